@@ -0,0 +1,1685 @@
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <disk.h>
+#include <fs.h>
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
+#define bench_error(fmt, ...) \
+	fprintf(stderr, "%s: "fmt"\n", __func__, ##__VA_ARGS__)
+
+#define die(...)				\
+do {							\
+	bench_error(__VA_ARGS__);	\
+	exit(1);					\
+} while (0)
+
+/* Size of the buffer handed to fs_write()/fs_read() */
+#define IO_CHUNK (1024 * 1024)
+/* Blocks written to each file in turn by the seek benchmark */
+#define SEEK_RUN 16
+
+struct bench_arg {
+	int argc;
+	char **argv;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t get_size(char *arg)
+{
+	char *end;
+	long long ret = strtoll(arg, &end, 0);
+
+	if (*end != '\0' || ret <= 0)
+		die("invalid size '%s'", arg);
+	return (size_t)ret;
+}
+
+/* Heap allocations made by the fs per MB transferred, since @before */
+static double allocs_per_mb(const struct fs_stats *before, size_t bytes)
+{
+	struct fs_stats after;
+
+	if (fs_stats(&after))
+		die("Cannot get stats");
+	return (after.allocations - before->allocations) /
+		((double)bytes / (1 << 20));
+}
+
+/*
+ * Write a file of @size bytes sequentially into the mounted fs, then read it
+ * back and check its content. Prints throughput and allocations per MB of
+ * both passes.
+ */
+static void bench_file_rw(const char *filename, size_t size)
+{
+	struct fs_stats stats;
+	char *buf;
+	size_t done, chunk;
+	double t;
+	int fd, ret;
+
+	buf = malloc(IO_CHUNK);
+	if (!buf)
+		die("Cannot malloc");
+
+	if (fs_create(filename))
+		die("Cannot create file");
+	fd = fs_open(filename);
+	if (fd < 0)
+		die("Cannot open file");
+
+	if (fs_stats(&stats))
+		die("Cannot get stats");
+	t = now();
+	for (done = 0; done < size; done += chunk) {
+		chunk = size - done < IO_CHUNK ? size - done : IO_CHUNK;
+		memset(buf, (int)(done / IO_CHUNK), chunk);
+		ret = fs_write(fd, buf, chunk);
+		if (ret != (int)chunk)
+			die("short write (%d/%zu)", ret, chunk);
+	}
+	t = now() - t;
+	printf("write: %zu MB in %.3f s (%.1f MB/s, %.2f allocs/MB)\n",
+	       size >> 20, t, (size >> 20) / t, allocs_per_mb(&stats, size));
+
+	if (fs_lseek(fd, 0) || fs_stats(&stats))
+		die("Cannot seek");
+	t = now();
+	for (done = 0; done < size; done += chunk) {
+		chunk = size - done < IO_CHUNK ? size - done : IO_CHUNK;
+		ret = fs_read(fd, buf, chunk);
+		if (ret != (int)chunk)
+			die("short read (%d/%zu)", ret, chunk);
+		if (buf[0] != (char)(done / IO_CHUNK) ||
+			buf[chunk - 1] != (char)(done / IO_CHUNK))
+			die("unexpected data at offset %zu", done);
+	}
+	t = now() - t;
+	printf("read: %zu MB in %.3f s (%.1f MB/s, %.2f allocs/MB)\n",
+	       size >> 20, t, (size >> 20) / t, allocs_per_mb(&stats, size));
+
+	if (fs_close(fd))
+		die("Cannot close file");
+	free(buf);
+}
+
+/*
+ * append <diskname> <writes> <bytes per write>
+ * Append to a file with many small writes, as loggers do, and report the
+ * time taken and the blocks read and written.
+ */
+static void bench_append(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	struct fs_format_opts opts = { .flags = FS_FORMAT_FAT32 };
+	struct fs_stats stats;
+	char *diskname, buf[4096];
+	size_t writes, len, i;
+	double t;
+	int fd;
+
+	if (b_arg->argc < 3)
+		die("Usage: <diskname> <writes> <bytes per write>");
+
+	diskname = b_arg->argv[0];
+	writes = get_size(b_arg->argv[1]);
+	len = get_size(b_arg->argv[2]);
+	if (len > sizeof(buf))
+		die("at most %zu bytes per write", sizeof(buf));
+
+	if (fs_format(diskname, writes * len / BLOCK_SIZE + 64, &opts))
+		die("Cannot format diskname");
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+	if (fs_create("log"))
+		die("Cannot create file");
+	fd = fs_open("log");
+	if (fd < 0)
+		die("Cannot open file");
+
+	t = now();
+	for (i = 0; i < writes; i++) {
+		memset(buf, 'a' + i % 26, len);
+		if (fs_write(fd, buf, len) != (int)len)
+			die("short write");
+	}
+	if (fs_close(fd))
+		die("Cannot close file");
+	t = now() - t;
+
+	if (fs_stats(&stats))
+		die("Cannot get stats");
+	printf("%zu writes of %zu bytes in %.3f s (%.2f us/write)\n", writes,
+	       len, t, t * 1e6 / writes);
+	printf("blocks read: %zu, blocks written: %zu, %.2f allocs/MB\n",
+	       stats.blocks_read, stats.blocks_written,
+	       stats.allocations / ((double)writes * len / (1 << 20)));
+
+	if (fs_umount())
+		die("Cannot unmount diskname");
+	unlink(diskname);
+}
+
+/*
+ * bigimage <diskname> <image GB> [<file MB> [<cluster blocks>]]
+ * Format a 32-bit FAT image of the given size, then time mount, a large
+ * sequential write and read-back, and unmount.
+ */
+static void bench_bigimage(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	struct fs_format_opts opts = { .flags = FS_FORMAT_FAT32 };
+	char *diskname;
+	size_t blocks, file_size = 256 << 20;
+	double t;
+
+	if (b_arg->argc < 2)
+		die("Usage: <diskname> <image GB> [<file MB> [<cluster blocks>]]");
+
+	diskname = b_arg->argv[0];
+	blocks = get_size(b_arg->argv[1]) * (1024 * 1024 * 1024 / BLOCK_SIZE);
+	if (b_arg->argc > 2)
+		file_size = get_size(b_arg->argv[2]) << 20;
+	if (b_arg->argc > 3)
+		opts.cluster_blocks = get_size(b_arg->argv[3]);
+
+	t = now();
+	if (fs_format(diskname, blocks, &opts))
+		die("Cannot format diskname");
+	printf("format: %zu data blocks (%u per cluster) in %.3f s\n", blocks,
+		   opts.cluster_blocks ? opts.cluster_blocks : 1, now() - t);
+
+	t = now();
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+	printf("mount: %.3f s\n", now() - t);
+
+	bench_file_rw("big", file_size);
+
+	t = now();
+	if (fs_umount())
+		die("Cannot unmount diskname");
+	printf("umount: %.3f s\n", now() - t);
+
+	unlink(diskname);
+}
+
+/*
+ * interleave <diskname> <files> <file MB> <bytes per write>
+ * Grow several files at once with round-robin appends, then report how many
+ * extents each file ended up in.
+ */
+static void bench_interleave(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	struct fs_format_opts opts = { .flags = FS_FORMAT_FAT32 };
+	char *diskname, name[FS_FILENAME_LEN], buf[4096];
+	size_t files, size, len, done, i, extents = 0;
+	int fds[FS_OPEN_MAX_COUNT], ret;
+	double t;
+
+	if (b_arg->argc < 4)
+		die("Usage: <diskname> <files> <file MB> <bytes per write>");
+
+	diskname = b_arg->argv[0];
+	files = get_size(b_arg->argv[1]);
+	size = get_size(b_arg->argv[2]) * 1024 * 1024;
+	len = get_size(b_arg->argv[3]);
+	if (files > FS_OPEN_MAX_COUNT || len > sizeof(buf))
+		die("at most %d files and %zu bytes per write",
+		    FS_OPEN_MAX_COUNT, sizeof(buf));
+
+	if (fs_format(diskname, files * size / BLOCK_SIZE + 64, &opts))
+		die("Cannot format diskname");
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+	for (i = 0; i < files; i++) {
+		snprintf(name, sizeof(name), "f%zu", i);
+		if (fs_create(name))
+			die("Cannot create file");
+		fds[i] = fs_open(name);
+		if (fds[i] < 0)
+			die("Cannot open file");
+	}
+
+	t = now();
+	memset(buf, 'x', len);
+	for (done = 0; done < size; done += len)
+		for (i = 0; i < files; i++)
+			if (fs_write(fds[i], buf, len) != (int)len)
+				die("short write");
+	for (i = 0; i < files; i++)
+		if (fs_close(fds[i]))
+			die("Cannot close file");
+	t = now() - t;
+
+	for (i = 0; i < files; i++) {
+		snprintf(name, sizeof(name), "f%zu", i);
+		fds[0] = fs_open(name);
+		ret = fs_extents(fds[0], NULL, 0);
+		if (ret < 0)
+			die("Cannot map file");
+		extents += ret;
+		fs_close(fds[0]);
+	}
+
+	printf("%zu files of %zu MB in %.3f s, %.1f extents per file\n",
+	       files, size >> 20, t, (double)extents / files);
+
+	if (fs_umount())
+		die("Cannot unmount diskname");
+	unlink(diskname);
+}
+
+/*
+ * mount <diskname> <max image GB>
+ * Time mount and unmount of empty 32-bit FAT images of 1 GB, then doubling
+ * sizes up to the given size.
+ */
+static void bench_mount(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	struct fs_format_opts opts = { .flags = FS_FORMAT_FAT32 };
+	char *diskname;
+	size_t gb, max_gb;
+	double t_mount, t_umount;
+
+	if (b_arg->argc < 2)
+		die("Usage: <diskname> <max image GB>");
+
+	diskname = b_arg->argv[0];
+	max_gb = get_size(b_arg->argv[1]);
+
+	for (gb = 1; gb <= max_gb; gb *= 2) {
+		if (fs_format(diskname, gb * (1024 * 1024 * 1024 / BLOCK_SIZE),
+			      &opts))
+			die("Cannot format diskname");
+
+		t_mount = now();
+		if (fs_mount(diskname))
+			die("Cannot mount diskname");
+		t_mount = now() - t_mount;
+
+		t_umount = now();
+		if (fs_umount())
+			die("Cannot unmount diskname");
+		t_umount = now() - t_umount;
+
+		printf("%zu GB: mount %.1f us, umount %.1f us\n", gb,
+		       t_mount * 1e6, t_umount * 1e6);
+	}
+
+	unlink(diskname);
+}
+
+/*
+ * dirscale <diskname> <entries>
+ * Fill one subdirectory with up to <entries> files, and time creation and
+ * random lookups each time the directory grows tenfold.
+ */
+static void bench_dirscale(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	struct fs_format_opts opts = { .flags = FS_FORMAT_FAT32 };
+	char *diskname, path[FS_FILENAME_LEN * 2];
+	size_t entries, created = 0, before, step, i;
+	const size_t lookups = 10000;
+	double t;
+	int fd;
+
+	if (b_arg->argc < 2)
+		die("Usage: <diskname> <entries>");
+
+	diskname = b_arg->argv[0];
+	entries = get_size(b_arg->argv[1]);
+
+	/* Buckets hold 128 entries, leave room for hashing imbalance */
+	if (fs_format(diskname, entries / 16 + 64, &opts))
+		die("Cannot format diskname");
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+	if (fs_mkdir("dir"))
+		die("Cannot create directory");
+
+	srand(1);
+	for (step = 1000; created < entries; step *= 10) {
+		if (step > entries)
+			step = entries;
+
+		before = created;
+		t = now();
+		for (; created < step; created++) {
+			snprintf(path, sizeof(path), "dir/f%09zu", created);
+			if (fs_create(path))
+				die("Cannot create file '%s'", path);
+		}
+		t = now() - t;
+		printf("%zu entries: create %.2f us/op", created,
+			   t * 1e6 / (created - before));
+
+		t = now();
+		for (i = 0; i < lookups; i++) {
+			snprintf(path, sizeof(path), "dir/f%09zu",
+					 (size_t)rand() % created);
+			fd = fs_open(path);
+			if (fd < 0)
+				die("Cannot open file '%s'", path);
+			fs_close(fd);
+		}
+		t = now() - t;
+		printf(", lookup %.2f us/op\n", t * 1e6 / lookups);
+	}
+
+	if (fs_umount())
+		die("Cannot unmount diskname");
+	unlink(diskname);
+}
+
+/*
+ * Run test_fs.x, found next to this program, with arguments @args from
+ * host directory @dir
+ */
+static void run_test_fs(const char *dir, const char *args)
+{
+	char self[PATH_MAX], cmd[2 * PATH_MAX + 256];
+	ssize_t len;
+
+	len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+	if (len < 0)
+		die("Cannot locate program");
+	self[len] = '\0';
+	snprintf(cmd, sizeof(cmd), "cd '%s' && '%s/test_fs.x' %s >/dev/null",
+		 dir, dirname(self), args);
+	if (system(cmd))
+		die("'%s' failed", cmd);
+}
+
+/*
+ * import <diskname> <files> <file KB>
+ * Create up to 128 host files, then time loading them into a 32-bit image with
+ * one test_fs.x add per file, and with a single test_fs.x import.
+ */
+static void bench_import(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	struct fs_format_opts opts = { .flags = FS_FORMAT_FAT32 };
+	char dir[] = "/tmp/bench_import.XXXXXX";
+	char disk[PATH_MAX], path[PATH_MAX + 32], args[2 * PATH_MAX + 32];
+	size_t files, size, i;
+	double t_add, t_import;
+	char *buf;
+	FILE *f;
+
+	if (b_arg->argc < 3)
+		die("Usage: <diskname> <files> <file KB>");
+
+	files = get_size(b_arg->argv[1]);
+	size = get_size(b_arg->argv[2]) * 1024;
+	/* add only creates files in the root directory */
+	if (files > FS_FILE_MAX_COUNT)
+		die("at most %d files", FS_FILE_MAX_COUNT);
+
+	/* Host files, named f<n> so that add stores them under the same name */
+	if (!mkdtemp(dir))
+		die("Cannot create host directory");
+	buf = malloc(size);
+	if (!buf)
+		die("Cannot malloc");
+	for (i = 0; i < files; i++) {
+		memset(buf, (int)i, size);
+		snprintf(path, sizeof(path), "%s/f%zu", dir, i);
+		f = fopen(path, "w");
+		if (!f || fwrite(buf, 1, size, f) != size || fclose(f))
+			die("Cannot write host file '%s'", path);
+	}
+	free(buf);
+
+	if (fs_format(b_arg->argv[0], files * (size / BLOCK_SIZE + 1) + 64,
+		      &opts))
+		die("Cannot format diskname");
+	if (!realpath(b_arg->argv[0], disk))
+		die("Cannot resolve diskname");
+
+	t_add = now();
+	for (i = 0; i < files; i++) {
+		snprintf(args, sizeof(args), "add '%s' f%zu", disk, i);
+		run_test_fs(dir, args);
+	}
+	t_add = now() - t_add;
+
+	if (fs_format(disk, files * (size / BLOCK_SIZE + 1) + 64, &opts))
+		die("Cannot format diskname");
+	t_import = now();
+	snprintf(args, sizeof(args), "import '%s' .", disk);
+	run_test_fs(dir, args);
+	t_import = now() - t_import;
+
+	printf("add: %zu files in %.3f s (%.1f MB/s)\n", files, t_add,
+	       files * size / 1048576.0 / t_add);
+	printf("import: %zu files in %.3f s (%.1f MB/s)\n", files, t_import,
+	       files * size / 1048576.0 / t_import);
+
+	for (i = 0; i < files; i++) {
+		snprintf(path, sizeof(path), "%s/f%zu", dir, i);
+		unlink(path);
+	}
+	rmdir(dir);
+	unlink(disk);
+}
+
+/*
+ * Fill @buf with @size bytes of synthetic service logs, which compress about
+ * as well as real ones
+ */
+static void gen_log(char *buf, size_t size)
+{
+	static const char *levels[] = { "INFO", "INFO", "INFO", "WARN", "DEBUG" };
+	static const char *paths[] = { "/api/v1/items", "/api/v1/users",
+				       "/healthz", "/api/v2/orders" };
+	char line[256];
+	size_t done = 0, len;
+	unsigned int i = 0;
+
+	srand(1);
+	while (done < size) {
+		len = snprintf(line, sizeof(line),
+			       "2026-10-18T%02u:%02u:%02u.%03u %s worker-%u "
+			       "request id=%u path=%s status=%u latency_ms=%u\n",
+			       i / 3600000 % 24, i / 60000 % 60, i / 1000 % 60,
+			       i % 1000, levels[rand() % ARRAY_SIZE(levels)],
+			       rand() % 8, rand(), paths[rand() % ARRAY_SIZE(paths)],
+			       rand() % 10 ? 200 : 500, rand() % 300);
+		if (len > size - done)
+			len = size - done;
+		memcpy(buf + done, line, len);
+		done += len;
+		i += rand() % 50;
+	}
+}
+
+/*
+ * clone <diskname> <file MB>
+ * Duplicate a file by copying it through the API then by cloning it, and
+ * report the time of both and of the first writes into the clone.
+ */
+static void bench_clone(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	struct fs_format_opts opts = { .flags = FS_FORMAT_FAT32 };
+	char *diskname, *buf;
+	size_t size, off, i;
+	double t, t_copy, t_clone, t_first, t_last;
+	int fd, fd2;
+
+	if (b_arg->argc < 2)
+		die("Usage: <diskname> <file MB>");
+
+	diskname = b_arg->argv[0];
+	size = get_size(b_arg->argv[1]) << 20;
+	buf = malloc(IO_CHUNK);
+	if (!buf)
+		die("Cannot malloc");
+	memset(buf, 'c', IO_CHUNK);
+
+	if (fs_format(diskname, 4 * (size / BLOCK_SIZE), &opts))
+		die("Cannot format diskname");
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+	if (fs_create("src"))
+		die("Cannot create file");
+	fd = fs_open("src");
+	if (fd < 0)
+		die("Cannot open file");
+	for (off = 0; off < size; off += IO_CHUNK)
+		if (fs_write(fd, buf, IO_CHUNK) != IO_CHUNK)
+			die("Cannot write file");
+	if (fs_close(fd))
+		die("Cannot close file");
+
+	/* Copy through the API, as done without cloning */
+	t = now();
+	if (fs_create("copy"))
+		die("Cannot create file");
+	fd = fs_open("src");
+	fd2 = fs_open("copy");
+	if (fd < 0 || fd2 < 0)
+		die("Cannot open file");
+	for (off = 0; off < size; off += IO_CHUNK)
+		if (fs_read(fd, buf, IO_CHUNK) != IO_CHUNK ||
+		    fs_write(fd2, buf, IO_CHUNK) != IO_CHUNK)
+			die("Cannot copy file");
+	if (fs_close(fd) || fs_close(fd2))
+		die("Cannot close file");
+	t_copy = now() - t;
+
+	t = now();
+	if (fs_clone("src", "clone"))
+		die("Cannot clone file");
+	t_clone = now() - t;
+
+	/* First writes into the clone, at its start then at its end */
+	fd = fs_open("clone");
+	if (fd < 0)
+		die("Cannot open file");
+	t = now();
+	if (fs_write(fd, buf, BLOCK_SIZE) != BLOCK_SIZE)
+		die("Cannot write clone");
+	t_first = now() - t;
+	if (fs_lseek(fd, size - BLOCK_SIZE))
+		die("Cannot seek clone");
+	t = now();
+	if (fs_write(fd, buf, BLOCK_SIZE) != BLOCK_SIZE)
+		die("Cannot write clone");
+	t_last = now() - t;
+	if (fs_close(fd))
+		die("Cannot close file");
+
+	/* The source is unchanged */
+	fd = fs_open("src");
+	if (fd < 0)
+		die("Cannot open file");
+	for (off = 0; off < size; off += IO_CHUNK) {
+		if (fs_read(fd, buf, IO_CHUNK) != IO_CHUNK)
+			die("Cannot read file");
+		for (i = 0; i < IO_CHUNK; i++)
+			if (buf[i] != 'c')
+				die("Source changed at %zu", off + i);
+	}
+	if (fs_close(fd) || fs_umount())
+		die("Cannot unmount diskname");
+
+	printf("copy: %.1f ms, clone: %.3f ms, first write at start: %.3f ms, "
+	       "at end: %.1f ms\n", t_copy * 1e3, t_clone * 1e3,
+	       t_first * 1e3, t_last * 1e3);
+
+	free(buf);
+	unlink(diskname);
+}
+
+/*
+ * dedup <diskname> <artifacts> <artifact MB>
+ * Write near-identical artifacts, differing in their first block, with and
+ * without deduplication, and report the write throughput and the space used.
+ */
+static void bench_dedup(void *arg)
+{
+	static const struct {
+		const char *name;
+		unsigned int flags;
+	} modes[] = {
+		{ "plain",	0 },
+		{ "dedup",	FS_MOUNT_DEDUP },
+	};
+	struct bench_arg *b_arg = arg;
+	struct fs_format_opts opts = { .flags = FS_FORMAT_FAT32 };
+	struct fs_mount_opts mopts = { 0 };
+	struct fs_stats stats;
+	char *diskname, *buf, name[32];
+	size_t artifacts, size, used, i, m, off;
+	double t;
+	int fd;
+
+	if (b_arg->argc < 3)
+		die("Usage: <diskname> <artifacts> <artifact MB>");
+
+	diskname = b_arg->argv[0];
+	artifacts = get_size(b_arg->argv[1]);
+	size = get_size(b_arg->argv[2]) << 20;
+	buf = malloc(size);
+	if (!buf)
+		die("Cannot malloc");
+	srand(1);
+	for (off = 0; off < size; off++)
+		buf[off] = rand();
+
+	for (m = 0; m < ARRAY_SIZE(modes); m++) {
+		mopts.flags = modes[m].flags;
+		if (fs_format(diskname, artifacts * (size / BLOCK_SIZE) + 1024,
+			      &opts))
+			die("Cannot format diskname");
+		if (fs_mount_opts(diskname, &mopts) || fs_stats(&stats))
+			die("Cannot mount diskname");
+		used = stats.free_clusters;
+
+		t = now();
+		for (i = 0; i < artifacts; i++) {
+			snprintf(name, sizeof(name), "a%zu", i);
+			snprintf(buf, BLOCK_SIZE, "artifact %zu", i);
+			if (fs_create(name))
+				die("Cannot create file");
+			fd = fs_open(name);
+			if (fd < 0)
+				die("Cannot open file");
+			for (off = 0; off < size; off += IO_CHUNK)
+				if (fs_write(fd, buf + off, IO_CHUNK) != IO_CHUNK)
+					die("Cannot write file");
+			if (fs_close(fd))
+				die("Cannot close file");
+		}
+		t = now() - t;
+
+		if (fs_stats(&stats))
+			die("Cannot get stats");
+		used -= stats.free_clusters;
+		printf("%s: %.1f MB/s, %zu MB used, dedup ratio %.2f, "
+		       "%zu clusters shared\n", modes[m].name,
+		       artifacts * (size >> 20) / t,
+		       used * stats.cluster_size >> 20,
+		       (double)artifacts * size / (used * stats.cluster_size),
+		       stats.dedup_clusters);
+		if (fs_umount())
+			die("Cannot unmount diskname");
+	}
+
+	free(buf);
+	unlink(diskname);
+}
+
+/* Copy host file @src to @dst, returning the number of bytes copied */
+static size_t host_copy(const char *src, const char *dst, char *buf)
+{
+	size_t total = 0;
+	ssize_t n;
+	int in, out;
+
+	in = open(src, O_RDONLY);
+	out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (in < 0 || out < 0)
+		die("Cannot open %s or %s", src, dst);
+	while ((n = read(in, buf, IO_CHUNK)) > 0) {
+		if (write(out, buf, n) != n)
+			die("Cannot write %s", dst);
+		total += n;
+	}
+	if (n < 0 || fsync(out))
+		die("Cannot copy %s", src);
+	close(in);
+	close(out);
+	return total;
+}
+
+/*
+ * delta <diskname> <image MB> <changed MB>
+ * Fill an image, take a checkpoint and keep a copy of it, then overwrite
+ * scattered MBs of its file. Report the time and size of a full copy of the
+ * image against those of exporting the changed blocks, and the time to bring
+ * the copy up to date with them.
+ */
+static void bench_delta(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	struct fs_format_opts opts = { .flags = FS_FORMAT_FAT32 };
+	char *diskname, *buf, copyname[PATH_MAX], deltaname[PATH_MAX];
+	size_t size, changed, off, full, blocks;
+	double t_full, t_export, t_apply, t;
+	struct stat st;
+	int fd;
+
+	if (b_arg->argc < 3)
+		die("Usage: <diskname> <image MB> <changed MB>");
+
+	diskname = b_arg->argv[0];
+	size = get_size(b_arg->argv[1]) << 20;
+	changed = get_size(b_arg->argv[2]);
+	if (changed > size >> 20)
+		die("Cannot change more than the image");
+	snprintf(copyname, sizeof(copyname), "%s.copy", diskname);
+	snprintf(deltaname, sizeof(deltaname), "%s.delta", diskname);
+	buf = malloc(IO_CHUNK);
+	if (!buf)
+		die("Cannot malloc");
+	memset(buf, 'b', IO_CHUNK);
+
+	if (fs_format(diskname, size / BLOCK_SIZE + 1024, &opts))
+		die("Cannot format diskname");
+	if (fs_mount(diskname) || fs_create("file"))
+		die("Cannot create file");
+	fd = fs_open("file");
+	if (fd < 0)
+		die("Cannot open file");
+	for (off = 0; off < size; off += IO_CHUNK)
+		if (fs_write(fd, buf, IO_CHUNK) != IO_CHUNK)
+			die("Cannot write file");
+	if (fs_close(fd) || fs_checkpoint() || fs_umount())
+		die("Cannot take checkpoint");
+	host_copy(diskname, copyname, buf);
+
+	srand(1);
+	memset(buf, 'c', IO_CHUNK);
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+	fd = fs_open("file");
+	if (fd < 0)
+		die("Cannot open file");
+	for (off = 0; off < changed; off++) {
+		if (fs_lseek(fd, (size_t)rand() % (size >> 20) << 20) ||
+		    fs_write(fd, buf, IO_CHUNK) != IO_CHUNK)
+			die("Cannot write file");
+	}
+	if (fs_close(fd))
+		die("Cannot close file");
+
+	t = now();
+	if (fs_delta_export(deltaname, FS_DELTA_CHECKPOINT, &blocks))
+		die("Cannot export delta");
+	t_export = now() - t;
+	if (fs_umount())
+		die("Cannot unmount diskname");
+	t = now();
+	if (fs_delta_apply(copyname, deltaname))
+		die("Cannot apply delta");
+	t_apply = now() - t;
+	if (stat(deltaname, &st))
+		die("Cannot stat delta");
+
+	t = now();
+	full = host_copy(diskname, copyname, buf);
+	t_full = now() - t;
+
+	printf("full copy: %.1f MB, %.1f ms\n", full / 1048576.0, t_full * 1e3);
+	printf("delta: %zu blocks, %.1f MB, export: %.1f ms, apply: %.1f ms\n",
+	       blocks, st.st_size / 1048576.0, t_export * 1e3, t_apply * 1e3);
+
+	free(buf);
+	unlink(deltaname);
+	unlink(copyname);
+	unlink(diskname);
+}
+
+/*
+ * compress <diskname> <file MB>
+ * Write then read back a log file on a plain and on a compressed image, and
+ * report throughput, storage ratio and blocks of host I/O of both.
+ */
+static void bench_compress(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	struct fs_format_opts opts = { .flags = FS_FORMAT_FAT32 };
+	struct fs_stats before, after;
+	char *diskname, *data, *buf;
+	size_t size, done, chunk, used;
+	double tw, tr;
+	int fd, mode;
+
+	if (b_arg->argc < 2)
+		die("Usage: <diskname> <file MB>");
+
+	diskname = b_arg->argv[0];
+	size = get_size(b_arg->argv[1]) << 20;
+
+	data = malloc(size);
+	buf = malloc(IO_CHUNK);
+	if (!data || !buf)
+		die("Cannot malloc");
+	gen_log(data, size);
+
+	for (mode = 0; mode < 2; mode++) {
+		if (mode)
+			opts.flags |= FS_FORMAT_COMPRESS;
+		if (fs_format(diskname, size / BLOCK_SIZE + 64, &opts))
+			die("Cannot format diskname");
+		if (fs_mount(diskname) || fs_stats(&before))
+			die("Cannot mount diskname");
+		if (fs_create("log"))
+			die("Cannot create file");
+		fd = fs_open("log");
+		if (fd < 0)
+			die("Cannot open file");
+
+		tw = now();
+		for (done = 0; done < size; done += chunk) {
+			chunk = size - done < IO_CHUNK ? size - done : IO_CHUNK;
+			if (fs_write(fd, data + done, chunk) != (int)chunk)
+				die("short write");
+		}
+		tw = now() - tw;
+
+		if (fs_lseek(fd, 0))
+			die("Cannot seek");
+		tr = now();
+		for (done = 0; done < size; done += chunk) {
+			chunk = size - done < IO_CHUNK ? size - done : IO_CHUNK;
+			if (fs_read(fd, buf, chunk) != (int)chunk)
+				die("short read");
+			if (memcmp(buf, data + done, chunk))
+				die("unexpected data at offset %zu", done);
+		}
+		tr = now() - tr;
+
+		if (fs_close(fd) || fs_stats(&after))
+			die("Cannot close file");
+		used = (before.free_clusters - after.free_clusters) *
+			after.cluster_size;
+		printf("%s: write %.1f MB/s, read %.1f MB/s, ratio %.2f, "
+		       "host I/O %zu blocks written, %zu read, "
+		       "%.2f allocs/MB\n",
+		       mode ? "compressed" : "plain", (size >> 20) / tw,
+		       (size >> 20) / tr, (double)size / used,
+		       after.blocks_written - before.blocks_written,
+		       after.blocks_read - before.blocks_read,
+		       (after.allocations - before.allocations) /
+		       (2.0 * size / (1 << 20)));
+
+		if (fs_umount())
+			die("Cannot unmount diskname");
+	}
+
+	unlink(diskname);
+	free(data);
+	free(buf);
+}
+
+/* Number of pages of @filename resident in the host's page cache */
+static size_t cached_pages(const char *filename)
+{
+	unsigned char *vec;
+	struct stat st;
+	size_t pages, i, n = 0;
+	void *map;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st))
+		die("Cannot open %s", filename);
+	pages = (st.st_size + getpagesize() - 1) / getpagesize();
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	vec = malloc(pages);
+	if (map == MAP_FAILED || !vec || mincore(map, st.st_size, vec))
+		die("Cannot map %s", filename);
+	for (i = 0; i < pages; i++)
+		n += vec[i] & 1;
+	free(vec);
+	munmap(map, st.st_size);
+	close(fd);
+	return n;
+}
+
+/* Drop the pages of @filename from the host's page cache */
+static void drop_cache(const char *filename)
+{
+	int fd = open(filename, O_RDONLY);
+
+	if (fd < 0 || fdatasync(fd) ||
+	    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED))
+		die("Cannot drop cache of %s", filename);
+	close(fd);
+}
+
+/*
+ * direct <diskname> <file MB>
+ * Scan a file through the page cache, then with direct I/O, and report the
+ * throughput, the worst latency of a read and the host memory left holding the
+ * image in each mode.
+ */
+static void bench_direct(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	struct fs_format_opts opts = { .flags = FS_FORMAT_FAT32 };
+	struct fs_mount_opts mopts = { 0 };
+	char *diskname, *buf;
+	size_t size, done, chunk;
+	double t, lat, worst;
+	int fd, mode;
+
+	if (b_arg->argc < 2)
+		die("Usage: <diskname> <file MB>");
+
+	diskname = b_arg->argv[0];
+	size = get_size(b_arg->argv[1]) << 20;
+
+	/* Misaligned on purpose, as callers' buffers may be */
+	buf = malloc(IO_CHUNK + 1);
+	if (!buf)
+		die("Cannot malloc");
+
+	if (fs_format(diskname, size / BLOCK_SIZE + 64, &opts))
+		die("Cannot format diskname");
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+	if (fs_create("scan"))
+		die("Cannot create file");
+	fd = fs_open("scan");
+	if (fd < 0)
+		die("Cannot open file");
+	for (done = 0; done < size; done += chunk) {
+		chunk = size - done < IO_CHUNK ? size - done : IO_CHUNK;
+		memset(buf + 1, (int)(done / IO_CHUNK), chunk);
+		if (fs_write(fd, buf + 1, chunk) != (int)chunk)
+			die("short write");
+	}
+	if (fs_close(fd) || fs_umount())
+		die("Cannot unmount diskname");
+
+	for (mode = 0; mode < 2; mode++) {
+		mopts.flags = mode ? FS_MOUNT_DIRECT : 0;
+		drop_cache(diskname);
+		if (fs_mount_opts(diskname, &mopts))
+			die("Cannot mount diskname");
+		fd = fs_open("scan");
+		if (fd < 0)
+			die("Cannot open file");
+
+		worst = 0;
+		t = now();
+		for (done = 0; done < size; done += chunk) {
+			chunk = size - done < IO_CHUNK ? size - done : IO_CHUNK;
+			lat = now();
+			if (fs_read(fd, buf + 1, chunk) != (int)chunk)
+				die("short read");
+			lat = now() - lat;
+			if (lat > worst)
+				worst = lat;
+			if (buf[1] != (char)(done / IO_CHUNK) ||
+			    buf[chunk] != (char)(done / IO_CHUNK))
+				die("unexpected data at offset %zu", done);
+		}
+		t = now() - t;
+
+		if (fs_close(fd) || fs_umount())
+			die("Cannot unmount diskname");
+		printf("%s: read %.1f MB/s, worst read %.2f ms, "
+		       "%zu MB of image in page cache\n",
+		       mode ? "direct" : "buffered", (size >> 20) / t,
+		       worst * 1e3,
+		       cached_pages(diskname) * getpagesize() >> 20);
+	}
+
+	unlink(diskname);
+	free(buf);
+}
+
+/*
+ * sync <diskname> <writers> <appends>
+ * Writers take turns appending 4 KB records, each append opening and closing
+ * the writer's file, under each durability policy. Reports the appends per
+ * second, and the number and latency of the syncs issued.
+ */
+static void bench_sync(void *arg)
+{
+	static const struct {
+		const char *name;
+		unsigned int flags;
+	} policies[] = {
+		{ "none",	0 },
+		{ "close",	FS_MOUNT_SYNC_CLOSE },
+		{ "periodic",	FS_MOUNT_SYNC_PERIODIC },
+	};
+	struct bench_arg *b_arg = arg;
+	struct fs_format_opts opts = { .flags = FS_FORMAT_FAT32 };
+	struct fs_mount_opts mopts = { 0 };
+	struct fs_stats stats;
+	char *diskname, name[16], buf[4096];
+	size_t writers, appends, i, p;
+	double t;
+	int fd;
+
+	if (b_arg->argc < 3)
+		die("Usage: <diskname> <writers> <appends>");
+
+	diskname = b_arg->argv[0];
+	writers = get_size(b_arg->argv[1]);
+	appends = get_size(b_arg->argv[2]);
+	if (writers > FS_FILE_MAX_COUNT)
+		die("at most %d writers", FS_FILE_MAX_COUNT);
+	memset(buf, 'l', sizeof(buf));
+
+	for (p = 0; p < ARRAY_SIZE(policies); p++) {
+		mopts.flags = policies[p].flags;
+		if (fs_format(diskname, appends + 64, &opts))
+			die("Cannot format diskname");
+		if (fs_mount_opts(diskname, &mopts))
+			die("Cannot mount diskname");
+		for (i = 0; i < writers; i++) {
+			snprintf(name, sizeof(name), "w%zu", i);
+			if (fs_create(name))
+				die("Cannot create file");
+		}
+
+		t = now();
+		for (i = 0; i < appends; i++) {
+			snprintf(name, sizeof(name), "w%zu", i % writers);
+			fd = fs_open(name);
+			if (fd < 0)
+				die("Cannot open file");
+			if (fs_lseek(fd, (i / writers) * sizeof(buf)) ||
+			    fs_write(fd, buf, sizeof(buf)) != sizeof(buf) ||
+			    fs_close(fd))
+				die("Cannot append");
+		}
+		t = now() - t;
+
+		if (fs_stats(&stats))
+			die("Cannot get stats");
+		printf("%s: %.0f appends/s, %zu syncs, %.1f us/sync avg, "
+		       "%zu us max\n", policies[p].name, appends / t,
+		       stats.syncs, stats.syncs ?
+		       (double)stats.sync_usecs / stats.syncs : 0.0,
+		       stats.sync_max_usecs);
+		if (fs_umount())
+			die("Cannot unmount diskname");
+	}
+
+	unlink(diskname);
+}
+
+/*
+ * reclaim <diskname> <file MB>
+ * Delete a large file on an image it fills, then write another one as large,
+ * and report the time of the delete, the throughput of the write that reuses
+ * the clusters as they are reclaimed, and the time of the unmount.
+ */
+static void bench_reclaim(void *arg)
+{
+	struct bench_arg *b_arg = arg;
+	struct fs_format_opts opts = { .flags = FS_FORMAT_FAT32 };
+	struct fs_stats stats;
+	char *diskname, *buf, *names[] = { "old", "new" };
+	size_t size, off, free_before, free_after;
+	double t, t_delete, t_write, t_umount;
+	int fd, i;
+
+	if (b_arg->argc < 2)
+		die("Usage: <diskname> <file MB>");
+
+	diskname = b_arg->argv[0];
+	size = get_size(b_arg->argv[1]) << 20;
+	buf = malloc(IO_CHUNK);
+	if (!buf)
+		die("Cannot malloc");
+	memset(buf, 'r', IO_CHUNK);
+
+	if (fs_format(diskname, size / BLOCK_SIZE + 1024, &opts))
+		die("Cannot format diskname");
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	t_delete = t_write = 0;
+	for (i = 0; i < 2; i++) {
+		t = now();
+		if (fs_create(names[i]))
+			die("Cannot create file");
+		fd = fs_open(names[i]);
+		if (fd < 0)
+			die("Cannot open file");
+		for (off = 0; off < size; off += IO_CHUNK)
+			if (fs_write(fd, buf, IO_CHUNK) != IO_CHUNK)
+				die("Cannot write file");
+		if (fs_close(fd))
+			die("Cannot close file");
+		t_write = now() - t;
+		if (i > 0)
+			break;
+
+		if (fs_stats(&stats))
+			die("Cannot get stats");
+		free_before = stats.free_clusters;
+		t = now();
+		if (fs_delete(names[i]))
+			die("Cannot delete file");
+		t_delete = now() - t;
+		if (fs_stats(&stats))
+			die("Cannot get stats");
+		free_after = stats.free_clusters;
+	}
+	if (fs_stats(&stats))
+		die("Cannot get stats");
+
+	t = now();
+	if (fs_umount())
+		die("Cannot unmount diskname");
+	t_umount = now() - t;
+
+	printf("delete: %.3f ms, %zu clusters freed by it, rewrite: %.1f MB/s, "
+	       "%zu clusters reclaimed, umount: %.1f ms\n", t_delete * 1e3,
+	       free_after - free_before, (size >> 20) / t_write,
+	       stats.reclaimed_clusters, t_umount * 1e3);
+
+	free(buf);
+	unlink(diskname);
+}
+
+/*
+ * sparse <diskname> <file MB>
+ * Make a file of the given size with one block of data at its end, by writing
+ * zeros up to it then by seeking past the end, and report the time, the space
+ * used and the blocks read to read the file back.
+ */
+static void bench_sparse(void *arg)
+{
+	static const char *modes[] = { "zeros", "sparse" };
+	struct bench_arg *b_arg = arg;
+	struct fs_format_opts opts = { .flags = FS_FORMAT_FAT32 };
+	struct fs_stats stats;
+	char *diskname, *buf;
+	size_t size, used, reads, off, i, m;
+	double t, t_write, t_read;
+	int fd;
+
+	if (b_arg->argc < 2)
+		die("Usage: <diskname> <file MB>");
+
+	diskname = b_arg->argv[0];
+	size = get_size(b_arg->argv[1]) << 20;
+	buf = malloc(IO_CHUNK);
+	if (!buf)
+		die("Cannot malloc");
+
+	for (m = 0; m < ARRAY_SIZE(modes); m++) {
+		if (fs_format(diskname, size / BLOCK_SIZE + 1024, &opts))
+			die("Cannot format diskname");
+		if (fs_mount(diskname) || fs_stats(&stats))
+			die("Cannot mount diskname");
+		used = stats.free_clusters;
+		if (fs_create("file"))
+			die("Cannot create file");
+		fd = fs_open("file");
+		if (fd < 0)
+			die("Cannot open file");
+
+		t_write = now();
+		memset(buf, 0, IO_CHUNK);
+		if (m == 0) {
+			for (off = 0; off < size - BLOCK_SIZE; off += i) {
+				i = size - BLOCK_SIZE - off < IO_CHUNK ?
+					size - BLOCK_SIZE - off : IO_CHUNK;
+				if (fs_write(fd, buf, i) != (int)i)
+					die("Cannot write file");
+			}
+		} else if (fs_lseek(fd, size - BLOCK_SIZE)) {
+			die("Cannot seek file");
+		}
+		memset(buf, 's', BLOCK_SIZE);
+		if (fs_write(fd, buf, BLOCK_SIZE) != BLOCK_SIZE)
+			die("Cannot write file");
+		if (fs_close(fd))
+			die("Cannot close file");
+		t_write = now() - t_write;
+
+		/* Read back, only the last block holds data */
+		if (fs_stats(&stats))
+			die("Cannot get stats");
+		used -= stats.free_clusters;
+		reads = stats.blocks_read;
+		fd = fs_open("file");
+		if (fd < 0 || fs_stat(fd) != (int)size)
+			die("Cannot open file");
+		t_read = 0;
+		for (off = 0; off < size; off += IO_CHUNK) {
+			t = now();
+			if (fs_read(fd, buf, IO_CHUNK) != IO_CHUNK)
+				die("Cannot read file");
+			t_read += now() - t;
+			for (i = 0; i < IO_CHUNK; i++)
+				if (buf[i] != (off + i < size - BLOCK_SIZE ? 0 : 's'))
+					die("Bad content at %zu", off + i);
+		}
+		if (fs_stats(&stats))
+			die("Cannot get stats");
+		reads = stats.blocks_read - reads;
+		if (fs_close(fd) || fs_umount())
+			die("Cannot unmount diskname");
+
+		printf("%s: write %.1f ms, %zu clusters used, read %.1f ms, "
+		       "%zu blocks read\n", modes[m], t_write * 1e3, used,
+		       t_read * 1e3, reads);
+	}
+
+	free(buf);
+	unlink(diskname);
+}
+
+/* Host disk space used by the virtual disk file, in MB */
+static double host_mb(const char *filename)
+{
+	struct stat st;
+
+	if (stat(filename, &st))
+		die("Cannot stat %s", filename);
+	return st.st_blocks * 512.0 / (1 << 20);
+}
+
+/*
+ * discard <diskname> <file MB>
+ * Write then delete a file, without and with FS_MOUNT_DISCARD, and report the
+ * host disk space used by the image after each step, then after an fs_trim()
+ * of the image mounted without discard.
+ */
+static void bench_discard(void *arg)
+{
+	static const char *modes[] = { "plain", "discard" };
+	struct bench_arg *b_arg = arg;
+	struct fs_format_opts opts = { .flags = FS_FORMAT_FAT32 };
+	struct fs_mount_opts mopts = { 0 };
+	char *diskname, *buf;
+	size_t size, off, m, blocks;
+	double written, deleted, t_delete, t_umount, t;
+	int fd;
+
+	if (b_arg->argc < 2)
+		die("Usage: <diskname> <file MB>");
+
+	diskname = b_arg->argv[0];
+	size = get_size(b_arg->argv[1]) << 20;
+	buf = malloc(IO_CHUNK);
+	if (!buf)
+		die("Cannot malloc");
+	memset(buf, 'd', IO_CHUNK);
+
+	for (m = 0; m < ARRAY_SIZE(modes); m++) {
+		mopts.flags = m ? FS_MOUNT_DISCARD : 0;
+		if (fs_format(diskname, size / BLOCK_SIZE + 1024, &opts))
+			die("Cannot format diskname");
+		if (fs_mount_opts(diskname, &mopts))
+			die("Cannot mount diskname");
+		if (fs_create("file"))
+			die("Cannot create file");
+		fd = fs_open("file");
+		if (fd < 0)
+			die("Cannot open file");
+		for (off = 0; off < size; off += IO_CHUNK)
+			if (fs_write(fd, buf, IO_CHUNK) != IO_CHUNK)
+				die("Cannot write file");
+		if (fs_close(fd))
+			die("Cannot close file");
+		written = host_mb(diskname);
+
+		t = now();
+		if (fs_delete("file"))
+			die("Cannot delete file");
+		t_delete = now() - t;
+		t = now();
+		if (fs_umount())
+			die("Cannot unmount diskname");
+		t_umount = now() - t;
+		deleted = host_mb(diskname);
+
+		printf("%s: %.1f MB used after write, %.1f MB after delete, "
+		       "delete: %.3f ms, umount: %.1f ms\n", modes[m], written,
+		       deleted, t_delete * 1e3, t_umount * 1e3);
+		if (m > 0)
+			break;
+
+		t = now();
+		if (fs_mount(diskname) || fs_trim(&blocks) || fs_umount())
+			die("Cannot trim diskname");
+		t = now() - t;
+		printf("trim: %zu blocks discarded, %.1f MB used after it, "
+		       "%.1f ms\n", blocks, host_mb(diskname), t * 1e3);
+	}
+
+	free(buf);
+	unlink(diskname);
+}
+
+/*
+ * readdir <diskname> <files> <rounds>
+ * Create <files> small files in the root directory, then time listing their
+ * names and sizes by opening and fs_stat()ing each file against one
+ * fs_readdir() call, with and without extent counts.
+ */
+static void bench_readdir(void *arg)
+{
+	static const char *modes[] = { "open+stat", "readdir", "readdir+extents" };
+	static struct fs_dirent ents[FS_FILE_MAX_COUNT];
+	struct bench_arg *b_arg = arg;
+	struct fs_format_opts opts = { .flags = FS_FORMAT_FAT32 };
+	char *diskname, name[FS_FILENAME_LEN], buf[BLOCK_SIZE];
+	size_t files, rounds, r, i, m, total;
+	double t;
+	int fd, n;
+
+	if (b_arg->argc < 3)
+		die("Usage: <diskname> <files> <rounds>");
+
+	diskname = b_arg->argv[0];
+	files = get_size(b_arg->argv[1]);
+	rounds = get_size(b_arg->argv[2]);
+	if (files > FS_FILE_MAX_COUNT)
+		die("Cannot create more than %d files", FS_FILE_MAX_COUNT);
+	memset(buf, 'r', sizeof(buf));
+
+	if (fs_format(diskname, 4 * files + 1024, &opts) || fs_mount(diskname))
+		die("Cannot mount diskname");
+	for (i = 0; i < files; i++) {
+		snprintf(name, sizeof(name), "file%zu", i);
+		if (fs_create(name))
+			die("Cannot create %s", name);
+		fd = fs_open(name);
+		if (fd < 0 || fs_write(fd, buf, sizeof(buf)) != sizeof(buf) ||
+		    fs_close(fd))
+			die("Cannot write %s", name);
+	}
+
+	for (m = 0; m < ARRAY_SIZE(modes); m++) {
+		total = 0;
+		t = now();
+		for (r = 0; r < rounds; r++) {
+			if (m > 0) {
+				n = fs_readdir(ents, FS_FILE_MAX_COUNT,
+					       m > 1 ? FS_READDIR_EXTENTS : 0);
+				if (n < 0)
+					die("Cannot read directory");
+				for (i = 0; i < (size_t)n; i++)
+					total += ents[i].size;
+				continue;
+			}
+			for (i = 0; i < files; i++) {
+				snprintf(name, sizeof(name), "file%zu", i);
+				fd = fs_open(name);
+				if (fd < 0)
+					die("Cannot open %s", name);
+				total += fs_stat(fd);
+				if (fs_close(fd))
+					die("Cannot close %s", name);
+			}
+		}
+		t = now() - t;
+		if (total != rounds * files * sizeof(buf))
+			die("Wrong sizes listed");
+		printf("%s: %.2f us per listing of %zu files\n", modes[m],
+		       t / rounds * 1e6, files);
+	}
+
+	if (fs_umount())
+		die("Cannot unmount diskname");
+	unlink(diskname);
+}
+
+/* Private (anonymous) memory of the calling process, in KB */
+static size_t rss_anon_kb(void)
+{
+	char line[256];
+	size_t kb = 0;
+	FILE *f = fopen("/proc/self/status", "r");
+
+	if (!f)
+		return 0;
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "RssAnon: %zu", &kb) == 1)
+			break;
+	fclose(f);
+	return kb;
+}
+
+/*
+ * readonly <diskname> <workers>
+ * Fork workers that each mount the same image, read all of its 256 files,
+ * count its free clusters and unmount it, without then with FS_MOUNT_READONLY.
+ * Report the time and private memory of a worker, and whether the image was
+ * written to.
+ */
+static void bench_readonly(void *arg)
+{
+	static const char *modes[] = { "plain", "readonly" };
+	struct bench_arg *b_arg = arg;
+	struct fs_format_opts opts = { .flags = FS_FORMAT_FAT32 };
+	struct fs_mount_opts mopts = { 0 };
+	struct fs_stats stats;
+	struct stat st;
+	struct timespec mtime;
+	char *diskname, *buf, path[FS_FILENAME_LEN * 2];
+	size_t workers, w, m, i, files = 256, file_size = 16 * BLOCK_SIZE;
+	double t, kb_max, *results;
+	int fd, status;
+
+	if (b_arg->argc < 2)
+		die("Usage: <diskname> <workers>");
+
+	diskname = b_arg->argv[0];
+	workers = get_size(b_arg->argv[1]);
+	buf = malloc(file_size);
+	/* Time & private KB of each worker, shared with them */
+	results = mmap(NULL, 2 * workers * sizeof(double),
+		       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (!buf || results == MAP_FAILED)
+		die("Cannot malloc");
+	memset(buf, 'o', file_size);
+
+	/* 1 GB image, whose FAT fills the metadata cache of a plain mount */
+	if (fs_format(diskname, 256 * 1024, &opts))
+		die("Cannot format diskname");
+	if (fs_mount(diskname) || fs_mkdir("dir"))
+		die("Cannot mount diskname");
+	for (i = 0; i < files; i++) {
+		snprintf(path, sizeof(path), "dir/f%zu", i);
+		if (fs_create(path))
+			die("Cannot create file");
+		fd = fs_open(path);
+		if (fd < 0 || fs_write(fd, buf, file_size) != (int)file_size ||
+		    fs_close(fd))
+			die("Cannot write file");
+	}
+	if (fs_umount())
+		die("Cannot unmount diskname");
+
+	for (m = 0; m < ARRAY_SIZE(modes); m++) {
+		mopts.flags = m ? FS_MOUNT_READONLY : 0;
+		if (stat(diskname, &st))
+			die("Cannot stat diskname");
+		mtime = st.st_mtim;
+
+		/* Workers must not print what is buffered again */
+		fflush(stdout);
+		for (w = 0; w < workers; w++) {
+			if (fork())
+				continue;
+			t = now();
+			if (fs_mount_opts(diskname, &mopts))
+				die("Cannot mount diskname");
+			for (i = 0; i < files; i++) {
+				snprintf(path, sizeof(path), "dir/f%zu", i);
+				fd = fs_open(path);
+				if (fd < 0 ||
+				    fs_read(fd, buf, file_size) != (int)file_size ||
+				    fs_close(fd))
+					die("Cannot read file");
+			}
+			if (fs_stats(&stats))
+				die("Cannot get stats");
+			results[2 * w + 1] = rss_anon_kb();
+			if (fs_umount())
+				die("Cannot unmount diskname");
+			results[2 * w] = now() - t;
+			exit(0);
+		}
+		for (w = 0; w < workers; w++)
+			if (wait(&status) < 0 || !WIFEXITED(status) ||
+			    WEXITSTATUS(status))
+				die("Worker failed");
+
+		t = kb_max = 0;
+		for (w = 0; w < workers; w++) {
+			t += results[2 * w];
+			if (results[2 * w + 1] > kb_max)
+				kb_max = results[2 * w + 1];
+		}
+		if (stat(diskname, &st))
+			die("Cannot stat diskname");
+		printf("%s: %zu workers, %.2f ms per worker, %.0f KB private "
+		       "memory at most, image %s\n", modes[m], workers,
+		       t / workers * 1e3, kb_max, st.st_mtim.tv_sec ==
+		       mtime.tv_sec && st.st_mtim.tv_nsec == mtime.tv_nsec ?
+		       "untouched" : "written");
+	}
+
+	munmap(results, 2 * workers * sizeof(double));
+	free(buf);
+	unlink(diskname);
+}
+
+/*
+ * seek <diskname> <file MB>
+ * Write two files of the given size SEEK_RUN blocks at a time in turn, so that
+ * the chain of each is cut in runs of SEEK_RUN clusters. Once the image is
+ * remounted, time the first read of the last block of the first file, then
+ * reads of a block at random offsets of it, and of its blocks in reverse
+ * order. Done on a 32-bit image, then on one keeping extent lists in entries.
+ */
+static void bench_seek(void *arg)
+{
+	static const char *formats[] = { "fat32", "extents" };
+	static const char *modes[] = { "random", "reverse" };
+	struct bench_arg *b_arg = arg;
+	struct fs_format_opts opts = { 0 };
+	char *diskname, *buf;
+	size_t size, off, blocks, i, m, e, reads = 10000;
+	double t;
+	int fd[2], f;
+
+	if (b_arg->argc < 2)
+		die("Usage: <diskname> <file MB>");
+
+	diskname = b_arg->argv[0];
+	size = get_size(b_arg->argv[1]) << 20;
+	blocks = size / BLOCK_SIZE;
+	buf = malloc(BLOCK_SIZE);
+	if (!buf)
+		die("Cannot malloc");
+
+	for (e = 0; e < ARRAY_SIZE(formats); e++) {
+		opts.flags = FS_FORMAT_FAT32 | (e ? FS_FORMAT_EXTENTS : 0);
+		if (fs_format(diskname, 2 * blocks + 1024, &opts))
+			die("Cannot format diskname");
+		if (fs_mount(diskname))
+			die("Cannot mount diskname");
+		for (f = 0; f < 2; f++) {
+			snprintf(buf, BLOCK_SIZE, "file%d", f);
+			if (fs_create(buf))
+				die("Cannot create file");
+			fd[f] = fs_open(buf);
+			if (fd[f] < 0)
+				die("Cannot open file");
+		}
+		for (off = 0; off < blocks; off += SEEK_RUN)
+			for (f = 0; f < 2; f++)
+				for (i = off; i < off + SEEK_RUN && i < blocks;
+				     i++) {
+					memset(buf, i + f, BLOCK_SIZE);
+					if (fs_write(fd[f], buf, BLOCK_SIZE) !=
+					    BLOCK_SIZE || fs_flush(fd[f]))
+						die("Cannot write file");
+				}
+		if (fs_close(fd[0]) || fs_close(fd[1]) || fs_umount() ||
+		    fs_mount(diskname))
+			die("Cannot remount diskname");
+
+		t = now();
+		fd[0] = fs_open("file0");
+		if (fd[0] < 0 || fs_lseek(fd[0], (blocks - 1) * BLOCK_SIZE) ||
+		    fs_read(fd[0], buf, BLOCK_SIZE) != BLOCK_SIZE)
+			die("Cannot read file");
+		t = now() - t;
+		printf("%s first: %.2f us to open a %zu MB file and read its "
+		       "last block\n", formats[e], t * 1e6, size >> 20);
+
+		srand(1);
+		for (m = 0; m < ARRAY_SIZE(modes); m++) {
+			t = now();
+			for (i = 0; i < reads; i++) {
+				off = m ? blocks - 1 - i % blocks :
+					(size_t)rand() % blocks;
+				if (fs_lseek(fd[0], off * BLOCK_SIZE) ||
+				    fs_read(fd[0], buf, BLOCK_SIZE) !=
+				    BLOCK_SIZE)
+					die("Cannot read file");
+				if (buf[0] != (char)off)
+					die("Bad content at block %zu", off);
+			}
+			t = now() - t;
+			printf("%s %s: %.2f us per read of a %zu MB file\n",
+			       formats[e], modes[m], t / reads * 1e6,
+			       size >> 20);
+		}
+
+		if (fs_close(fd[0]) || fs_umount())
+			die("Cannot unmount diskname");
+	}
+	free(buf);
+	unlink(diskname);
+}
+
+static struct {
+	const char *name;
+	void(*func)(void *);
+} commands[] = {
+	{ "append",	bench_append },
+	{ "bigimage",	bench_bigimage },
+	{ "clone",	bench_clone },
+	{ "compress",	bench_compress },
+	{ "dedup",	bench_dedup },
+	{ "delta",	bench_delta },
+	{ "direct",	bench_direct },
+	{ "discard",	bench_discard },
+	{ "dirscale",	bench_dirscale },
+	{ "import",	bench_import },
+	{ "interleave",	bench_interleave },
+	{ "mount",	bench_mount },
+	{ "readdir",	bench_readdir },
+	{ "readonly",	bench_readonly },
+	{ "reclaim",	bench_reclaim },
+	{ "seek",	bench_seek },
+	{ "sparse",	bench_sparse },
+	{ "sync",	bench_sync },
+};
+
+static void usage(char *program)
+{
+	size_t i;
+	fprintf(stderr, "Usage: %s <benchmark> [<arg>]\n", program);
+	fprintf(stderr, "Possible benchmarks are:\n");
+	for (i = 0; i < ARRAY_SIZE(commands); i++)
+		fprintf(stderr, "\t%s\n", commands[i].name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	size_t i;
+	char *program;
+	char *cmd;
+	struct bench_arg arg;
+
+	program = argv[0];
+
+	if (argc == 1)
+		usage(program);
+
+	/* Skip argv[0] */
+	argc--;
+	argv++;
+
+	cmd = argv[0];
+	arg.argc = --argc;
+	arg.argv = &argv[1];
+
+	for (i = 0; i < ARRAY_SIZE(commands); i++) {
+		if (!strcmp(cmd, commands[i].name)) {
+			commands[i].func(&arg);
+			break;
+		}
+	}
+	if (i == ARRAY_SIZE(commands)) {
+		bench_error("invalid benchmark '%s'", cmd);
+		usage(program);
+	}
+
+	return 0;
+}
@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fs.h>
+
+/* Exit codes */
+#define CHECK_CLEAN	0
+#define CHECK_REPAIRED	1
+#define CHECK_PROBLEMS	2
+#define CHECK_FAILED	3
+
+static void usage(char *program)
+{
+	fprintf(stderr, "Usage: %s [-r] [-j <threads>] <diskname>\n", program);
+	fprintf(stderr, "\t-r\trepair the problems found\n");
+	fprintf(stderr, "\t-j\tnumber of threads (default: one per CPU)\n");
+	fprintf(stderr, "Exit status is %d if the image is clean, %d if all "
+		"problems were repaired,\n%d if problems remain, %d if the "
+		"image cannot be checked\n", CHECK_CLEAN, CHECK_REPAIRED,
+		CHECK_PROBLEMS, CHECK_FAILED);
+	exit(CHECK_FAILED);
+}
+
+int main(int argc, char **argv)
+{
+	struct fs_check_report report;
+	unsigned int flags = 0, threads = 0;
+	size_t problems;
+	char *end;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "rj:")) != -1) {
+		switch (opt) {
+		case 'r':
+			flags |= FS_CHECK_REPAIR;
+			break;
+		case 'j':
+			threads = strtoul(optarg, &end, 0);
+			if (*end != '\0' || threads == 0)
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1)
+		usage(argv[0]);
+
+	if (fs_check(argv[optind], flags, threads, &report)) {
+		fprintf(stderr, "%s: cannot check image\n", argv[optind]);
+		return CHECK_FAILED;
+	}
+
+	problems = report.cycles + report.cross_links + report.bad_links +
+		report.size_mismatches + report.leaks + report.ref_mismatches +
+		report.extent_mismatches;
+	printf("%s: %zu files, %zu cycles, %zu cross links, %zu bad links, "
+	       "%zu size mismatches, %zu leaked clusters, "
+	       "%zu wrong reference counts, %zu wrong extent lists, "
+	       "%zu repaired\n",
+	       argv[optind], report.files, report.cycles, report.cross_links,
+	       report.bad_links, report.size_mismatches, report.leaks,
+	       report.ref_mismatches, report.extent_mismatches,
+	       report.repaired);
+
+	if (problems == 0)
+		return CHECK_CLEAN;
+	return report.repaired == problems ? CHECK_REPAIRED : CHECK_PROBLEMS;
+}
@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fs.h>
+
+static void usage(char *program)
+{
+	fprintf(stderr, "Usage: %s checkpoint <diskname>\n", program);
+	fprintf(stderr, "       %s export [-c] <diskname> <delta>\n", program);
+	fprintf(stderr, "       %s apply <diskname> <delta>\n", program);
+	fprintf(stderr, "Copy the blocks of an image changed since its last "
+		"checkpoint to a delta,\nand bring a copy of the image made at "
+		"that checkpoint up to date with it\n");
+	fprintf(stderr, "\t-c\ttake a checkpoint once the delta is written\n");
+	exit(1);
+}
+
+static int do_checkpoint(char *diskname)
+{
+	if (fs_mount(diskname)) {
+		fprintf(stderr, "%s: cannot mount image\n", diskname);
+		return 1;
+	}
+	if (fs_checkpoint()) {
+		fprintf(stderr, "%s: cannot take checkpoint\n", diskname);
+		fs_umount();
+		return 1;
+	}
+	if (fs_umount()) {
+		fprintf(stderr, "%s: cannot unmount image\n", diskname);
+		return 1;
+	}
+	return 0;
+}
+
+static int do_export(char *diskname, char *deltaname, unsigned int flags)
+{
+	size_t blocks;
+
+	if (fs_mount(diskname)) {
+		fprintf(stderr, "%s: cannot mount image\n", diskname);
+		return 1;
+	}
+	if (fs_delta_export(deltaname, flags, &blocks)) {
+		fprintf(stderr, "%s: cannot export delta\n", deltaname);
+		fs_umount();
+		return 1;
+	}
+	if (fs_umount()) {
+		fprintf(stderr, "%s: cannot unmount image\n", diskname);
+		return 1;
+	}
+
+	printf("%s: %zu blocks changed\n", deltaname, blocks);
+	return 0;
+}
+
+static int do_apply(char *diskname, char *deltaname)
+{
+	if (fs_delta_apply(diskname, deltaname)) {
+		fprintf(stderr, "%s: cannot apply delta\n", deltaname);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int flags = 0;
+	char *cmd;
+	int opt;
+
+	if (argc < 2)
+		usage(argv[0]);
+	cmd = argv[1];
+	optind = 2;
+	while ((opt = getopt(argc, argv, "c")) != -1) {
+		switch (opt) {
+		case 'c':
+			if (strcmp(cmd, "export"))
+				usage(argv[0]);
+			flags |= FS_DELTA_CHECKPOINT;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (!strcmp(cmd, "checkpoint") && optind == argc - 1)
+		return do_checkpoint(argv[optind]);
+	if (!strcmp(cmd, "export") && optind == argc - 2)
+		return do_export(argv[optind], argv[optind + 1], flags);
+	if (!strcmp(cmd, "apply") && optind == argc - 2)
+		return do_apply(argv[optind], argv[optind + 1]);
+	usage(argv[0]);
+	return 1;
+}
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <fs.h>
+
+static void usage(char *program)
+{
+	fprintf(stderr, "Usage: %s [-x] [-i] [-z] [-e] [-c <cluster blocks>] [-p] "
+		"<diskname> <data block count>\n", program);
+	fprintf(stderr, "\t-x\t32-bit format (more than 8192 data blocks, "
+		"directories)\n");
+	fprintf(stderr, "\t-i\tstore files of up to 64 bytes inline\n");
+	fprintf(stderr, "\t-z\tcompress file content\n");
+	fprintf(stderr, "\t-e\tkeep the extent list of each file in its "
+		"entry\n");
+	fprintf(stderr, "\t-c\tdata blocks per cluster, a power of 2\n");
+	fprintf(stderr, "\t-p\treserve host disk space for the whole image\n");
+	fprintf(stderr, "Options -i, -z, -e and -c imply -x\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct fs_format_opts opts = { 0 };
+	unsigned long blocks;
+	char *end;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "xizec:p")) != -1) {
+		switch (opt) {
+		case 'x':
+			opts.flags |= FS_FORMAT_FAT32;
+			break;
+		case 'i':
+			opts.flags |= FS_FORMAT_FAT32 | FS_FORMAT_INLINE;
+			break;
+		case 'z':
+			opts.flags |= FS_FORMAT_FAT32 | FS_FORMAT_COMPRESS;
+			break;
+		case 'e':
+			opts.flags |= FS_FORMAT_FAT32 | FS_FORMAT_EXTENTS;
+			break;
+		case 'c':
+			opts.cluster_blocks = strtoul(optarg, &end, 0);
+			if (*end != '\0' || opts.cluster_blocks == 0)
+				usage(argv[0]);
+			opts.flags |= FS_FORMAT_FAT32;
+			break;
+		case 'p':
+			opts.flags |= FS_FORMAT_PREALLOCATE;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 2)
+		usage(argv[0]);
+
+	blocks = strtoul(argv[optind + 1], &end, 0);
+	if (*end != '\0' || blocks == 0) {
+		fprintf(stderr, "%s: invalid data block count\n", argv[0]);
+		return 1;
+	}
+	if (!(opts.flags & FS_FORMAT_FAT32) && blocks > 8192) {
+		fprintf(stderr, "%s: data block count invalid, range is [1, 8192] "
+			"(use -x for more)\n", argv[0]);
+		return 1;
+	}
+
+	if (fs_format(argv[optind], blocks, &opts)) {
+		fprintf(stderr, "%s: cannot format %s\n", argv[0], argv[optind]);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,36 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <fs.h>
+
+static void usage(char *program)
+{
+	fprintf(stderr, "Usage: %s <diskname>\n", program);
+	fprintf(stderr, "Punch the free clusters of the image out of its file\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	size_t blocks;
+
+	if (argc != 2)
+		usage(argv[0]);
+
+	if (fs_mount(argv[1])) {
+		fprintf(stderr, "%s: cannot mount image\n", argv[1]);
+		return 1;
+	}
+	if (fs_trim(&blocks)) {
+		fprintf(stderr, "%s: cannot discard free space\n", argv[1]);
+		fs_umount();
+		return 1;
+	}
+	if (fs_umount()) {
+		fprintf(stderr, "%s: cannot unmount image\n", argv[1]);
+		return 1;
+	}
+
+	printf("%s: %zu blocks discarded\n", argv[1], blocks);
+	return 0;
+}
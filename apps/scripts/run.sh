@@ -0,0 +1,643 @@
+#!/bin/sh
+#
+# Round-trip checks of the file system features. Each check formats a fresh
+# image with fs_make.x, runs a script of this directory on it through
+# test_fs.x, then fs_check.x must find the image clean. Checks made with ref
+# also run their script through fs_ref.x on a 16-bit image, whose output,
+# listing and file contents must match.
+#
+# Usage: scripts/run.sh [<check>...]
+# Runs every check, or only the ones named. Exit status is the # of failures.
+
+cd "$(dirname "$0")/.." || exit 1
+APPS=$(pwd)
+WORK=$(mktemp -d) || exit 1
+trap 'rm -rf "$WORK"' EXIT
+
+# Host files scripts write and compare against, found in the work directory
+head -c 4096 /dev/urandom > "$WORK/test_file" || exit 1
+awk 'BEGIN { for (i = 0; i < 20000; i++)
+	printf "line %06d of the big test file\n", i }' > "$WORK/big_file"
+awk 'BEGIN { for (i = 0; i < 600; i++) printf "rec%013d", i }' \
+	> "$WORK/records"
+awk 'BEGIN { for (i = 600; i < 700; i++) printf "rec%013d", i }' \
+	> "$WORK/more_records"
+head -c 65536 /dev/zero > "$WORK/zeros" || exit 1
+
+# Host trees to import, a flat one for 16-bit images
+mkdir -p "$WORK/flat" "$WORK/tree/sub/deeper" || exit 1
+for dir in flat tree; do
+	cp "$WORK/test_file" "$WORK/big_file" "$WORK/$dir" || exit 1
+	: > "$WORK/$dir/empty"
+done
+echo "small file" > "$WORK/flat/small"
+awk 'BEGIN { for (i = 0; i < 30000; i++) print i }' > "$WORK/tree/sub/numbers"
+echo "small file" > "$WORK/tree/sub/deeper/small"
+
+failed=0
+
+# True if check $1 is to run
+selected()
+{
+	[ -z "$CHECKS" ] && return 0
+	for c in $CHECKS; do
+		[ "$c" = "$1" ] && return 0
+	done
+	return 1
+}
+
+fail()
+{
+	echo "FAIL $name: $*"
+	failed=$((failed + 1))
+}
+
+# Run script $1 through program $2 on image $3, output to $3.out
+script()
+{
+	(cd "$WORK" && "$2" script "$3" "$APPS/scripts/$1.script") \
+		> "$3.out" 2>&1 && ! grep -q "unexpected" "$3.out"
+}
+
+# Check that fs_check.x finds image $1 clean
+clean()
+{
+	"$APPS/fs_check.x" "$1" > "$1.check" 2>&1 && return 0
+	cat "$1.check"
+	return 1
+}
+
+# run <check> <script> <data blocks> [<fs_make.x option>...]
+# Run a script on a fresh image
+run()
+{
+	name=$1
+	selected "$name" || return 0
+	img=$WORK/$name.fs
+	if ! "$APPS/fs_make.x" $4 $5 $6 "$img" "$3" > /dev/null; then
+		fail "cannot format"
+	elif ! script "$2" "$APPS/test_fs.x" "$img"; then
+		fail "script failed"
+		cat "$img.out"
+	elif ! clean "$img"; then
+		fail "image not clean"
+	else
+		echo "PASS $name"
+	fi
+}
+
+# ref <check> <script> <data blocks>
+# Run a script on two fresh 16-bit images, through test_fs.x and fs_ref.x
+ref()
+{
+	name=$1
+	selected "$name" || return 0
+	img=$WORK/$name.fs
+	if ! "$APPS/fs_make.x" "$img" "$3" > /dev/null ||
+	   ! cp "$img" "$img.ref"; then
+		fail "cannot format"
+		return
+	fi
+	if ! script "$2" "$APPS/test_fs.x" "$img" ||
+	   ! script "$2" "$APPS/fs_ref.x" "$img.ref"; then
+		fail "script failed"
+		cat "$img.out" "$img.ref.out"
+		return
+	fi
+	if ! clean "$img"; then
+		fail "image not clean"
+		return
+	fi
+	# Files may take other slots and blocks, the listing is compared
+	# without them
+	"$APPS/test_fs.x" info "$img" > "$img.info"
+	"$APPS/fs_ref.x" info "$img.ref" > "$img.ref.info"
+	"$APPS/test_fs.x" ls "$img" | sed 's/, data_blk: [0-9]*//' | sort \
+		> "$img.ls"
+	"$APPS/fs_ref.x" ls "$img.ref" | sed 's/, data_blk: [0-9]*//' | sort \
+		> "$img.ref.ls"
+	: > "$img.cat"
+	: > "$img.ref.cat"
+	for file in $(sed -n 's/^file: \([^,]*\),.*/\1/p' "$img.ls"); do
+		"$APPS/test_fs.x" cat "$img" "$file" >> "$img.cat"
+		"$APPS/fs_ref.x" cat "$img.ref" "$file" >> "$img.ref.cat"
+	done
+	for out in out info ls cat; do
+		if ! cmp -s "$img.$out" "$img.ref.$out"; then
+			fail "$out differs from fs_ref.x"
+			diff "$img.$out" "$img.ref.$out" | head -20
+			return
+		fi
+	done
+	echo "PASS $name"
+}
+
+# leak <check> <script> <data blocks> <FAT entry bytes> [<fs_make.x option>...]
+# Run a script on a fresh image, leak its last cluster, then fs_check.x must
+# find the leak, repair it, and find the image clean
+leak()
+{
+	name=$1
+	selected "$name" || return 0
+	img=$WORK/$name.fs
+	if ! "$APPS/fs_make.x" $5 $6 "$img" "$3" > /dev/null; then
+		fail "cannot format"
+		return
+	elif ! script "$2" "$APPS/test_fs.x" "$img"; then
+		fail "script failed"
+		cat "$img.out"
+		return
+	fi
+	# 1-block clusters, the FAT starts at block 1
+	head -c "$4" /dev/zero | tr '\0' '\377' |
+		dd of="$img" bs=1 seek=$((4096 + $4 * ($3 - 1))) conv=notrunc \
+		2> /dev/null
+	"$APPS/fs_check.x" "$img" > "$img.check"
+	if [ $? -ne 2 ] || ! grep -q "leaked" "$img.check"; then
+		fail "leak not found"
+		cat "$img.check"
+	elif "$APPS/fs_check.x" -r "$img" > "$img.check"; [ $? -ne 1 ]; then
+		fail "leak not repaired"
+		cat "$img.check"
+	elif ! clean "$img"; then
+		fail "image not clean once repaired"
+	else
+		echo "PASS $name"
+	fi
+}
+
+# format <check> <data blocks> [<fs_make.x option>...]
+# Format a fresh image, fs_check.x must find it clean, fs_ref.x must read a
+# 16-bit one the same as test_fs.x, and -p must leave no hole in it
+format()
+{
+	name=$1
+	selected "$name" || return 0
+	img=$WORK/$name.fs
+	if ! "$APPS/fs_make.x" $3 $4 $5 "$img" "$2" > /dev/null; then
+		fail "cannot format"
+		return
+	elif ! clean "$img"; then
+		fail "image not clean"
+		return
+	fi
+	case " $3 $4 $5 " in
+	*" -p "*)
+		if [ $(($(stat -c %b "$img") * 512)) -lt "$(stat -c %s "$img")" ]
+		then
+			fail "image not preallocated"
+			return
+		fi
+		;;
+	*" -"*)
+		;;
+	*)
+		"$APPS/test_fs.x" info "$img" > "$img.info"
+		"$APPS/fs_ref.x" info "$img" > "$img.ref.info"
+		if ! cmp -s "$img.info" "$img.ref.info"; then
+			fail "info differs from fs_ref.x"
+			diff "$img.info" "$img.ref.info"
+			return
+		fi
+		;;
+	esac
+	echo "PASS $name"
+}
+
+# import <check> <host tree> <data blocks> [<fs_make.x option>...]
+# Import a host tree into a fresh image, whose files must then read the same as
+# the host ones, through fs_ref.x as well on 16-bit images
+import()
+{
+	name=$1
+	selected "$name" || return 0
+	img=$WORK/$name.fs
+	if ! "$APPS/fs_make.x" $4 $5 $6 "$img" "$3" > /dev/null; then
+		fail "cannot format"
+		return
+	elif ! "$APPS/test_fs.x" import "$img" "$WORK/$2" > "$img.out" 2>&1
+	then
+		fail "import failed"
+		cat "$img.out"
+		return
+	elif ! clean "$img"; then
+		fail "image not clean"
+		return
+	fi
+	for file in $(cd "$WORK/$2" && find . -type f | sed 's|^\./||'); do
+		# cat prints two lines before the content
+		"$APPS/test_fs.x" cat "$img" "$file" > "$img.cat" 2>&1
+		if ! tail -n +3 "$img.cat" | cmp -s - "$WORK/$2/$file"; then
+			fail "$file differs from the host one"
+			return
+		fi
+		[ -n "$4" ] && continue
+		"$APPS/fs_ref.x" cat "$img" "$file" > "$img.ref.cat" 2>&1
+		if ! cmp -s "$img.cat" "$img.ref.cat"; then
+			fail "$file differs through fs_ref.x"
+			return
+		fi
+	done
+	echo "PASS $name"
+}
+
+# roundtrip <check> <host tree> <data blocks> [<fs_make.x option>...]
+# Import a host tree into a fresh image and export it back, the exported tree
+# must be the same as the host one
+roundtrip()
+{
+	name=$1
+	selected "$name" || return 0
+	img=$WORK/$name.fs
+	files=$(cd "$WORK/$2" && find . -type f | sed 's|^\./||')
+	if ! "$APPS/fs_make.x" $4 $5 $6 "$img" "$3" > /dev/null; then
+		fail "cannot format"
+	elif ! "$APPS/test_fs.x" import "$img" "$WORK/$2" > "$img.out" 2>&1
+	then
+		fail "import failed"
+		cat "$img.out"
+	elif ! "$APPS/test_fs.x" export "$img" "$img.tree" $files \
+		> "$img.out" 2>&1; then
+		fail "export failed"
+		cat "$img.out"
+	elif ! clean "$img"; then
+		fail "image not clean"
+	elif ! diff -r "$WORK/$2" "$img.tree" > "$img.diff"; then
+		fail "exported tree differs from the host one"
+		head -20 "$img.diff"
+	else
+		echo "PASS $name"
+	fi
+}
+
+# session <check> <script> <data blocks> <failures> [<fs_make.x option>...]
+# Feed a script to a session on a fresh image, in which <failures> commands
+# must fail
+session()
+{
+	name=$1
+	selected "$name" || return 0
+	img=$WORK/$name.fs
+	if ! "$APPS/fs_make.x" $5 $6 "$img" "$3" > /dev/null; then
+		fail "cannot format"
+	elif ! (cd "$WORK" && "$APPS/test_fs.x" session "$img") \
+		< "scripts/$2.script" > "$img.out" 2>&1 ||
+	     grep -q "unexpected" "$img.out" ||
+	     ! grep -q "^[0-9]* commands, $4 failed" "$img.out"; then
+		fail "session failed"
+		grep -v "successful" "$img.out"
+	elif ! clean "$img"; then
+		fail "image not clean"
+	else
+		echo "PASS $name"
+	fi
+}
+
+# crash <check> <mount options> <data blocks> [<fs_make.x option>...]
+# Add host files in a session mounted with options that make them durable,
+# then copy the image while it is still mounted: the copy must be clean and
+# hold the files
+crash()
+{
+	name=$1
+	selected "$name" || return 0
+	img=$WORK/$name.fs
+	if ! "$APPS/fs_make.x" $4 $5 $6 "$img" "$3" > /dev/null; then
+		fail "cannot format"
+		return
+	fi
+	rm -f "$WORK/in"
+	mkfifo "$WORK/in" || exit 1
+	(cd "$WORK" && "$APPS/test_fs.x" session "$img") < "$WORK/in" \
+		> "$img.out" 2>&1 &
+	exec 3> "$WORK/in"
+	printf 'UMOUNT\nMOUNT\t%s\nADD\tbig_file\nADD\ttest_file\n' "$2" >&3
+	# Periodic commits happen on the first change after their interval
+	sleep 0.2
+	printf 'CREATE\tlast\n' >&3
+	while ! grep -q "^CREATE" "$img.out"; do
+		sleep 0.05
+	done
+	cp "$img" "$img.copy"
+	printf 'QUIT\n' >&3
+	exec 3>&-
+	wait
+	if grep -q "failed (" "$img.out"; then
+		fail "session failed"
+		cat "$img.out"
+	elif ! clean "$img.copy"; then
+		fail "copy not clean"
+	else
+		for file in big_file test_file; do
+			"$APPS/test_fs.x" cat "$img.copy" "$file" > "$img.cat"
+			if ! tail -n +3 "$img.cat" | cmp -s - "$WORK/$file"; then
+				fail "$file differs in the copy"
+				return
+			fi
+		done
+		echo "PASS $name"
+	fi
+}
+
+# True if image $1 takes no more host space than its used blocks
+sparse()
+{
+	"$APPS/test_fs.x" info "$1" | awk -F '[=/]' -v alloc="$(stat -c %b "$1")" '
+		$1 == "data_blk" { meta = $2 }
+		$1 == "cluster_blk_count" { cluster = $2 }
+		$1 == "fat_free_ratio" { used = $3 - $2 }
+		END { exit alloc * 512 > (meta + used * (cluster ? cluster : 1)) * 4096 }'
+}
+
+# trim <check> <script> <data blocks> [<fs_make.x option>...]
+# Run a script on a fresh image, then fs_trim.x must leave the files as they
+# were, with no host space taken by free blocks. Scripts that mount with the
+# discard option must leave none to fs_trim.x
+trim()
+{
+	name=$1
+	selected "$name" || return 0
+	img=$WORK/$name.fs
+	if ! "$APPS/fs_make.x" $4 $5 $6 "$img" "$3" > /dev/null; then
+		fail "cannot format"
+		return
+	elif ! script "$2" "$APPS/test_fs.x" "$img"; then
+		fail "script failed"
+		cat "$img.out"
+		return
+	elif grep -q "^MOUNT	.*discard" "scripts/$2.script" && ! sparse "$img"
+	then
+		fail "free blocks not discarded"
+		return
+	fi
+	"$APPS/test_fs.x" ls "$img" > "$img.ls"
+	cp "$img" "$img.copy"
+	if ! "$APPS/fs_trim.x" "$img" > "$img.trim" 2>&1; then
+		fail "fs_trim.x failed"
+		cat "$img.trim"
+	elif ! clean "$img"; then
+		fail "image not clean"
+	elif ! sparse "$img"; then
+		fail "free blocks not trimmed"
+	elif ! "$APPS/test_fs.x" ls "$img" | cmp -s - "$img.ls"; then
+		fail "files changed by fs_trim.x"
+	else
+		for file in $(sed -n 's/^file: \([^,]*\),.*/\1/p' "$img.ls"); do
+			"$APPS/test_fs.x" cat "$img" "$file" > "$img.cat"
+			"$APPS/test_fs.x" cat "$img.copy" "$file" > "$img.copy.cat"
+			if ! cmp -s "$img.cat" "$img.copy.cat"; then
+				fail "$file changed by fs_trim.x"
+				return
+			fi
+		done
+		echo "PASS $name"
+	fi
+}
+
+# rdonly <check> <data blocks> [<fs_make.x option>...]
+# Run basic.script on a fresh image, then read its files in processes that all
+# mount it read-only at once, and have a session fail to change it: the image
+# must be left as it was
+rdonly()
+{
+	name=$1
+	selected "$name" || return 0
+	img=$WORK/$name.fs
+	if ! "$APPS/fs_make.x" $3 $4 $5 "$img" "$2" > /dev/null; then
+		fail "cannot format"
+		return
+	elif ! script basic "$APPS/test_fs.x" "$img"; then
+		fail "script failed"
+		cat "$img.out"
+		return
+	fi
+	cp "$img" "$img.copy"
+	pids=
+	for i in 1 2 3 4; do
+		(cd "$WORK" && "$APPS/test_fs.x" script "$img" \
+			"$APPS/scripts/readonly.script") > "$img.out$i" 2>&1 &
+		pids="$pids $!"
+	done
+	for pid in $pids; do
+		wait $pid || echo "unexpected exit" >> "$img.out"
+	done
+	if cat "$img".out* | grep -q "unexpected"; then
+		fail "read-only script failed"
+		cat "$img".out*
+		return
+	fi
+	printf 'UMOUNT\nMOUNT\treadonly\nCREATE\tnew\nDELETE\tsmall\nOPEN\tsmall\nWRITE\tDATA\tx\nCLOSE\n' |
+		"$APPS/test_fs.x" session "$img" > "$img.out" 2>&1
+	if ! grep -q "^7 commands, 3 failed" "$img.out"; then
+		fail "read-only session changed the image"
+		cat "$img.out"
+	elif ! cmp -s "$img" "$img.copy"; then
+		fail "image written"
+	elif ! clean "$img"; then
+		fail "image not clean"
+	else
+		echo "PASS $name"
+	fi
+}
+
+# True if images $1 and $2 list the same files, with the same content
+same()
+{
+	"$APPS/test_fs.x" ls "$1" > "$1.ls"
+	"$APPS/test_fs.x" ls "$2" > "$2.ls"
+	cmp -s "$1.ls" "$2.ls" || return 1
+	for file in $(sed -n 's/^file: \([^,]*\),.*/\1/p' "$1.ls"); do
+		"$APPS/test_fs.x" cat "$1" "$file" > "$1.cat"
+		"$APPS/test_fs.x" cat "$2" "$file" > "$2.cat"
+		cmp -s "$1.cat" "$2.cat" || return 1
+	done
+}
+
+# delta <check> <script> <script> <script> <data blocks> [<fs_make.x option>...]
+# Run the first script on a fresh image and take a checkpoint of a copy of it,
+# then run the second script: the delta fs_delta.x exports of the changes must
+# turn the copy into the image. A second delta, of the third script, must do
+# the same from the checkpoint the export took. The changed block bitmaps of
+# the images may differ, their files may not
+delta()
+{
+	name=$1
+	selected "$name" || return 0
+	img=$WORK/$name.fs
+	if ! "$APPS/fs_make.x" $6 $7 $8 "$img" "$5" > /dev/null; then
+		fail "cannot format"
+		return
+	elif ! script "$2" "$APPS/test_fs.x" "$img"; then
+		fail "script failed"
+		cat "$img.out"
+		return
+	elif ! "$APPS/fs_delta.x" checkpoint "$img" > /dev/null; then
+		fail "cannot take checkpoint"
+		return
+	fi
+	cp "$img" "$img.copy"
+	for next in "$3" "$4"; do
+		if ! script "$next" "$APPS/test_fs.x" "$img"; then
+			fail "script failed"
+			cat "$img.out"
+			return
+		elif ! "$APPS/fs_delta.x" export -c "$img" "$img.delta" \
+			> /dev/null; then
+			fail "cannot export delta"
+			return
+		elif ! "$APPS/fs_delta.x" apply "$img.copy" "$img.delta" \
+			> /dev/null; then
+			fail "cannot apply delta"
+			return
+		elif ! same "$img" "$img.copy"; then
+			fail "copy differs once $next delta applied"
+			return
+		fi
+	done
+	if ! clean "$img"; then
+		fail "image not clean"
+	elif ! clean "$img.copy"; then
+		fail "copy not clean"
+	else
+		echo "PASS $name"
+	fi
+}
+
+# expect <check> <script> <data blocks> [<fs_make.x option>...]
+# Run a script on a fresh image, its output must be the one saved along in
+# this directory
+expect()
+{
+	name=$1
+	selected "$name" || return 0
+	img=$WORK/$name.fs
+	if ! "$APPS/fs_make.x" $4 $5 $6 "$img" "$3" > /dev/null; then
+		fail "cannot format"
+	elif ! script "$2" "$APPS/test_fs.x" "$img"; then
+		fail "script failed"
+		cat "$img.out"
+	elif ! cmp -s "$img.out" "scripts/$2.out"; then
+		fail "output differs from $2.out"
+		diff "$img.out" "scripts/$2.out" | head -20
+	elif ! clean "$img"; then
+		fail "image not clean"
+	else
+		echo "PASS $name"
+	fi
+}
+
+# listing <check> <script> <data blocks> [<fs_make.x option>...]
+# Run a script on a fresh image, then the entries fs_readdir() reads must be
+# the ones fs_ls() lists
+listing()
+{
+	name=$1
+	selected "$name" || return 0
+	img=$WORK/$name.fs
+	if ! "$APPS/fs_make.x" $4 $5 $6 "$img" "$3" > /dev/null; then
+		fail "cannot format"
+	elif ! script "$2" "$APPS/test_fs.x" "$img" ||
+	     ! script list "$APPS/test_fs.x" "$img"; then
+		fail "script failed"
+		cat "$img.out"
+	elif ! "$APPS/test_fs.x" ls "$img" | sed 1d > "$img.ls" ||
+	     ! sed -n 's/, extents: [0-9]*$//p' "$img.out" |
+		cmp -s - "$img.ls"; then
+		fail "fs_readdir() entries differ from fs_ls()"
+		diff "$img.out" "$img.ls" | head -20
+	else
+		echo "PASS $name"
+	fi
+}
+
+CHECKS="$*"
+
+ref	fat16		basic		4096
+run	fat32		basic		70000	-x
+run	clusters	basic		8192	-c 4
+run	clusters16	basic		8192	-c 16
+run	dirs		dirs		8192	-x
+run	dirs16		dirs		8192	-c 16
+run	inline		inline		8192	-i
+run	compress	basic		8192	-z
+run	frames		compress	8192	-z -c 4
+run	fatpages	basic		300000	-x
+leak	leak16		basic		4096	2
+leak	leak		dirs		8192	4	-x
+format	format16	1
+format	format16max	8192
+format	prealloc	70000	-x -p
+format	prealloc16	4096	-p
+import	import16	flat		4096
+import	import		tree		8192	-x
+import	importc		tree		8192	-c 4
+roundtrip	export16	flat	4096
+roundtrip	export		tree	8192	-x
+roundtrip	exportc		tree	8192	-c 4
+roundtrip	exportz		tree	8192	-z
+session	session16	session		4096	1
+session	session		session		8192	1	-x
+session	sessionb	basic		8192	0	-x
+session	sessiond	dirs		8192	0	-x
+ref	appends16	appends		4096
+run	appends		appends		8192	-x
+run	appendsc	appends		8192	-c 4
+run	appendsz	appends		8192	-z
+run	interleave16	interleave	4096
+run	interleave	interleave	8192	-x
+run	interleavec	interleave	8192	-c 4
+run	interleavez	interleave	8192	-z
+ref	full16		full		100
+ref	direct16	direct		4096
+run	direct		direct		8192	-x
+run	directc		direct		8192	-c 4
+run	directz		direct		8192	-z
+ref	sync16		sync		4096
+run	sync		sync		8192	-x
+run	syncc		sync		8192	-c 4
+run	syncz		sync		8192	-z
+crash	crash16		sync-close	4096
+crash	crash		sync-close	8192	-x
+crash	crashp16	sync-periodic	4096
+crash	crashp		sync-periodic	8192	-c 4
+run	clone		clone		8192	-x
+run	clonec		clone		8192	-c 4
+run	clonei		clone		8192	-i
+run	clonez		clone		8192	-z
+run	dedup		dedup		8192	-x
+run	dedupc		dedup		8192	-c 4
+run	dedupz		dedup		8192	-z
+run	sparse16	sparse		4096
+run	sparse		sparse		8192	-x
+run	sparsec		sparse		8192	-c 4
+run	sparsei		sparse		8192	-i
+ref	reclaim16	reclaim		200
+run	reclaim		reclaim		200	-x
+run	reclaimc	reclaim		200	-c 4
+trim	trim16		basic		4096
+trim	trim		dirs		8192	-x
+trim	trimc		reclaim		200	-c 4
+trim	discard16	discard		4096
+trim	discard		discard		4096	-x
+trim	discardc	discard		4096	-c 4
+rdonly	readonly16	4096
+rdonly	readonly	8192	-x
+rdonly	readonlyc	8192	-c 4
+rdonly	readonlyz	8192	-z
+run	extents16	extents		4096
+run	extents		extents		8192	-e
+run	extentsc	extents		8192	-e -c 4
+run	extentsi	extents		8192	-e -i
+delta	delta		dirs	basic	appends		8192	-x
+delta	deltac		basic	clone	interleave	8192	-c 4
+delta	deltaz		basic	compress	interleave	8192	-z
+delta	deltae		basic	extents	sparse		8192	-e
+expect	readdir		readdir		8192	-x
+listing	list16		basic		4096
+listing	list		dirs		8192	-x
+listing	listc		clone		8192	-c 4
+listing	listi		inline		8192	-i
+listing	liste		extents		8192	-e
+
+echo "$failed failed"
+exit $failed
@@ -1,12 +1,19 @@
+#define _GNU_SOURCE
 #include <assert.h>
+#include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <libgen.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <fs.h>
@@ -34,6 +41,56 @@ struct thread_arg {
 	char **argv;
 };
 
+/* Options scripts can give to MOUNT */
+static const struct {
+	const char *name;
+	unsigned int flag;
+} mount_options[] = {
+	{ "direct",	FS_MOUNT_DIRECT },
+	{ "sync-close",	FS_MOUNT_SYNC_CLOSE },
+	{ "sync-periodic", FS_MOUNT_SYNC_PERIODIC },
+	{ "dedup",	FS_MOUNT_DEDUP },
+	{ "discard",	FS_MOUNT_DISCARD },
+	{ "readonly",	FS_MOUNT_READONLY },
+};
+
+/* Mount @diskname with @options, a comma separated list, or NULL for none */
+static int script_mount(const char *diskname, char *options)
+{
+	struct fs_mount_opts opts = { 0 };
+	char *option, *save;
+	size_t i;
+
+	for (option = options ? strtok_r(options, ",", &save) : NULL; option;
+	     option = strtok_r(NULL, ",", &save)) {
+		for (i = 0; i < ARRAY_SIZE(mount_options); i++)
+			if (!strcmp(option, mount_options[i].name))
+				break;
+		if (i == ARRAY_SIZE(mount_options))
+			die("Invalid mount option '%s'", option);
+		opts.flags |= mount_options[i].flag;
+	}
+
+	return fs_mount_opts(diskname, &opts);
+}
+
+/* Print the entries of the root directory fs_readdir() reads */
+static int print_readdir(void)
+{
+	struct fs_dirent entries[FS_FILE_MAX_COUNT];
+	int i, n;
+
+	n = fs_readdir(entries, FS_FILE_MAX_COUNT, FS_READDIR_EXTENTS);
+	if (n < 0)
+		return -1;
+	for (i = 0; i < n && i < FS_FILE_MAX_COUNT; i++)
+		printf("%s: %s, size: %zu, data_blk: %u, extents: %zu\n",
+		       entries[i].flags & FS_DIRENT_DIR ? "dir" : "file",
+		       entries[i].name, entries[i].size, entries[i].data_blk,
+		       entries[i].extents);
+	return 0;
+}
+
 void thread_fs_script(void *arg)
 {
 	struct thread_arg *t_arg = arg;
@@ -48,6 +105,9 @@ void thread_fs_script(void *arg)
 
 	char line_buffer[1024];
 	int command_index = 1;
+	/* Name each open descriptor was opened with, to switch back to it */
+	char *open_names[FS_OPEN_MAX_COUNT] = { 0 };
+	int i;
 
 	if (t_arg->argc < 2)
 		die("Usage: <diskname> <script filename>");
@@ -87,7 +147,7 @@ void thread_fs_script(void *arg)
 			break;
 
 		if (strcmp(command, "MOUNT") == 0) {
-			if (fs_mount(diskname))
+			if (script_mount(diskname, command_args[1]))
 				die("Cannot mount disk");
 			else {
 				printf("MOUNT successful.\n");
@@ -112,6 +172,25 @@ void thread_fs_script(void *arg)
 
 			printf("CREATE successful.\n");
 
+		} else if (strcmp(command, "MKDIR") == 0) {
+			fs_filename = command_args[1];
+
+			if(fs_mkdir(fs_filename)) {
+				fs_umount();
+				die("Cannot create directory");
+			}
+
+			printf("MKDIR successful.\n");
+
+		} else if (strcmp(command, "CLONE") == 0) {
+			if (!command_args[1] || !command_args[2] ||
+			    fs_clone(command_args[1], command_args[2])) {
+				fs_umount();
+				die("Cannot clone file");
+			}
+
+			printf("CLONE successful.\n");
+
 		} else if (strcmp(command, "DELETE") == 0) {
 			fs_filename = command_args[1];
 
@@ -131,17 +210,47 @@ void thread_fs_script(void *arg)
 				fs_umount();
 				die("Cannot open file");
 			}
+			if (fs_fd < FS_OPEN_MAX_COUNT) {
+				free(open_names[fs_fd]);
+				open_names[fs_fd] = strdup(fs_filename);
+			}
 
 			printf("OPEN successful.\n");
 
+		} else if (strcmp(command, "SWITCH") == 0) {
+			fs_filename = command_args[1];
+
+			for (i = 0; i < FS_OPEN_MAX_COUNT; i++)
+				if (open_names[i] && !strcmp(open_names[i], fs_filename))
+					break;
+			if (i == FS_OPEN_MAX_COUNT) {
+				fs_umount();
+				die("File not open");
+			}
+			fs_fd = i;
+
+			printf("SWITCH successful.\n");
+
 		} else if (strcmp(command, "CLOSE") == 0) {
 			if (fs_close(fs_fd)) {
 				fs_umount();
 				die("Cannot close file");
 			}
+			if (fs_fd >= 0 && fs_fd < FS_OPEN_MAX_COUNT) {
+				free(open_names[fs_fd]);
+				open_names[fs_fd] = NULL;
+			}
 
 			printf("CLOSE successful.\n");
 
+		} else if (strcmp(command, "READDIR") == 0) {
+			if (print_readdir()) {
+				fs_umount();
+				die("Cannot read directory");
+			}
+
+			printf("READDIR successful.\n");
+
 		} else if (strcmp(command, "SEEK") == 0) {
 			offset = atoi(command_args[1]);
 
@@ -266,6 +375,8 @@ void thread_fs_script(void *arg)
 	if (mounted && fs_umount())
 		die("Cannot unmount diskname");
 
+	for (i = 0; i < FS_OPEN_MAX_COUNT; i++)
+		free(open_names[i]);
 	fclose(fd_script);
 }
 
@@ -461,6 +572,690 @@ void thread_fs_add(void *arg)
 	close(fd);
 }
 
+/* Maximum number of host files loaded ahead of the import writer */
+#define IMPORT_WINDOW 32
+/* Maximum number of threads loading host files */
+#define IMPORT_THREADS 8
+
+struct import_file {
+	char *host;	/* Host path, NULL for a directory to create */
+	char *name;	/* Path in the file system */
+	char *buf;
+	size_t size;
+	int state;	/* 0 until loaded, 1 once loaded, -1 if loading failed */
+};
+
+struct import {
+	struct import_file *files;
+	size_t count;
+	size_t alloc;
+	size_t next;	/* Next file to load */
+	size_t done;	/* Number of files the writer is done with */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+static char *path_join(const char *dir, const char *name)
+{
+	size_t len = strlen(dir) + strlen(name) + 2;
+	char *path = malloc(len);
+
+	if (!path)
+		die_perror("malloc");
+	if (*dir)
+		snprintf(path, len, "%s/%s", dir, name);
+	else
+		snprintf(path, len, "%s", name);
+	return path;
+}
+
+static void import_push(struct import *imp, char *host, char *name)
+{
+	struct import_file *file;
+
+	if (imp->count == imp->alloc) {
+		imp->alloc = imp->alloc ? imp->alloc * 2 : 64;
+		imp->files = realloc(imp->files,
+				     imp->alloc * sizeof(*imp->files));
+		if (!imp->files)
+			die_perror("realloc");
+	}
+	file = &imp->files[imp->count++];
+	memset(file, 0, sizeof(*file));
+	file->host = host;
+	file->name = name;
+}
+
+/* Queue host directory tree @dir as fs directory @dir_name */
+static void import_walk(struct import *imp, const char *dir,
+			const char *dir_name)
+{
+	struct dirent *de;
+	struct stat st;
+	char *host, *name;
+	DIR *d;
+
+	d = opendir(dir);
+	if (!d)
+		die_perror("opendir");
+	while ((de = readdir(d))) {
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+			continue;
+		host = path_join(dir, de->d_name);
+		name = path_join(dir_name, de->d_name);
+		if (stat(host, &st))
+			die_perror("stat");
+		if (S_ISDIR(st.st_mode)) {
+			/* Directory is created before the files it holds */
+			import_push(imp, NULL, name);
+			import_walk(imp, host, name);
+			free(host);
+		} else if (S_ISREG(st.st_mode)) {
+			import_push(imp, host, name);
+		} else {
+			free(host);
+			free(name);
+		}
+	}
+	closedir(d);
+}
+
+/* Queue the host files listed in @list, one path per line */
+static void import_list(struct import *imp, const char *list)
+{
+	char *line = NULL, *copy, *host, *name;
+	size_t len = 0;
+	ssize_t n;
+	FILE *f;
+
+	f = fopen(list, "r");
+	if (!f)
+		die_perror("fopen");
+	while ((n = getline(&line, &len, f)) != -1) {
+		if (n && line[n - 1] == '\n')
+			line[--n] = '\0';
+		if (!n)
+			continue;
+		copy = strdup(line);
+		if (!copy)
+			die_perror("strdup");
+		host = strdup(line);
+		name = strdup(basename(copy));
+		if (!host || !name)
+			die_perror("strdup");
+		import_push(imp, host, name);
+		free(copy);
+	}
+	free(line);
+	fclose(f);
+}
+
+/*
+ * Map host file of @file, its pages read in by the loader thread so that the
+ * writer finds them in memory
+ */
+static int import_read(struct import_file *file)
+{
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(file->host, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st)) {
+		perror(file->host);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	file->size = st.st_size;
+	if (file->size) {
+		map = mmap(NULL, file->size, PROT_READ,
+			   MAP_PRIVATE | MAP_POPULATE, fd, 0);
+		if (map == MAP_FAILED) {
+			perror(file->host);
+			close(fd);
+			return -1;
+		}
+		madvise(map, file->size, MADV_SEQUENTIAL);
+		file->buf = map;
+	}
+	close(fd);
+	return 1;
+}
+
+/* Loader thread, reads host files at most IMPORT_WINDOW ahead of the writer */
+static void *import_load(void *arg)
+{
+	struct import *imp = arg;
+	struct import_file *file;
+	int state;
+
+	pthread_mutex_lock(&imp->lock);
+	while (imp->next < imp->count) {
+		if (imp->next >= imp->done + IMPORT_WINDOW) {
+			pthread_cond_wait(&imp->cond, &imp->lock);
+			continue;
+		}
+		file = &imp->files[imp->next++];
+		pthread_mutex_unlock(&imp->lock);
+
+		state = file->host ? import_read(file) : 1;
+
+		pthread_mutex_lock(&imp->lock);
+		file->state = state;
+		pthread_cond_broadcast(&imp->cond);
+	}
+	pthread_mutex_unlock(&imp->lock);
+	return NULL;
+}
+
+/* Create file of @file in the mounted fs and write its content */
+static int import_write(struct import_file *file)
+{
+	int fs_fd, written;
+
+	if (!file->host) {
+		if (fs_mkdir(file->name)) {
+			test_fs_error("Cannot create directory '%s'", file->name);
+			return -1;
+		}
+		return 0;
+	}
+
+	if (fs_create(file->name)) {
+		test_fs_error("Cannot create file '%s'", file->name);
+		return -1;
+	}
+	fs_fd = fs_open(file->name);
+	if (fs_fd < 0) {
+		test_fs_error("Cannot open file '%s'", file->name);
+		return -1;
+	}
+	written = file->size ? fs_write(fs_fd, file->buf, file->size) : 0;
+	if (fs_close(fs_fd))
+		die("Cannot close file");
+	if (written < 0 || (size_t)written != file->size) {
+		test_fs_error("Wrote file '%s' (%d/%zu bytes)", file->name,
+			      written, file->size);
+		return -1;
+	}
+	return 0;
+}
+
+void thread_fs_import(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	struct import imp = { 0 };
+	struct import_file *file;
+	pthread_t threads[IMPORT_THREADS];
+	char *diskname, *source;
+	size_t i, bytes = 0, failed = 0;
+	long num_threads;
+	struct stat st;
+
+	if (t_arg->argc < 2)
+		die("Usage: <diskname> <host directory | file list>");
+
+	diskname = t_arg->argv[0];
+	source = t_arg->argv[1];
+
+	/* Either a whole directory tree or a list of host files */
+	if (stat(source, &st))
+		die_perror("stat");
+	if (S_ISDIR(st.st_mode))
+		import_walk(&imp, source, "");
+	else
+		import_list(&imp, source);
+
+	/* Mount once for the whole import */
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+
+	/* Host files are read in parallel, and written in order as they come */
+	pthread_mutex_init(&imp.lock, NULL);
+	pthread_cond_init(&imp.cond, NULL);
+	num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_threads < 1)
+		num_threads = 1;
+	if (num_threads > IMPORT_THREADS)
+		num_threads = IMPORT_THREADS;
+	for (i = 0; i < (size_t)num_threads; i++)
+		if (pthread_create(&threads[i], NULL, import_load, &imp))
+			die("Cannot create thread");
+
+	for (i = 0; i < imp.count; i++) {
+		file = &imp.files[i];
+		pthread_mutex_lock(&imp.lock);
+		while (!file->state)
+			pthread_cond_wait(&imp.cond, &imp.lock);
+		pthread_mutex_unlock(&imp.lock);
+
+		if (file->state < 0 || import_write(file))
+			failed++;
+		else
+			bytes += file->size;
+
+		if (file->buf)
+			munmap(file->buf, file->size);
+		free(file->host);
+		free(file->name);
+		pthread_mutex_lock(&imp.lock);
+		imp.done++;
+		pthread_cond_broadcast(&imp.cond);
+		pthread_mutex_unlock(&imp.lock);
+	}
+
+	for (i = 0; i < (size_t)num_threads; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&imp.lock);
+	pthread_cond_destroy(&imp.cond);
+
+	if (fs_umount())
+		die("Cannot unmount diskname");
+
+	printf("Imported %zu/%zu entries (%zu bytes)\n", imp.count - failed,
+	       imp.count, bytes);
+	free(imp.files);
+	if (failed)
+		exit(1);
+}
+
+/*
+ * Copy @len bytes at offset @off_in of @in_fd to offset @off_out of @out_fd,
+ * without going through user space
+ */
+static int export_copy(int in_fd, off_t off_in, int out_fd, off_t off_out,
+		       size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = copy_file_range(in_fd, &off_in, out_fd, &off_out, len, 0);
+		if (n < 0 && (errno == EXDEV || errno == ENOSYS ||
+			      errno == EINVAL || errno == EOPNOTSUPP)) {
+			/* Not supported between these files, use sendfile() */
+			if (lseek(out_fd, off_out, SEEK_SET) < 0)
+				return -1;
+			n = sendfile(out_fd, in_fd, &off_in, len);
+			if (n > 0)
+				off_out += n;
+		}
+		if (n <= 0)
+			return -1;
+		len -= n;
+	}
+	return 0;
+}
+
+/* Create the missing directories of host path @path */
+static void export_mkdirs(char *path)
+{
+	char *slash;
+
+	for (slash = strchr(path + 1, '/'); slash;
+	     slash = strchr(slash + 1, '/')) {
+		*slash = '\0';
+		if (mkdir(path, 0755) && errno != EEXIST)
+			perror(path);
+		*slash = '/';
+	}
+}
+
+/*
+ * Copy file @filename of the mounted fs, whose virtual disk file is open as
+ * @disk_fd, to host file @dest. Returns the size of the file, or -1
+ */
+static int export_file(int disk_fd, const char *filename, const char *dest)
+{
+	struct fs_extent *extents;
+	int fs_fd, out_fd, size, count, i, ret = 0;
+	char *buf;
+
+	fs_fd = fs_open(filename);
+	if (fs_fd < 0) {
+		test_fs_error("Cannot open file '%s'", filename);
+		return -1;
+	}
+	size = fs_stat(fs_fd);
+	out_fd = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (size < 0 || out_fd < 0) {
+		if (out_fd < 0)
+			perror(dest);
+		fs_close(fs_fd);
+		return -1;
+	}
+
+	count = fs_extents(fs_fd, NULL, 0);
+	if (count >= 0) {
+		/* Copy the extents straight from the virtual disk file */
+		extents = malloc(count * sizeof(*extents) + 1);
+		if (!extents)
+			die_perror("malloc");
+		fs_extents(fs_fd, extents, count);
+		for (i = 0; i < count && !ret; i++)
+			ret = export_copy(disk_fd, extents[i].disk_offset,
+					  out_fd, extents[i].file_offset,
+					  extents[i].length);
+		free(extents);
+	} else {
+		/* Inline or compressed content goes through fs_read() */
+		buf = malloc(size + 1);
+		if (!buf)
+			die_perror("malloc");
+		if (fs_read(fs_fd, buf, size) != size ||
+		    write(out_fd, buf, size) != size)
+			ret = -1;
+		free(buf);
+	}
+	if (ret)
+		test_fs_error("Cannot copy file '%s'", filename);
+
+	close(out_fd);
+	fs_close(fs_fd);
+	return ret ? -1 : size;
+}
+
+void thread_fs_export(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	char *diskname, *dir, *dest;
+	size_t bytes = 0, failed = 0, len;
+	int i, disk_fd, size;
+
+	if (t_arg->argc < 3)
+		die("Usage: <diskname> <host directory> <filename>...");
+
+	diskname = t_arg->argv[0];
+	dir = t_arg->argv[1];
+
+	/* Mount once for all files, and read their content from the disk file */
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+	disk_fd = open(diskname, O_RDONLY);
+	if (disk_fd < 0)
+		die_perror("open");
+
+	for (i = 2; i < t_arg->argc; i++) {
+		len = strlen(dir) + strlen(t_arg->argv[i]) + 2;
+		dest = malloc(len);
+		if (!dest)
+			die_perror("malloc");
+		snprintf(dest, len, "%s/%s", dir, t_arg->argv[i]);
+		export_mkdirs(dest);
+
+		size = export_file(disk_fd, t_arg->argv[i], dest);
+		if (size < 0)
+			failed++;
+		else
+			bytes += size;
+		free(dest);
+	}
+
+	close(disk_fd);
+	if (fs_umount())
+		die("Cannot unmount diskname");
+
+	printf("Exported %zu/%d files (%zu bytes)\n", t_arg->argc - 2 - failed,
+	       t_arg->argc - 2, bytes);
+	if (failed)
+		exit(1);
+}
+
+/* Number of tab-separated parts of a session command */
+#define SESSION_ARGS 4
+
+/* Load host file @path in a buffer with an extra zero byte, NULL on error */
+static char *session_load(const char *path, int *size)
+{
+	struct stat st;
+	char *buf;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		return NULL;
+	}
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size > INT_MAX) {
+		test_fs_error("Not a regular file: %s", path);
+		close(fd);
+		return NULL;
+	}
+	*size = st.st_size;
+	buf = calloc(*size + 1, 1);
+	if (!buf)
+		die_perror("calloc");
+	if (read(fd, buf, *size) != *size) {
+		perror(path);
+		free(buf);
+		buf = NULL;
+	}
+	close(fd);
+	return buf;
+}
+
+/* Open file @filename and print its size, or its content if @cat is set */
+static int session_stat(const char *filename, int cat)
+{
+	char *buf;
+	int fs_fd, size, ret = 0;
+
+	fs_fd = fs_open(filename);
+	if (fs_fd < 0)
+		return -1;
+	size = fs_stat(fs_fd);
+	if (size < 0) {
+		ret = -1;
+	} else if (!cat) {
+		printf("Size of file '%s' is %d bytes\n", filename, size);
+	} else {
+		buf = malloc(size + 1);
+		if (!buf)
+			die_perror("malloc");
+		if (fs_read(fs_fd, buf, size) != size)
+			ret = -1;
+		else
+			fwrite(buf, 1, size, stdout);
+		free(buf);
+	}
+	fs_close(fs_fd);
+	return ret;
+}
+
+/* Write host file @host into new file @filename */
+static int session_add(const char *host, const char *filename)
+{
+	char *data;
+	int fs_fd, size, written;
+
+	data = session_load(host, &size);
+	if (!data)
+		return -1;
+	if (fs_create(filename)) {
+		free(data);
+		return -1;
+	}
+	fs_fd = fs_open(filename);
+	if (fs_fd < 0) {
+		free(data);
+		return -1;
+	}
+	written = fs_write(fs_fd, data, size);
+	fs_close(fs_fd);
+	free(data);
+	printf("Wrote file '%s' (%d/%d bytes)\n", filename, written, size);
+	return written == size ? 0 : -1;
+}
+
+/* Run one session command, returns -1 if it failed */
+static int session_command(char **args, const char *diskname, int *fs_fd,
+			   int *mounted)
+{
+	char *cmd = args[0], *data, *buf;
+	int size, count, len, ret = 0;
+
+	if (!strcmp(cmd, "MOUNT")) {
+		/* Already mounted for the session, unless unmounted before */
+		if (!*mounted && script_mount(diskname, args[1]))
+			return -1;
+		*mounted = 1;
+		return 0;
+	}
+	if (!strcmp(cmd, "UMOUNT")) {
+		if (fs_umount())
+			return -1;
+		*mounted = 0;
+		return 0;
+	}
+	if (!strcmp(cmd, "LS"))
+		return fs_ls();
+	if (!strcmp(cmd, "READDIR"))
+		return print_readdir();
+	if (!strcmp(cmd, "INFO"))
+		return fs_info();
+	if (!strcmp(cmd, "CLOSE")) {
+		ret = fs_close(*fs_fd);
+		*fs_fd = -1;
+		return ret;
+	}
+
+	/* All other commands have at least one argument */
+	if (!args[1])
+		return -1;
+	if (!strcmp(cmd, "CREATE"))
+		return fs_create(args[1]);
+	if (!strcmp(cmd, "MKDIR"))
+		return fs_mkdir(args[1]);
+	if (!strcmp(cmd, "DELETE"))
+		return fs_delete(args[1]);
+	if (!strcmp(cmd, "STAT"))
+		return session_stat(args[1], 0);
+	if (!strcmp(cmd, "CAT"))
+		return session_stat(args[1], 1);
+	if (!strcmp(cmd, "ADD"))
+		return session_add(args[1], args[2] ? args[2] : args[1]);
+	if (!strcmp(cmd, "CLONE"))
+		return args[2] ? fs_clone(args[1], args[2]) : -1;
+	if (!strcmp(cmd, "OPEN")) {
+		*fs_fd = fs_open(args[1]);
+		return *fs_fd < 0 ? -1 : 0;
+	}
+	if (!strcmp(cmd, "SEEK"))
+		return fs_lseek(*fs_fd, atoi(args[1]));
+
+	if (!strcmp(cmd, "WRITE") && args[2]) {
+		if (!strcmp(args[1], "DATA")) {
+			data = strdup(args[2]);
+			size = strlen(data);
+		} else if (!strcmp(args[1], "FILE")) {
+			data = session_load(args[2], &size);
+		} else {
+			return -1;
+		}
+		if (!data)
+			return -1;
+		count = fs_write(*fs_fd, data, size);
+		free(data);
+		if (count < 0)
+			return -1;
+		printf("Wrote %d bytes to file.\n", count);
+		return 0;
+	}
+
+	if (!strcmp(cmd, "READ") && args[2] && args[3]) {
+		len = atoi(args[1]);
+		if (len < 0)
+			return -1;
+		if (!strcmp(args[2], "DATA")) {
+			data = strdup(args[3]);
+			size = strlen(data);
+		} else if (!strcmp(args[2], "FILE")) {
+			data = session_load(args[3], &size);
+		} else {
+			return -1;
+		}
+		if (!data)
+			return -1;
+		buf = calloc(len + 1, 1);
+		if (!buf)
+			die_perror("calloc");
+		count = fs_read(*fs_fd, buf, len);
+		if (count < 0) {
+			ret = -1;
+		} else if (count == size && !memcmp(data, buf, size + 1)) {
+			printf("Read %d bytes from file. Compared %d correct.\n",
+			       count, size);
+		} else {
+			printf("Read unexpected data!\n");
+			ret = -1;
+		}
+		free(buf);
+		free(data);
+		return ret;
+	}
+
+	return -1;
+}
+
+void thread_fs_session(void *arg)
+{
+	struct thread_arg *t_arg = arg;
+	struct timespec start, end;
+	char line_buffer[1024], *args[SESSION_ARGS], *nl;
+	char *diskname;
+	int i, fs_fd = -1, mounted = 0, ret;
+	size_t commands = 0, failed = 0;
+	double us, total_us = 0;
+
+	if (t_arg->argc < 1)
+		die("Usage: <diskname>");
+
+	diskname = t_arg->argv[0];
+
+	/* Mounted once, for every command read from stdin */
+	if (fs_mount(diskname))
+		die("Cannot mount diskname");
+	mounted = 1;
+
+	while (fgets(line_buffer, sizeof(line_buffer), stdin)) {
+		nl = strchr(line_buffer, '\n');
+		if (nl)
+			*nl = '\0';
+
+		/* Same syntax as scripts, blank lines and comments skipped */
+		args[0] = strtok(line_buffer, "\t");
+		if (!args[0] || args[0][0] == '#')
+			continue;
+		if (!strcmp(args[0], "QUIT"))
+			break;
+		for (i = 1; i < SESSION_ARGS; i++)
+			args[i] = strtok(NULL, "\t");
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		ret = session_command(args, diskname, &fs_fd, &mounted);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		us = (end.tv_sec - start.tv_sec) * 1e6 +
+			(end.tv_nsec - start.tv_nsec) / 1e3;
+		total_us += us;
+		commands++;
+		if (ret)
+			failed++;
+		printf("%s %s (%.1f us)\n", args[0],
+		       ret ? "failed" : "successful", us);
+		/* Answer each command right away when driven through a pipe */
+		fflush(stdout);
+	}
+
+	if (fs_fd >= 0)
+		fs_close(fs_fd);
+	if (mounted && fs_umount())
+		die("Cannot unmount diskname");
+
+	printf("%zu commands, %zu failed, %.1f us on average\n", commands,
+	       failed, commands ? total_us / commands : 0);
+}
+
 void thread_fs_ls(void *arg)
 {
 	struct thread_arg *t_arg = arg;
@@ -514,10 +1309,13 @@ static struct {
 	{ "info",	thread_fs_info },
 	{ "ls",		thread_fs_ls },
 	{ "add",	thread_fs_add },
+	{ "import",	thread_fs_import },
 	{ "rm",		thread_fs_rm },
 	{ "cat",	thread_fs_cat },
+	{ "export",	thread_fs_export },
 	{ "stat",	thread_fs_stat },
-	{ "script",	thread_fs_script }
+	{ "script",	thread_fs_script },
+	{ "session",	thread_fs_session }
 };
 
 void usage(char *program)
@@ -0,0 +1,1022 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "disk.h"
+#include "fs.h"
+#include "layout.h"
+
+#define CHAIN_OK 0
+#define CHAIN_CYCLE 1
+#define CHAIN_CROSS 2
+#define CHAIN_BAD 3
+#define CHECK_PATH_LEN 256
+// # of FAT blocks, or of files, a thread takes at a time
+#define CHECK_FAT_CHUNK 64
+#define CHECK_FILE_CHUNK 16
+
+// Struct representation of a file(or directory) found while scanning
+struct checkFile {
+  // Copy of the file's entry, & disk block & slot it is stored at
+  struct root ent;
+  size_t block;
+  int slot;
+  // Index of the directory holding the file, -1 for the root directory
+  long parent;
+  // # of clusters claimed during the first walk of the chain
+  size_t claimed;
+  // Result of the second walk: # of clusters of the chain that belong to the
+  // file, or that it shares with clones owned by another file, last of them, &
+  // what ended the chain(CHAIN_*)
+  size_t length;
+  uint32_t last;
+  int end;
+  // # of clusters of the chain before the one it shares with clones from
+  size_t own;
+  // With ROOT_FLAG_SPARSE: # of clusters in holes, & cluster the last one
+  // ends at
+  size_t holes;
+  size_t holesEnd;
+  // For a chain of a deleted file left to free: its reclaimIndex + 1, else 0
+  int reclaim;
+  // With ROOT_FLAG_EXTENTS: header & runs of the extent list in the record,
+  // & index + 1 of the chain of its overflow cluster, 0 if none
+  struct extentHeader extents;
+  struct extentRun runs[EXTENT_INLINE_RUNS];
+  size_t overflow;
+  // True if the entry was changed by repairs
+  bool dirty;
+};
+
+// Struct representation of the image being checked
+struct check {
+  // Image file, read & written with pread()/pwrite() so threads can share it
+  int fd;
+  bool fat16;
+  struct superblock sb;
+  uint32_t numClusters;
+  size_t clusterSize;
+  // Whole FAT, 16-bit entries are widened like fat_get() does
+  uint32_t *fat;
+  // Owner of each cluster: index of the file + 1, 0 if none. A cluster shared
+  // by clones is owned by the file with the lowest index
+  uint32_t *owner;
+  // With FEATURE_CLONE: reference count of each cluster, & disk block of each
+  // block of the table. NULL otherwise
+  uint32_t *refs;
+  size_t *refBlocks;
+  size_t numRefBlocks;
+  // True for each FAT block modified by repairs
+  bool *dirtyFAT;
+  // Files of all directories, # of them that are chains without an entry
+  struct checkFile *files;
+  size_t numFiles;
+  size_t capFiles;
+  size_t numChains;
+  // # of threads, & next work item they take
+  unsigned int threads;
+  size_t next;
+};
+
+// Struct representation of the work of one thread
+struct checkWorker {
+  struct check *c;
+  int (*func)(struct check *c, size_t item);
+  size_t numItems;
+  size_t chunk;
+  int ret;
+};
+
+// HELPER FUNCTION - reads @count blocks of the image starting at @block
+static int check_read(struct check *c, size_t block, void *buf, size_t count)
+{
+  size_t len = count * BLOCK_SIZE, done = 0;
+  while (done < len) {
+    ssize_t ret = pread(c->fd, (char*)buf + done, len - done,
+                        (off_t)block * BLOCK_SIZE + done);
+    if (ret <= 0) {
+      return -1;
+    }
+    done += ret;
+  }
+  return 0;
+}
+
+// HELPER FUNCTION - writes @count blocks of the image starting at @block
+static int check_write(struct check *c, size_t block, const void *buf,
+                       size_t count)
+{
+  size_t len = count * BLOCK_SIZE, done = 0;
+  while (done < len) {
+    ssize_t ret = pwrite(c->fd, (const char*)buf + done, len - done,
+                         (off_t)block * BLOCK_SIZE + done);
+    if (ret <= 0) {
+      return -1;
+    }
+    done += ret;
+  }
+  return 0;
+}
+
+// HELPER FUNCTION - thread body: takes chunks of items until none are left
+static void *check_thread(void *arg)
+{
+  struct checkWorker *w = arg;
+  while (1) {
+    size_t first = __atomic_fetch_add(&w->c->next, w->chunk, __ATOMIC_RELAXED);
+    if (first >= w->numItems) {
+      return NULL;
+    }
+    for (size_t i = first; i < first + w->chunk && i < w->numItems; i++) {
+      if (w->func(w->c, i)) {
+        w->ret = -1;
+      }
+    }
+  }
+}
+
+// HELPER FUNCTION - runs @func on items 0 to @numItems - 1, spread on all
+// threads. Returns -1 if it failed on any item
+static int check_parallel(struct check *c,
+                          int (*func)(struct check *c, size_t item),
+                          size_t numItems, size_t chunk)
+{
+  pthread_t tids[c->threads];
+  struct checkWorker workers[c->threads];
+  unsigned int started = 1;
+  c->next = 0;
+
+  for (unsigned int i = 0; i < c->threads; i++) {
+    workers[i].c = c;
+    workers[i].func = func;
+    workers[i].numItems = numItems;
+    workers[i].chunk = chunk;
+    workers[i].ret = 0;
+  }
+  // The calling thread works too, & takes over if threads can't be started
+  while (started < c->threads &&
+         !pthread_create(&tids[started], NULL, check_thread,
+                         &workers[started])) {
+    started++;
+  }
+  check_thread(&workers[0]);
+
+  int ret = workers[0].ret;
+  for (unsigned int i = 1; i < started; i++) {
+    pthread_join(tids[i], NULL);
+    ret |= workers[i].ret;
+  }
+  return ret;
+}
+
+// HELPER FUNCTION - loads FAT block @item into the widened FAT
+static int check_load_fat(struct check *c, size_t item)
+{
+  uint8_t block[BLOCK_SIZE];
+  if (check_read(c, 1 + item, block, 1)) {
+    return -1;
+  }
+
+  size_t perBlock = c->fat16 ? ENTRIES_PER_FAT_BLOCK : ENTRIES_PER_FAT32_BLOCK;
+  size_t first = item * perBlock;
+  for (size_t i = 0; i < perBlock && first + i < c->numClusters; i++) {
+    if (c->fat16) {
+      uint16_t entry = ((uint16_t*)block)[i];
+      c->fat[first + i] = entry == FAT16_EOC ? FAT_EOC : entry;
+    } else {
+      c->fat[first + i] = ((uint32_t*)block)[i];
+    }
+  }
+  return 0;
+}
+
+// HELPER FUNCTION - true if cluster @i can be part of a chain
+static bool check_cluster(struct check *c, uint32_t i)
+{
+  return i != 0 && i < c->numClusters && c->fat[i] != 0;
+}
+
+// HELPER FUNCTION - first walk of the chain of file @item
+// Each cluster goes to the file with the lowest index claiming it, whatever
+// the order threads walk in. A walk stops at a cluster it can't claim: one of
+// the file's own(a cycle) or one of a file with a lower index(a cross link)
+static int check_claim(struct check *c, size_t item)
+{
+  struct checkFile *f = &c->files[item];
+  uint32_t me = item + 1;
+  f->claimed = 0;
+  for (uint32_t i = f->ent.firstIndex; i != FAT_EOC && check_cluster(c, i);
+       i = c->fat[i]) {
+    uint32_t cur = __atomic_load_n(&c->owner[i], __ATOMIC_RELAXED);
+    bool claimed = false;
+    while ((cur == 0 || cur > me) && !claimed) {
+      claimed = __atomic_compare_exchange_n(&c->owner[i], &cur, me, true,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED);
+    }
+    if (!claimed) {
+      break;
+    }
+    f->claimed++;
+  }
+  return 0;
+}
+
+// HELPER FUNCTION - second walk of the chain of file @item, once all claims
+// are settled. Records how much of the chain belongs to the file & why it ends
+static int check_walk(struct check *c, size_t item)
+{
+  struct checkFile *f = &c->files[item];
+  uint32_t me = item + 1;
+  f->length = 0;
+  f->last = FAT_EOC;
+  f->end = CHAIN_OK;
+  f->own = SIZE_MAX;
+  for (uint32_t i = f->ent.firstIndex; i != FAT_EOC; i = c->fat[i]) {
+    if (!check_cluster(c, i)) {
+      f->end = CHAIN_BAD;
+      break;
+    }
+    // Chain joining clones at a cluster counted as shared goes on with theirs,
+    // which its owner checks
+    if (f->own == SIZE_MAX && c->owner[i] != me && c->refs && c->refs[i]) {
+      f->own = f->length;
+    }
+    if (f->own != SIZE_MAX) {
+      if (f->length - f->own == c->numClusters) {
+        f->end = CHAIN_CYCLE;
+        break;
+      }
+      f->length++;
+      f->last = i;
+      continue;
+    }
+    if (c->owner[i] != me) {
+      f->end = CHAIN_CROSS;
+      break;
+    }
+    // All clusters claimed were walked, so this one comes round again
+    if (f->length == f->claimed) {
+      f->end = CHAIN_CYCLE;
+      break;
+    }
+    f->length++;
+    f->last = i;
+  }
+  if (f->own == SIZE_MAX) {
+    f->own = f->length;
+  }
+  return 0;
+}
+
+// HELPER FUNCTION - adds entry @ent stored at @block/@slot to the files found
+static int check_add(struct check *c, const struct root *ent, size_t block,
+                     int slot, long parent)
+{
+  if (c->numFiles == c->capFiles) {
+    size_t cap = c->capFiles ? 2 * c->capFiles : 256;
+    struct checkFile *files = realloc(c->files, cap * sizeof(*files));
+    if (!files) {
+      return -1;
+    }
+    c->files = files;
+    c->capFiles = cap;
+  }
+  struct checkFile *f = &c->files[c->numFiles++];
+  memset(f, 0, sizeof(*f));
+  f->ent = *ent;
+  f->block = block;
+  f->slot = slot;
+  f->parent = parent;
+  return 0;
+}
+
+// HELPER FUNCTION - adds the entries of directory block @entries to the files
+// found
+static int check_add_block(struct check *c, const struct root *entries,
+                           int numSlots, size_t block, long parent)
+{
+  for (int i = 0; i < numSlots; i++) {
+    if (entries[i].fileName[0] == '\0') {
+      continue;
+    }
+    if (check_add(c, &entries[i], block, i, parent)) {
+      return -1;
+    }
+    // Holes of a sparse file are summed up, & inline data or holes skipped
+    if (entries[i].flags & ROOT_FLAG_SPARSE && i + INLINE_SLOTS < numSlots) {
+      struct checkFile *f = &c->files[c->numFiles - 1];
+      const struct hole *holes = (const struct hole*)&entries[i + 1];
+      for (size_t h = 0; h < SPARSE_MAX_HOLES && holes[h].count; h++) {
+        f->holes += holes[h].count;
+        f->holesEnd = (size_t)holes[h].start + holes[h].count;
+      }
+    }
+    // Extent list is kept, & its overflow cluster owned by a chain of its own
+    if (entries[i].flags & ROOT_FLAG_EXTENTS) {
+      size_t f = c->numFiles - 1;
+      if (i + INLINE_SLOTS >= numSlots) {
+        c->files[f].ent.flags &= ~ROOT_FLAG_EXTENTS;
+      } else {
+        const struct extentHeader *header =
+          (const struct extentHeader*)&entries[i + 1];
+        c->files[f].extents = *header;
+        memcpy(c->files[f].runs, header + 1, sizeof(c->files[f].runs));
+      }
+      if (c->files[f].extents.overflow) {
+        struct root chain;
+        memset(&chain, 0, sizeof(chain));
+        strcpy((char*)chain.fileName, "<extents>");
+        chain.size = c->clusterSize;
+        chain.firstIndex = c->files[f].extents.overflow;
+        if (check_add(c, &chain, 0, -1, -1)) {
+          return -1;
+        }
+        c->files[f].overflow = c->numFiles;
+        c->numChains++;
+      }
+    }
+    if (entries[i].flags & (ROOT_FLAG_INLINE | ROOT_FLAG_SPARSE |
+                            ROOT_FLAG_EXTENTS)) {
+      i += INLINE_SLOTS;
+    }
+  }
+  return 0;
+}
+
+// HELPER FUNCTION - scans the root directory, then every subdirectory found,
+// for the files to check. Bucket clusters are only scanned once, so that a
+// cross-linked directory can't make the scan go round in circles
+static int check_scan(struct check *c)
+{
+  struct root entries[DIR_ENTRIES_PER_BLOCK];
+  if (c->fat16) {
+    struct root16 entries16[FS_FILE_MAX_COUNT];
+    if (check_read(c, c->sb.rootIndex, entries16, 1)) {
+      return -1;
+    }
+    memset(entries, 0, sizeof(entries));
+    for (int i = 0; i < FS_FILE_MAX_COUNT; i++) {
+      memcpy(entries[i].fileName, entries16[i].fileName, FILENAME_SIZE);
+      entries[i].size = entries16[i].size;
+      entries[i].firstIndex = entries16[i].firstIndex == FAT16_EOC ? FAT_EOC :
+        entries16[i].firstIndex;
+    }
+    return check_add_block(c, entries, FS_FILE_MAX_COUNT, c->sb.rootIndex, -1);
+  }
+
+  if (check_read(c, c->sb.rootIndex, entries, 1) ||
+      check_add_block(c, entries, FS_FILE_MAX_COUNT, c->sb.rootIndex, -1)) {
+    return -1;
+  }
+
+  bool *scanned = calloc(c->numClusters, sizeof(bool));
+  if (!scanned) {
+    return -1;
+  }
+  // Files found are appended, so directories found get scanned in turn
+  for (size_t d = 0; d < c->numFiles; d++) {
+    if (!(c->files[d].ent.flags & ROOT_FLAG_DIR)) {
+      continue;
+    }
+    size_t numBuckets = c->files[d].ent.size / BLOCK_SIZE;
+    uint32_t i = c->files[d].ent.firstIndex;
+    for (size_t b = 0; b < numBuckets && check_cluster(c, i) &&
+         !scanned[i]; b++) {
+      if (check_read(c, c->sb.dataIndex + (size_t)i * c->sb.clusterBlocks +
+                     b % c->sb.clusterBlocks, entries, 1) ||
+          check_add_block(c, entries, DIR_ENTRIES_PER_BLOCK,
+                          c->sb.dataIndex + (size_t)i * c->sb.clusterBlocks +
+                          b % c->sb.clusterBlocks, d)) {
+        free(scanned);
+        return -1;
+      }
+      if ((b + 1) % c->sb.clusterBlocks == 0) {
+        scanned[i] = true;
+        i = c->fat[i];
+      }
+    }
+  }
+  free(scanned);
+  return 0;
+}
+
+// HELPER FUNCTION - loads & validates the superblock, like fs_mount() does
+static int check_superblock(struct check *c)
+{
+  uint8_t block[BLOCK_SIZE];
+  struct stat st;
+  if (fstat(c->fd, &st) || check_read(c, 0, block, 1)) {
+    fprintf(stderr, "superblock: cannot read\n");
+    return -1;
+  }
+
+  struct superblock *sb = &c->sb;
+  if (!memcmp(block, "ECS150FS", SIGNATURE_BYTES)) {
+    struct superblock16 *sb16 = (struct superblock16*)block;
+    c->fat16 = true;
+    memset(sb, 0, sizeof(*sb));
+    memcpy(sb->signature, sb16->signature, SIGNATURE_BYTES);
+    sb->numBlocks = sb16->numBlocks;
+    sb->rootIndex = sb16->rootIndex;
+    sb->dataIndex = sb16->dataIndex;
+    sb->numDataBlocks = sb16->numDataBlocks;
+    sb->numFATBlocks = sb16->numFATBlocks;
+    sb->clusterBlocks = 1;
+  } else if (!memcmp(block, "ECS150FX", SIGNATURE_BYTES)) {
+    c->fat16 = false;
+    memcpy(sb, block, sizeof(*sb));
+    if (sb->version != FS_VERSION) {
+      fprintf(stderr, "superblock: unsupported version %u\n", sb->version);
+      return -1;
+    }
+    if (sb->features & ~FEATURES_KNOWN) {
+      fprintf(stderr, "superblock: unsupported features 0x%x\n",
+              sb->features);
+      return -1;
+    }
+    if (sb->clusterBlocks == 0) {
+      sb->clusterBlocks = 1;
+    }
+  } else {
+    fprintf(stderr, "superblock: wrong signature\n");
+    return -1;
+  }
+
+  if ((off_t)sb->numBlocks * BLOCK_SIZE != st.st_size) {
+    fprintf(stderr, "superblock: %u blocks, image holds %lld\n",
+            sb->numBlocks, (long long)(st.st_size / BLOCK_SIZE));
+    return -1;
+  }
+  if (sb->rootIndex != sb->numFATBlocks + 1 ||
+      sb->dataIndex != sb->rootIndex + 1 ||
+      (uint64_t)sb->dataIndex + sb->numDataBlocks > sb->numBlocks) {
+    fprintf(stderr, "superblock: wrong layout\n");
+    return -1;
+  }
+  c->numClusters = sb->numDataBlocks / sb->clusterBlocks;
+  c->clusterSize = (size_t)sb->clusterBlocks * BLOCK_SIZE;
+  if ((sb->clusterBlocks & (sb->clusterBlocks - 1)) ||
+      sb->numDataBlocks % sb->clusterBlocks ||
+      (uint64_t)sb->numFATBlocks * (c->fat16 ? ENTRIES_PER_FAT_BLOCK :
+      ENTRIES_PER_FAT32_BLOCK) < c->numClusters) {
+    fprintf(stderr, "superblock: wrong cluster size\n");
+    return -1;
+  }
+  return 0;
+}
+
+// HELPER FUNCTION - writes path of file @i into @path
+static void check_path(struct check *c, long i, char *path, size_t size)
+{
+  char parent[CHECK_PATH_LEN] = "";
+  if (c->files[i].parent != -1) {
+    check_path(c, c->files[i].parent, parent, sizeof(parent));
+  }
+  snprintf(path, size, "%s/%.*s", parent, FILENAME_SIZE,
+           (char*)c->files[i].ent.fileName);
+}
+
+// HELPER FUNCTION - sets FAT entry @i, marking its FAT block for writing
+static void check_fat_set(struct check *c, uint32_t i, uint32_t entry)
+{
+  c->fat[i] = entry;
+  c->dirtyFAT[i / (c->fat16 ? ENTRIES_PER_FAT_BLOCK :
+                   ENTRIES_PER_FAT32_BLOCK)] = true;
+}
+
+// HELPER FUNCTION - keeps the first @keep clusters of the chain of file @f
+// that belong to it, & frees the others. Clusters shared with clones are left
+// to them
+static void check_cut(struct check *c, struct checkFile *f, size_t keep)
+{
+  uint32_t i = f->ent.firstIndex;
+  uint32_t prev = FAT_EOC;
+  for (size_t n = 0; n < f->length; n++) {
+    if (n >= f->own && n > keep) {
+      break;
+    }
+    uint32_t next = c->fat[i];
+    if (n == keep) {
+      if (prev == FAT_EOC) {
+        f->ent.firstIndex = FAT_EOC;
+        f->dirty = true;
+      } else {
+        check_fat_set(c, prev, FAT_EOC);
+      }
+    }
+    if (n >= keep && n < f->own) {
+      check_fat_set(c, i, 0);
+      c->owner[i] = 0;
+    }
+    prev = i;
+    i = next;
+  }
+  // Chain going on past its clusters(cycle, cross link, bad link) is ended
+  if (keep >= f->length && f->end != CHAIN_OK) {
+    if (prev == FAT_EOC) {
+      f->ent.firstIndex = FAT_EOC;
+      f->dirty = true;
+    } else {
+      check_fat_set(c, prev, FAT_EOC);
+    }
+  }
+  if (keep < f->length) {
+    f->length = keep;
+  }
+  if (keep < f->own) {
+    f->own = keep;
+  }
+  f->end = CHAIN_OK;
+}
+
+// HELPER FUNCTION - reports & optionally repairs problems of file @i
+static void check_file(struct check *c, size_t i, unsigned int flags,
+                       struct fs_check_report *report)
+{
+  static const char *ends[] = {
+    [CHAIN_CYCLE] = "cycle", [CHAIN_CROSS] = "cross link",
+    [CHAIN_BAD] = "bad link",
+  };
+  struct checkFile *f = &c->files[i];
+  bool repair = flags & FS_CHECK_REPAIR;
+  char path[CHECK_PATH_LEN];
+  check_path(c, i, path, sizeof(path));
+
+  if (f->end != CHAIN_OK) {
+    printf("%s: %s after %zu clusters%s\n", path, ends[f->end], f->length,
+           repair ? ", chain ended" : "");
+    report->cycles += f->end == CHAIN_CYCLE;
+    report->cross_links += f->end == CHAIN_CROSS;
+    report->bad_links += f->end == CHAIN_BAD;
+    if (repair) {
+      check_cut(c, f, f->length);
+      report->repaired++;
+    }
+  }
+  // Chains of deleted files have no size
+  if (f->reclaim) {
+    return;
+  }
+
+  // # of clusters the file's size needs, & size to shrink it to if the chain
+  // is too short
+  size_t need = (f->ent.size + c->clusterSize - 1) / c->clusterSize;
+  uint64_t fixedSize = (uint64_t)f->length * c->clusterSize;
+  if (f->ent.flags & ROOT_FLAG_DIR) {
+    // Directories are a power of 2 of buckets, shrunk to what the chain holds
+    uint64_t buckets = f->ent.size / BLOCK_SIZE;
+    if (f->ent.size % BLOCK_SIZE || buckets == 0 || buckets > DIR_MAX_BUCKETS ||
+        (buckets & (buckets - 1))) {
+      need = SIZE_MAX;
+    }
+    uint64_t fit = fixedSize / BLOCK_SIZE;
+    for (buckets = 1; buckets * 2 <= fit && buckets < DIR_MAX_BUCKETS; ) {
+      buckets *= 2;
+    }
+    fixedSize = fit ? buckets * BLOCK_SIZE : 0;
+  } else if (f->ent.flags & ROOT_FLAG_INLINE) {
+    // Inline files have no clusters at all
+    need = f->ent.size <= INLINE_MAX_BYTES ? 0 : SIZE_MAX;
+    fixedSize = INLINE_MAX_BYTES;
+  } else if (f->ent.flags & ROOT_FLAG_COMPRESSED) {
+    // Compressed files only need some clusters if not empty
+    need = f->ent.size == 0 ? 0 : f->length ? f->length : 1;
+    fixedSize = 0;
+  } else if (f->ent.flags & ROOT_FLAG_SPARSE) {
+    // Sparse files have no clusters in their holes, which the size covers
+    need = need >= f->holesEnd ? need - f->holes : SIZE_MAX;
+    fixedSize += (uint64_t)f->holes * c->clusterSize;
+  }
+  if (need == f->length) {
+    return;
+  }
+  // Chain can't be cut where clones share it, the size grows to it instead
+  if (need < f->length && need > f->own) {
+    need = SIZE_MAX;
+  }
+
+  report->size_mismatches++;
+  printf("%s: size %llu, chain of %zu clusters%s\n", path,
+         (unsigned long long)f->ent.size, f->length,
+         !repair ? "" : need > f->length ? ", size fixed" :
+         ", chain shortened");
+  if (!repair) {
+    return;
+  }
+  if (need > f->length) {
+    f->ent.size = fixedSize;
+    f->dirty = true;
+    need = (fixedSize + c->clusterSize - 1) / c->clusterSize - f->holes;
+    if (f->ent.flags & ROOT_FLAG_INLINE) {
+      need = 0;
+    }
+  }
+  // Clusters past the end of the file are freed
+  if (need < f->length) {
+    check_cut(c, f, need);
+  }
+  report->repaired++;
+}
+
+// HELPER FUNCTION - checks the extent list of file @i against its chain, once
+// chains are repaired. A list that doesn't match is optionally marked out of
+// date, for the file system to rebuild it
+static int check_extents(struct check *c, size_t i, unsigned int flags,
+                         struct fs_check_report *report)
+{
+  struct checkFile *f = &c->files[i];
+  if (!(f->ent.flags & ROOT_FLAG_EXTENTS)) {
+    return 0;
+  }
+  bool repair = flags & FS_CHECK_REPAIR;
+  // An overflow cluster repairs cut off is no longer the list's
+  if (f->overflow && c->files[f->overflow - 1].ent.firstIndex == FAT_EOC) {
+    f->extents.overflow = 0;
+    f->overflow = 0;
+    f->dirty = true;
+  }
+  if (f->extents.numRuns == 0) {
+    return 0;
+  }
+
+  // Runs past the record are read from the overflow cluster
+  const struct extentRun *runs = f->runs;
+  uint8_t *buf = NULL;
+  bool match = f->end == CHAIN_OK;
+  if (f->extents.numRuns > EXTENT_INLINE_RUNS) {
+    match = match && f->overflow &&
+      f->extents.numRuns <= c->clusterSize / sizeof(struct extentRun);
+    if (match) {
+      if (!(buf = malloc(c->clusterSize))) {
+        return -1;
+      }
+      if (check_read(c, c->sb.dataIndex + (size_t)f->extents.overflow *
+                     c->sb.clusterBlocks, buf, c->sb.clusterBlocks)) {
+        free(buf);
+        return -1;
+      }
+      runs = (const struct extentRun*)buf;
+    }
+  }
+  // Runs must follow the chain cluster by cluster, & cover all of it
+  uint32_t cluster = f->ent.firstIndex;
+  size_t n = 0;
+  for (uint32_t r = 0; match && r < f->extents.numRuns; r++) {
+    for (uint32_t k = 0; match && k < runs[r].count; k++, n++) {
+      match = n < f->length && cluster == runs[r].first + k;
+      cluster = match ? c->fat[cluster] : cluster;
+    }
+    match = match && runs[r].count != 0;
+  }
+  free(buf);
+  if (match && n == f->length) {
+    return 0;
+  }
+
+  char path[CHECK_PATH_LEN];
+  check_path(c, i, path, sizeof(path));
+  printf("%s: extent list doesn't match chain%s\n", path,
+         repair ? ", list cleared" : "");
+  report->extent_mismatches++;
+  if (repair) {
+    f->extents.numRuns = 0;
+    f->dirty = true;
+    report->repaired++;
+  }
+  return 0;
+}
+
+// HELPER FUNCTION - writes entries of repaired files back to their blocks
+static int check_write_entries(struct check *c)
+{
+  bool dirtySB = false;
+  for (size_t i = 0; i < c->numFiles; i++) {
+    // Chain of a deleted file starts in the superblock, reference count table
+    // has no entry
+    if (c->files[i].dirty && c->files[i].reclaim) {
+      uint32_t first = c->files[i].ent.firstIndex;
+      c->sb.reclaimIndex[c->files[i].reclaim - 1] = first == FAT_EOC ? 0 :
+        first;
+      c->files[i].dirty = false;
+      dirtySB = true;
+    }
+    if (!c->files[i].dirty || c->files[i].block == 0) {
+      continue;
+    }
+    // Every dirty entry of the same block is written at once
+    size_t block = c->files[i].block;
+    uint8_t buf[BLOCK_SIZE];
+    if (check_read(c, block, buf, 1)) {
+      return -1;
+    }
+    for (size_t j = i; j < c->numFiles; j++) {
+      struct checkFile *f = &c->files[j];
+      if (!f->dirty || f->block != block) {
+        continue;
+      }
+      if (c->fat16) {
+        struct root16 *ent = (struct root16*)buf + f->slot;
+        ent->size = f->ent.size;
+        ent->firstIndex = f->ent.firstIndex == FAT_EOC ? FAT16_EOC :
+          f->ent.firstIndex;
+      } else {
+        struct root *ent = (struct root*)buf + f->slot;
+        ent->size = f->ent.size;
+        ent->firstIndex = f->ent.firstIndex;
+        if (f->ent.flags & ROOT_FLAG_EXTENTS) {
+          memcpy(ent + 1, &f->extents, sizeof(f->extents));
+        }
+      }
+      f->dirty = false;
+    }
+    if (check_write(c, block, buf, 1)) {
+      return -1;
+    }
+  }
+  if (dirtySB && check_write(c, 0, &c->sb, 1)) {
+    return -1;
+  }
+  return 0;
+}
+
+// HELPER FUNCTION - writes FAT blocks modified by repairs back to the image
+static int check_write_fat(struct check *c)
+{
+  size_t perBlock = c->fat16 ? ENTRIES_PER_FAT_BLOCK : ENTRIES_PER_FAT32_BLOCK;
+  for (size_t b = 0; b < c->sb.numFATBlocks; b++) {
+    if (!c->dirtyFAT[b]) {
+      continue;
+    }
+    // Entries past the last cluster are kept as they are
+    uint8_t block[BLOCK_SIZE];
+    if (check_read(c, 1 + b, block, 1)) {
+      return -1;
+    }
+    for (size_t i = 0; i < perBlock && b * perBlock + i < c->numClusters;
+         i++) {
+      uint32_t entry = c->fat[b * perBlock + i];
+      if (c->fat16) {
+        ((uint16_t*)block)[i] = entry == FAT_EOC ? FAT16_EOC : entry;
+      } else {
+        ((uint32_t*)block)[i] = entry;
+      }
+    }
+    if (check_write(c, 1 + b, block, 1)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// HELPER FUNCTION - loads the reference count table of clones, & adds its
+// chain to the files found so that its clusters are owned
+static int check_load_refs(struct check *c)
+{
+  c->numRefBlocks = (c->numClusters + REFS_PER_BLOCK - 1) / REFS_PER_BLOCK;
+  c->refs = calloc(c->numRefBlocks * REFS_PER_BLOCK, sizeof(uint32_t));
+  c->refBlocks = malloc(c->numRefBlocks * sizeof(size_t));
+  if (!c->refs || !c->refBlocks) {
+    return -1;
+  }
+  uint32_t i = c->sb.refIndex;
+  for (size_t b = 0; b < c->numRefBlocks; b++) {
+    if (!check_cluster(c, i)) {
+      return -1;
+    }
+    c->refBlocks[b] = c->sb.dataIndex + (size_t)i * c->sb.clusterBlocks +
+      b % c->sb.clusterBlocks;
+    if (check_read(c, c->refBlocks[b], c->refs + b * REFS_PER_BLOCK, 1)) {
+      return -1;
+    }
+    if ((b + 1) % c->sb.clusterBlocks == 0) {
+      i = c->fat[i];
+    }
+  }
+
+  struct root table;
+  memset(&table, 0, sizeof(table));
+  strcpy((char*)table.fileName, "<refcounts>");
+  table.size = c->numRefBlocks * BLOCK_SIZE;
+  table.firstIndex = c->sb.refIndex;
+  c->numChains++;
+  return check_add(c, &table, 0, -1, -1);
+}
+
+// HELPER FUNCTION - adds the chain of the changed block bitmap to the files
+// found, so that its clusters are owned
+static int check_load_cbt(struct check *c)
+{
+  struct root bitmap;
+  memset(&bitmap, 0, sizeof(bitmap));
+  strcpy((char*)bitmap.fileName, "<changes>");
+  bitmap.size = (c->sb.numBlocks + CBT_BITS_PER_BLOCK - 1) /
+    CBT_BITS_PER_BLOCK * BLOCK_SIZE;
+  bitmap.firstIndex = c->sb.cbtIndex;
+  c->numChains++;
+  return check_add(c, &bitmap, 0, -1, -1);
+}
+
+// HELPER FUNCTION - adds the chains of deleted files left to free to the files
+// found, so that their clusters are owned
+static int check_load_reclaim(struct check *c)
+{
+  for (int r = 0; r < RECLAIM_MAX; r++) {
+    if (c->sb.reclaimIndex[r] == 0) {
+      continue;
+    }
+    struct root chain;
+    memset(&chain, 0, sizeof(chain));
+    strcpy((char*)chain.fileName, "<reclaim>");
+    chain.firstIndex = c->sb.reclaimIndex[r];
+    if (check_add(c, &chain, 0, -1, -1)) {
+      return -1;
+    }
+    c->files[c->numFiles - 1].reclaim = r + 1;
+    c->numChains++;
+  }
+  return 0;
+}
+
+// HELPER FUNCTION - checks reference counts against the references found to
+// each cluster: from the first cluster of a file, or the FAT entry of a
+// cluster owned by a file. Optionally rewrites the table
+static int check_refs(struct check *c, unsigned int flags,
+                      struct fs_check_report *report)
+{
+  uint32_t *found = calloc(c->numClusters, sizeof(uint32_t));
+  if (!found) {
+    return -1;
+  }
+  for (size_t f = 0; f < c->numFiles; f++) {
+    if (check_cluster(c, c->files[f].ent.firstIndex)) {
+      found[c->files[f].ent.firstIndex]++;
+    }
+  }
+  for (uint32_t i = 1; i < c->numClusters; i++) {
+    if (c->owner[i] && check_cluster(c, c->fat[i])) {
+      found[c->fat[i]]++;
+    }
+  }
+
+  bool repair = flags & FS_CHECK_REPAIR;
+  int ret = 0;
+  for (size_t b = 0; b < c->numRefBlocks; b++) {
+    bool dirty = false;
+    for (size_t k = 0; k < REFS_PER_BLOCK; k++) {
+      size_t i = b * REFS_PER_BLOCK + k;
+      uint32_t refs = i < c->numClusters && found[i] > 1 ? found[i] - 1 : 0;
+      if (c->refs[i] == refs) {
+        continue;
+      }
+      printf("cluster %zu: %u references counted, %u found%s\n", i,
+             c->refs[i] + 1, refs + 1, repair ? ", count fixed" : "");
+      report->ref_mismatches++;
+      if (repair) {
+        c->refs[i] = refs;
+        report->repaired++;
+        dirty = true;
+      }
+    }
+    if (dirty && check_write(c, c->refBlocks[b], c->refs + b * REFS_PER_BLOCK,
+                             1)) {
+      ret = -1;
+    }
+  }
+  free(found);
+  return ret;
+}
+
+// HELPER FUNCTION - runs every pass of the check on the opened image
+static int check_run(struct check *c, unsigned int flags,
+                     struct fs_check_report *report)
+{
+  if (check_superblock(c)) {
+    return -1;
+  }
+
+  c->fat = malloc((size_t)c->numClusters * sizeof(uint32_t));
+  c->owner = calloc(c->numClusters, sizeof(uint32_t));
+  c->dirtyFAT = calloc(c->sb.numFATBlocks, sizeof(bool));
+  if (!c->fat || !c->owner || !c->dirtyFAT) {
+    return -1;
+  }
+  if (check_parallel(c, check_load_fat, c->sb.numFATBlocks,
+                     CHECK_FAT_CHUNK)) {
+    fprintf(stderr, "FAT: cannot read\n");
+    return -1;
+  }
+  if (c->fat[0] != FAT_EOC) {
+    fprintf(stderr, "FAT: first entry not invalid\n");
+    return -1;
+  }
+
+  // Files of all directories, then their chains in two parallel passes
+  if (check_scan(c)) {
+    fprintf(stderr, "directories: cannot read\n");
+    return -1;
+  }
+  if (c->sb.features & FEATURE_CLONE && check_load_refs(c)) {
+    fprintf(stderr, "reference counts: cannot read\n");
+    return -1;
+  }
+  if (c->sb.features & FEATURE_RECLAIM && check_load_reclaim(c)) {
+    return -1;
+  }
+  if (c->sb.features & FEATURE_CBT && check_load_cbt(c)) {
+    return -1;
+  }
+  report->files = c->numFiles - c->numChains;
+  check_parallel(c, check_claim, c->numFiles, CHECK_FILE_CHUNK);
+  check_parallel(c, check_walk, c->numFiles, CHECK_FILE_CHUNK);
+
+  for (size_t i = 0; i < c->numFiles; i++) {
+    check_file(c, i, flags, report);
+  }
+  for (size_t i = 0; i < c->numFiles; i++) {
+    if (check_extents(c, i, flags, report)) {
+      fprintf(stderr, "extent lists: cannot read\n");
+      return -1;
+    }
+  }
+
+  // Allocated clusters nobody owns, reported as ranges
+  for (uint32_t i = 1; i < c->numClusters; i++) {
+    if (c->fat[i] == 0 || c->owner[i]) {
+      continue;
+    }
+    uint32_t j = i;
+    while (j + 1 < c->numClusters && c->fat[j + 1] && !c->owner[j + 1]) {
+      j++;
+    }
+    printf("clusters %u-%u: leaked%s\n", i, j,
+           flags & FS_CHECK_REPAIR ? ", freed" : "");
+    report->leaks += j - i + 1;
+    if (flags & FS_CHECK_REPAIR) {
+      for (uint32_t k = i; k <= j; k++) {
+        check_fat_set(c, k, 0);
+      }
+      report->repaired += j - i + 1;
+    }
+    i = j;
+  }
+
+  if ((c->refs && check_refs(c, flags, report)) ||
+      (flags & FS_CHECK_REPAIR &&
+       (check_write_entries(c) || check_write_fat(c)))) {
+    fprintf(stderr, "cannot write repairs\n");
+    return -1;
+  }
+  // Repairs aren't tracked by the changed block bitmap, the next mount then
+  // counts every block as changed
+  if (report->repaired && c->sb.features & FEATURE_CBT) {
+    c->sb.cbtOpen = 1;
+    if (check_write(c, 0, &c->sb, 1)) {
+      fprintf(stderr, "cannot write repairs\n");
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int fs_check(const char *diskname, unsigned int flags, unsigned int threads,
+             struct fs_check_report *report)
+{
+  // ERROR CHECKING
+  // Invalid diskname or report
+  if (!diskname || !report) {
+    return -1;
+  }
+
+  struct check c;
+  memset(&c, 0, sizeof(c));
+  memset(report, 0, sizeof(*report));
+  c.threads = threads;
+  if (c.threads == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    c.threads = cpus > 0 ? cpus : 1;
+  }
+
+  c.fd = open(diskname, flags & FS_CHECK_REPAIR ? O_RDWR : O_RDONLY);
+  if (c.fd < 0) {
+    perror("open");
+    return -1;
+  }
+
+  int ret = check_run(&c, flags, report);
+
+  close(c.fd);
+  free(c.fat);
+  free(c.owner);
+  free(c.refs);
+  free(c.refBlocks);
+  free(c.dirtyFAT);
+  free(c.files);
+  return ret;
+}
@@ -1,6 +1,8 @@
+#define _GNU_SOURCE
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -23,12 +25,19 @@ struct disk {
 	int fd;
 	/* Block count */
 	size_t bcount;
+	/* Number of blocks read and written since the disk was opened */
+	size_t reads;
+	size_t writes;
+	/* Read-only shared mapping of the disk image, NULL if not opened so */
+	void *map;
+	/* Called with the blocks of each successful write, if not NULL */
+	void (*written)(size_t block, size_t count);
 };
 
 /* Currently open virtual disk (invalid by default) */
 static struct disk disk = { .fd = INVALID_FD };
 
-int block_disk_open(const char *diskname)
+static int disk_open(const char *diskname, int flags)
 {
 	int fd;
 	struct stat st;
@@ -43,13 +52,14 @@ int block_disk_open(const char *diskname)
 		return -1;
 	}
 
-	if ((fd = open(diskname, O_RDWR, 0644)) < 0) {
+	if ((fd = open(diskname, flags, 0644)) < 0) {
 		perror("open");
 		return -1;
 	}
 
 	if (fstat(fd, &st)) {
 		perror("fstat");
+		close(fd);
 		return -1;
 	}
 
@@ -57,15 +67,44 @@ int block_disk_open(const char *diskname)
 	if (st.st_size % BLOCK_SIZE != 0) {
 		block_error("size '%zu' is not multiple of '%d'",
 			    st.st_size, BLOCK_SIZE);
+		close(fd);
 		return -1;
 	}
 
+	disk.map = NULL;
+	if ((flags & O_ACCMODE) == O_RDONLY) {
+		disk.map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (disk.map == MAP_FAILED) {
+			perror("mmap");
+			close(fd);
+			return -1;
+		}
+	}
+
 	disk.fd = fd;
 	disk.bcount = st.st_size / BLOCK_SIZE;
+	disk.reads = 0;
+	disk.writes = 0;
+	disk.written = NULL;
 
 	return 0;
 }
 
+int block_disk_open(const char *diskname)
+{
+	return disk_open(diskname, O_RDWR);
+}
+
+int block_disk_open_direct(const char *diskname)
+{
+	return disk_open(diskname, O_RDWR | O_DIRECT);
+}
+
+int block_disk_open_readonly(const char *diskname)
+{
+	return disk_open(diskname, O_RDONLY);
+}
+
 int block_disk_close(void)
 {
 	if (disk.fd == INVALID_FD) {
@@ -73,6 +112,10 @@ int block_disk_close(void)
 		return -1;
 	}
 
+	if (disk.map) {
+		munmap(disk.map, disk.bcount * BLOCK_SIZE);
+		disk.map = NULL;
+	}
 	close(disk.fd);
 
 	disk.fd = INVALID_FD;
@@ -80,6 +123,43 @@ int block_disk_close(void)
 	return 0;
 }
 
+int block_disk_sync(void)
+{
+	if (disk.fd == INVALID_FD) {
+		block_error("no disk currently open");
+		return -1;
+	}
+
+	if (fdatasync(disk.fd)) {
+		perror("fdatasync");
+		return -1;
+	}
+
+	return 0;
+}
+
+const void *block_disk_map(void)
+{
+	if (disk.fd == INVALID_FD) {
+		block_error("no disk currently open");
+		return NULL;
+	}
+
+	return disk.map;
+}
+
+int block_disk_track(void (*written)(size_t block, size_t count))
+{
+	if (disk.fd == INVALID_FD) {
+		block_error("no disk currently open");
+		return -1;
+	}
+
+	disk.written = written;
+
+	return 0;
+}
+
 int block_disk_count(void)
 {
 	if (disk.fd == INVALID_FD) {
@@ -90,6 +170,19 @@ int block_disk_count(void)
 	return disk.bcount;
 }
 
+int block_disk_io_count(size_t *reads, size_t *writes)
+{
+	if (disk.fd == INVALID_FD) {
+		block_error("no disk currently open");
+		return -1;
+	}
+
+	*reads = disk.reads;
+	*writes = disk.writes;
+
+	return 0;
+}
+
 int block_write(size_t block, const void *buf)
 {
 	if (disk.fd == INVALID_FD) {
@@ -114,6 +207,9 @@ int block_write(size_t block, const void *buf)
 		perror("write");
 		return -1;
 	}
+	disk.writes++;
+	if (disk.written)
+		disk.written(block, 1);
 
 	return 0;
 }
@@ -142,7 +238,103 @@ int block_read(size_t block, void *buf)
 		perror("read");
 		return -1;
 	}
+	disk.reads++;
 
 	return 0;
 }
 
+int block_write_range(size_t block, size_t count, const void *buf)
+{
+	size_t done = 0, len = count * BLOCK_SIZE;
+	ssize_t ret;
+
+	if (disk.fd == INVALID_FD) {
+		block_error("no disk currently open");
+		return -1;
+	}
+
+	if (block >= disk.bcount || count > disk.bcount - block) {
+		block_error("block range out of bounds (%zu+%zu/%zu)",
+			    block, count, disk.bcount);
+		return -1;
+	}
+
+	/* Move to the specified block number */
+	if (lseek(disk.fd, block * BLOCK_SIZE, SEEK_SET) < 0) {
+		perror("lseek");
+		return -1;
+	}
+
+	/* Perform the actual write into the disk image, resuming short writes */
+	while (done < len) {
+		if ((ret = write(disk.fd, (const char *)buf + done,
+				 len - done)) <= 0) {
+			perror("write");
+			return -1;
+		}
+		done += ret;
+	}
+	disk.writes += count;
+	if (disk.written)
+		disk.written(block, count);
+
+	return 0;
+}
+
+int block_read_range(size_t block, size_t count, void *buf)
+{
+	size_t done = 0, len = count * BLOCK_SIZE;
+	ssize_t ret;
+
+	if (disk.fd == INVALID_FD) {
+		block_error("no disk currently open");
+		return -1;
+	}
+
+	if (block >= disk.bcount || count > disk.bcount - block) {
+		block_error("block range out of bounds (%zu+%zu/%zu)",
+			    block, count, disk.bcount);
+		return -1;
+	}
+
+	/* Move to the specified block number */
+	if (lseek(disk.fd, block * BLOCK_SIZE, SEEK_SET) < 0) {
+		perror("lseek");
+		return -1;
+	}
+
+	/* Perform the actual read from the disk image, resuming short reads */
+	while (done < len) {
+		if ((ret = read(disk.fd, (char *)buf + done, len - done)) <= 0) {
+			perror("read");
+			return -1;
+		}
+		done += ret;
+	}
+	disk.reads += count;
+
+	return 0;
+}
+
+int block_discard(size_t block, size_t count)
+{
+	if (disk.fd == INVALID_FD) {
+		block_error("no disk currently open");
+		return -1;
+	}
+
+	if (block >= disk.bcount || count > disk.bcount - block) {
+		block_error("block range out of bounds (%zu+%zu/%zu)",
+			    block, count, disk.bcount);
+		return -1;
+	}
+
+	/* Deallocate the blocks' space in the disk image, keeping its size */
+	if (fallocate(disk.fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+		      (off_t)block * BLOCK_SIZE, (off_t)count * BLOCK_SIZE)) {
+		perror("fallocate");
+		return -1;
+	}
+
+	return 0;
+}
@@ -23,6 +23,32 @@
  */
 int block_disk_open(const char *diskname);
 
+/**
+ * block_disk_open_direct - Open virtual disk file for direct I/O
+ * @diskname: Name of the virtual disk file
+ *
+ * Open virtual disk file @diskname like block_disk_open(), bypassing the host's
+ * page cache (%O_DIRECT). The buffers given to the block_read*() and
+ * block_write*() functions must then be aligned on %BLOCK_SIZE.
+ *
+ * Return: -1 if @diskname is invalid, if the virtual disk file cannot be opened
+ * for direct I/O or is already open. 0 otherwise.
+ */
+int block_disk_open_direct(const char *diskname);
+
+/**
+ * block_disk_open_readonly - Open virtual disk file read-only
+ * @diskname: Name of the virtual disk file
+ *
+ * Open virtual disk file @diskname like block_disk_open(), for reading only:
+ * block_write(), block_write_range() and block_discard() then fail. The file is
+ * also mapped read-only, see block_disk_map().
+ *
+ * Return: -1 if @diskname is invalid, if the virtual disk file cannot be opened
+ * or mapped, or is already open. 0 otherwise.
+ */
+int block_disk_open_readonly(const char *diskname);
+
 /**
  * block_disk_close - Close virtual disk file
  *
@@ -30,6 +56,31 @@ int block_disk_open(const char *diskname);
  */
 int block_disk_close(void);
 
+/**
+ * block_disk_sync - Make disk's written blocks durable
+ *
+ * Wait until the blocks written so far have reached stable storage
+ * (fdatasync()). Can be called from another thread than the one reading and
+ * writing blocks.
+ *
+ * Return: -1 if there was no virtual disk file opened, or if the
+ * synchronization fails. 0 otherwise.
+ */
+int block_disk_sync(void);
+
+/**
+ * block_disk_track - Track the blocks written to disk
+ * @written: Function to call after each successful block_write() or
+ * block_write_range(), with the index of the first block written and the
+ * number of blocks. NULL to stop tracking
+ *
+ * @written is called from within the writing function, and must not access
+ * the disk itself. Tracking stops when the disk is closed.
+ *
+ * Return: -1 if there was no virtual disk file opened. 0 otherwise.
+ */
+int block_disk_track(void (*written)(size_t block, size_t count));
+
 /**
  * block_disk_count - Get disk's block count
  *
@@ -38,6 +89,28 @@ int block_disk_close(void);
  */
 int block_disk_count(void);
 
+/**
+ * block_disk_map - Get disk's read-only mapping
+ *
+ * The mapping is shared (%MAP_SHARED): processes opening the same virtual disk
+ * file read-only all access the host's page cache, without a copy of their
+ * own. Reading through it is not counted by block_disk_io_count().
+ *
+ * Return: NULL if there was no virtual disk file opened, or if it was not
+ * opened with block_disk_open_readonly(). Otherwise the content of the disk,
+ * block @i starting at byte @i * %BLOCK_SIZE.
+ */
+const void *block_disk_map(void);
+
+/**
+ * block_disk_io_count - Get disk's I/O counters
+ * @reads: Filled with the number of blocks read since the disk was opened
+ * @writes: Filled with the number of blocks written since the disk was opened
+ *
+ * Return: -1 if there was no virtual disk file opened. 0 otherwise.
+ */
+int block_disk_io_count(size_t *reads, size_t *writes);
+
 /**
  * block_write - Write a block to disk
  * @block: Index of the block to write to
@@ -64,5 +137,47 @@ int block_write(size_t block, const void *buf);
  */
 int block_read(size_t block, void *buf);
 
+/**
+ * block_write_range - Write consecutive blocks to disk
+ * @block: Index of the first block to write to
+ * @count: Number of blocks to write
+ * @buf: Data buffer to write in the blocks
+ *
+ * Write the content of buffer @buf (@count * %BLOCK_SIZE bytes) in the virtual
+ * disk's blocks @block to @block + @count - 1, with a single write operation.
+ *
+ * Return: -1 if any of the blocks is out of bounds or inaccessible or if the
+ * writing operation fails. 0 otherwise.
+ */
+int block_write_range(size_t block, size_t count, const void *buf);
+
+/**
+ * block_read_range - Read consecutive blocks from disk
+ * @block: Index of the first block to read from
+ * @count: Number of blocks to read
+ * @buf: Data buffer to be filled with content of blocks
+ *
+ * Read the content of virtual disk's blocks @block to @block + @count - 1
+ * (@count * %BLOCK_SIZE bytes) into buffer @buf, with a single read operation.
+ *
+ * Return: -1 if any of the blocks is out of bounds or inaccessible, or if the
+ * reading operation fails. 0 otherwise.
+ */
+int block_read_range(size_t block, size_t count, void *buf);
+
+/**
+ * block_discard - Discard consecutive blocks of disk
+ * @block: Index of the first block to discard
+ * @count: Number of blocks to discard
+ *
+ * Punch a hole in the virtual disk file over blocks @block to @block + @count
+ * - 1 (%FALLOC_FL_PUNCH_HOLE), so that the host no longer stores them. The
+ * blocks then read as zeros, and the file keeps its size.
+ *
+ * Return: -1 if any of the blocks is out of bounds, or if the host file system
+ * cannot punch holes. 0 otherwise.
+ */
+int block_discard(size_t block, size_t count);
+
 #endif /* _DISK_H */
 
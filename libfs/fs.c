@@ -1,56 +1,125 @@
 #include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdbool.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "disk.h"
 #include "fs.h"
+#include "layout.h"
+#include "lz.h"
 
-#define SUPERBLOCK_UNUSED_BYTES 4079
-#define ENTRIES_PER_FAT_BLOCK 2048
-#define SIGNATURE_BYTES 8 
-#define FILENAME_SIZE 16
-#define ROOT_UNUSED_BYTES 10
-#define FAT_EOC 0xFFFF
+#define COMP_STAGE_FRAMES 16
+#define CACHE_PAGES 256
+#define CACHE_HASH 512
+#define POOL_BLOCKS 512
+#define WBUF_BYTES (16 * BLOCK_SIZE)
+#define WBUF_MAX_BYTES (256 * BLOCK_SIZE)
+#define STAGE_BLOCKS 256
+#define SYNC_INTERVAL_MS 100
+#define DEDUP_TRIES 4
+#define RECLAIM_BATCH 1024
+#define DISCARD_RANGES 64
+#define EXTENT_WALK 64
+// Buffers handed to the disk are block aligned, as direct I/O requires
+#define BLOCK_ALIGNED __attribute__((aligned(BLOCK_SIZE)))
 
 /* TODO: Phase 1 */
-// Struct representation of a superblock(4096 bytes)
-struct __attribute__((__packed__)) superblock {
-  // Signature(8 bytes)
-  uint8_t signature[SIGNATURE_BYTES];
-  // Total # of blocks of virtual disk(2 bytes)
-  uint16_t numBlocks;
-  // Root directory block index(2 bytes)
-  uint16_t rootIndex;
-  // Data block start index(2 bytes)
-  uint16_t dataIndex;
-  // Amount of data blocks(2 bytes)
-  uint16_t numDataBlocks;
-  // # of blocks for FAT(1 byte)
-  uint8_t numFATBlocks;
-  // Unused/Padding(4079 bytes)
-  uint8_t padding[SUPERBLOCK_UNUSED_BYTES];
+// Struct representation of where a directory entry is stored
+struct dirLoc {
+  // Disk block holding the entry, 0 if the entry is in rootD
+  size_t block;
+  // Slot of the entry within that block, or index in rootD
+  int slot;
 };
 
-// Struct representation of a FAT entry
-// 1 FAT block(4096 bytes) is 2048 FAT entries
-struct __attribute__((__packed__)) FAT {
-  // FAT entry(2 bytes)
-  uint16_t entry;
+// Struct representation of a directory
+// Subdirectories are files of hashed buckets: each data block is a bucket of
+// 128 entries, & an entry lives in bucket hash(name) % (# of buckets)
+struct dir {
+  // True for the root directory, which is rootD & has no entry of its own
+  bool isRoot;
+  // Location & copy of the directory's own entry
+  struct dirLoc loc;
+  struct root ent;
 };
 
-// Struct representation of a root directory entry(32 bytes)
-struct __attribute__((__packed__)) root {
-  // Filename(16 bytes)
-  uint8_t fileName[FILENAME_SIZE];
-  // Size of the file(4 bytes)
-  uint32_t size;
-  // Index of the first data block(2 bytes)
-  uint16_t firstIndex;
-  // Unused/Padding(10 bytes)
-  uint8_t padding[ROOT_UNUSED_BYTES];
+// Struct representation of a run of clusters contiguous on disk in a chain
+struct extent {
+  // Position of the run's first cluster in the chain
+  size_t pos;
+  // First cluster of the run, & # of clusters
+  uint32_t first;
+  uint32_t count;
+};
+
+// Struct representation of an open file, shared by all of its fds
+struct openFile {
+  // # of fds referring to the file, 0 if unused
+  int refs;
+  // Location of the file's entry in its directory
+  struct dirLoc loc;
+  // First cluster of the file's directory, FAT_EOC for the root directory
+  uint32_t parentFirst;
+  // File's record: points into rootD for files in the root directory, else to
+  // record below, which is written back to the directory on last close
+  struct root *ent;
+  struct root entry[RECORD_SLOTS];
+  // Compressed files only: offset of each frame in the stream, followed by
+  // the stream's length, & last frame decompressed for reads. The frames hold
+  // rawSize bytes, the file's size but for data still in write-back buffers
+  uint64_t *frames;
+  size_t numFrames;
+  uint64_t rawSize;
+  char *cache;
+  size_t cacheFrame;
+  // # of clusters at the start of the chain known not to be shared with
+  // clones, & last of them
+  size_t cowPrivate;
+  uint32_t cowLast;
+  // First cluster written since the last dedup pass, SIZE_MAX if none
+  size_t dedupFrom;
+  // Extent map of the chain, sorted by position: built on the first lookup far
+  // from the fds' cursors, NULL until then. Still right once the chain grows,
+  // dropped when clusters of it move
+  struct extent *extents;
+  size_t numExtents;
+};
+
+// Struct representation of a page of the metadata cache
+// Holds a copy of one metadata block(FAT block), which is written back when
+// the page is evicted or when the file system is unmounted
+struct cachePage {
+  // Disk block held by the page, 0 if the page is unused
+  size_t block;
+  // Index of next page in the same hash bucket, -1 if none
+  int next;
+  // True if the page was modified since it was read
+  bool dirty;
+  // Set on access, cleared by the clock hand looking for a page to evict
+  bool ref;
+  // Content of the block, allocated on first use of the page
+  uint8_t *data;
+};
+
+// Struct representation of the free runs of one FAT block, as find_freeGap()
+// sees them: # of free entries the block starts & ends with, & its longest
+// free run
+struct fatRuns {
+  uint32_t head;
+  uint32_t tail;
+  uint32_t longest;
+  uint32_t start;
+  // True if entries of the block changed since it was summarized
+  bool stale;
 };
 
 // Struct representation of a file descriptor
@@ -58,464 +127,4554 @@ struct fileDesc{
   // Unique ID number of file(actual file descriptor #)
 	int ID;
   // Current position of file
-	int offset;
-	// Index of file in root directory
-	int index;
+	size_t offset;
+	// Index of open file in files
+	int file;
+  // Chain cursor: last data block visited(# within file) & its FAT index
+  size_t curBlock;
+  uint32_t curFAT;
+  // Write-back buffer of wbufSize bytes: bytes written at [wbufStart,
+  // wbufStart + wbufLen) that aren't in their data blocks yet, kept at the
+  // same offset within the buffer's blocks as within the file's blocks
+  char *wbuf;
+  size_t wbufSize;
+  size_t wbufStart;
+  size_t wbufLen;
+  // # of clusters in the file's chain, & # of clusters reserved to extend it
+  // when the buffer is flushed
+  size_t wbufChain;
+  size_t wbufReserved;
 };
 
 
 // GLOBAL VARIABLES
 // Pointer to superblock
 static struct superblock *superB;
-// Dynamic array of pointers to FAT entries
-static struct FAT *fat;
+// Metadata cache: pages, hash buckets of page indices by block, clock hand
+// & last page hit. Only CACHE_PAGES blocks of the FAT are resident at a time
+static struct cachePage cache[CACHE_PAGES];
+static int cacheHash[CACHE_HASH];
+static int cacheHand;
+static int cacheLast;
+// # of free FAT entries, counted on first need & then kept up to date
+static uint32_t numFree;
+static bool numFreeKnown;
+// Free runs of each FAT block, summarized on the first search for a free gap,
+// & then again only for blocks changed since
+static struct fatRuns *fatRuns;
+// # of free clusters reserved by write-back buffers, not to be allocated
+static size_t numReserved;
+// True if the mounted disk uses the original 16-bit format
+static bool fat16;
+// True once a FAT or reference count block couldn't be read or written back:
+// entries in memory may then differ from disk, fs_umount() reports it
+static bool metaError;
+// Reference count table of clones: disk block of each of its blocks, NULL if
+// the image has none
+static size_t *refBlocks;
+static size_t numRefBlocks;
 // Linear array of [128]root directory entries
-static struct root rootD[FS_FILE_MAX_COUNT];
+static struct root rootD[FS_FILE_MAX_COUNT] BLOCK_ALIGNED;
 // Linear array of [32]file descriptors
 static struct fileDesc fds[FS_OPEN_MAX_COUNT];
+// Linear array of [32]open files
+static struct openFile files[FS_OPEN_MAX_COUNT];
 // Current running # of open files
 static int numOpenFiles = 0;
 // Current ID #(file descriptor #) to be assigned to a file
 static int currentID = 0;
+// FAT index to resume free block search from
+static uint32_t freeHint = 1;
+// # of FAT entries(clusters) & size of a cluster in bytes
+static uint32_t numClusters;
+static size_t clusterSize;
 
 // True if a file system is mounted, false otherwise
 static bool FS = false;
 
-// Mount a file system
-int fs_mount(const char *diskname)
+// Write-back buffers are flushed by fs_close() & fs_lseek(), ahead of the
+// write path
+static void wbuf_flush(int fdIndex);
+// Write-back buffers of compressed files are written through compression, &
+// reserve room for their frames at worst
+static size_t data_write(int fdIndex, const char *buf, size_t count);
+static int comp_index(int fdIndex);
+static uint64_t comp_worst(int fdIndex, size_t first, uint64_t end);
+// Metadata flushes write entries of open files back to their directory
+static int entry_write(const struct dirLoc *loc, const struct root *ent);
+// Listings count extents of files like fs_extents() maps them
+static size_t entry_extents(const struct root *ent, struct fs_extent *extents,
+                            size_t max);
+// Chains of deleted files are freed at the end of operations, & by allocations
+// running out of free clusters
+static bool reclaim_run(size_t clusters);
+// Clusters freed with FS_MOUNT_DISCARD are discarded in batches
+static void discard_add(uint32_t i);
+// The changed block bitmap is added by the first checkpoint, in its own chain
+static int cbt_create(void);
+
+// Block buffer pool: POOL_BLOCKS block-aligned buffers carved out of one arena
+// mapped at mount, & a stack of the free ones
+static char *poolArena;
+static char *poolFree[POOL_BLOCKS];
+static int poolNumFree;
+// # of heap allocations made by the data path since mount
+static size_t numAllocs;
+// Disk opened for direct I/O, & the buffer misaligned caller buffers are
+// staged through then
+static bool directIO;
+static char *directStage;
+// Buffers compressed writes assemble a frame & compress frames into, allocated
+// by the first of them
+static char *compRaw;
+static char *compStage;
+// Durability policy(FS_MOUNT_SYNC_* flags) & commit interval in usecs
+static unsigned int syncPolicy;
+static uint64_t syncInterval;
+// Group commit: time of last commit, # of commits made & made durable, the
+// thread syncing them. syncLock guards what the syncer thread shares
+static uint64_t lastCommit;
+static uint64_t commitGen;
+static uint64_t syncedGen;
+static bool syncStop;
+static pthread_t syncer;
+static pthread_mutex_t syncLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t syncCond = PTHREAD_COND_INITIALIZER;
+// # of syncs since mount, their total & longest time in usecs
+static size_t numSyncs;
+static uint64_t syncUsecs;
+static uint64_t syncMaxUsecs;
+// Dedup index of the clusters of files written since mount, by key: hash of
+// their content mixed with # of clusters to the end of their chain. First
+// cluster of each of dedupMask + 1 buckets(0 if empty), & of each cluster:
+// next cluster in the same bucket, hash of its content(0 if not indexed) & key.
+// NULL without FS_MOUNT_DEDUP
+static uint32_t *dedupBuckets;
+static uint32_t *dedupNext;
+static uint64_t *dedupHash;
+static uint64_t *dedupKey;
+static size_t dedupMask;
+// # of clusters found identical to another file's & shared since mount
+static size_t numDeduped;
+// # of clusters of deleted files freed since mount
+static size_t numReclaimed;
+// With FS_MOUNT_DISCARD: ranges of clusters freed since the last discard, as
+// first cluster & # of clusters, & range last extended. # of blocks discarded
+// since mount
+static bool discardOn;
+static uint32_t discardStart[DISCARD_RANGES];
+static uint32_t discardCount[DISCARD_RANGES];
+static int numDiscard;
+static int discardLast;
+static size_t numDiscarded;
+// With FS_MOUNT_READONLY: nothing is written, & metadata blocks are read
+// straight from the disk's shared mapping
+static bool readOnly;
+static const uint8_t *diskMap;
+// Changed block bitmap of FEATURE_CBT, kept whole in memory for the mount: its
+// content, disk block of each of its blocks, & whether each of them changed
+// since written back. NULL without it, & on read-only mounts
+static uint8_t *cbtMap;
+static size_t *cbtBlocks;
+static bool *cbtDirty;
+static size_t numCbtBlocks;
+
+// HELPER FUNCTION - maps the block buffer pool's arena, on huge pages if the
+// system has some to spare. Without an arena, buffers come from the heap
+static void pool_init(void)
 {
-	/* TODO: Phase 1 */
-  // ERROR CHECKING
-  // Check diskname validity
-  if (block_disk_open(diskname)) {
-    fprintf(stderr, "Can't open\n");
-    return -1;
+  size_t bytes = POOL_BLOCKS * BLOCK_SIZE;
+  poolArena = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (poolArena == MAP_FAILED) {
+    poolArena = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    // Transparent huge pages are the next best thing
+    if (poolArena != MAP_FAILED) {
+      madvise(poolArena, bytes, MADV_HUGEPAGE);
+    }
   }
 
-  // Read superblock(First block of fs)
-  // Buffer to read in superblock
-  char SBBuffer[BLOCK_SIZE];
-  block_read(0, SBBuffer);
-  // Typecast into pointer to superblock struct for easy handling
-  superB = (struct superblock*)&SBBuffer;
+  poolNumFree = 0;
+  numAllocs = 0;
+  if (poolArena == MAP_FAILED) {
+    poolArena = NULL;
+    return;
+  }
+  for (int i = POOL_BLOCKS - 1; i >= 0; i--) {
+    poolFree[poolNumFree++] = poolArena + (size_t)i * BLOCK_SIZE;
+  }
+}
 
-  // ERROR CHECKING
-  // Check correct signature
-  if (strncmp((char*)(superB->signature), "ECS150FS", 8)) {
-	  fprintf(stderr, "Wrong signature\n");
-	  return -1;
+// HELPER FUNCTION - unmaps the block buffer pool's arena
+static void pool_free(void)
+{
+  if (poolArena) {
+    munmap(poolArena, POOL_BLOCKS * BLOCK_SIZE);
+    poolArena = NULL;
   }
-  // Check correct number of blocks
-  if (superB->numBlocks != block_disk_count()) {
-  	fprintf(stderr, "Wrong number of blocks\n");
-	  return -1;
+  poolNumFree = 0;
+}
+
+// HELPER FUNCTION - allocates @size bytes for the data path, block aligned &
+// counted in the statistics. Returns NULL if out of memory
+static void *io_alloc(size_t size)
+{
+  void *buf;
+  numAllocs++;
+  return posix_memalign(&buf, BLOCK_SIZE, size) ? NULL : buf;
+}
+
+// HELPER FUNCTION - writes @count blocks of @buf from @block on. Under direct
+// I/O, a misaligned @buf is staged through directStage
+static int data_write_blocks(size_t block, size_t count, const char *buf)
+{
+  if (!directIO || (uintptr_t)buf % BLOCK_SIZE == 0) {
+    return block_write_range(block, count, buf);
   }
-  // Check correct root index
-  if (superB->rootIndex != (superB->numFATBlocks + 1)) {
-	  fprintf(stderr, "Wrong root index\n");
-	  return -1;
+  while (count) {
+    size_t n = count < STAGE_BLOCKS ? count : STAGE_BLOCKS;
+    memcpy(directStage, buf, n * BLOCK_SIZE);
+    if (block_write_range(block, n, directStage)) {
+      return -1;
+    }
+    block += n;
+    buf += n * BLOCK_SIZE;
+    count -= n;
   }
-  // Check correct data index
-  if (superB->dataIndex != (superB->rootIndex + 1)) {
-	  fprintf(stderr, "Wrong data index\n");
-	  return -1;
+  return 0;
+}
+
+// HELPER FUNCTION - reads @count blocks from @block on into @buf. Under direct
+// I/O, a misaligned @buf is staged through directStage
+static int data_read_blocks(size_t block, size_t count, char *buf)
+{
+  if (!directIO || (uintptr_t)buf % BLOCK_SIZE == 0) {
+    return block_read_range(block, count, buf);
+  }
+  while (count) {
+    size_t n = count < STAGE_BLOCKS ? count : STAGE_BLOCKS;
+    if (block_read_range(block, n, directStage)) {
+      return -1;
+    }
+    memcpy(buf, directStage, n * BLOCK_SIZE);
+    block += n;
+    buf += n * BLOCK_SIZE;
+    count -= n;
+  }
+  return 0;
+}
+
+// HELPER FUNCTION - borrows a block-aligned buffer of BLOCK_SIZE bytes from the
+// pool, or from the heap once the pool is empty. Returns NULL if out of memory
+static void *pool_get(void)
+{
+  if (poolNumFree > 0) {
+    return poolFree[--poolNumFree];
+  }
+  void *buf;
+  numAllocs++;
+  return posix_memalign(&buf, BLOCK_SIZE, BLOCK_SIZE) ? NULL : buf;
+}
+
+// HELPER FUNCTION - returns a buffer borrowed with pool_get()
+static void pool_put(void *buf)
+{
+  char *p = buf;
+  if (poolArena && p >= poolArena && p < poolArena + POOL_BLOCKS * BLOCK_SIZE) {
+    poolFree[poolNumFree++] = p;
+  } else {
+    free(buf);
+  }
+}
+
+// HELPER FUNCTION - empties the metadata cache
+static void cache_init(void)
+{
+  for (int i = 0; i < CACHE_PAGES; i++) {
+    cache[i].block = 0;
+    cache[i].next = -1;
+    cache[i].dirty = false;
+    cache[i].ref = false;
+  }
+  for (int i = 0; i < CACHE_HASH; i++) {
+    cacheHash[i] = -1;
+  }
+  cacheHand = 0;
+  cacheLast = 0;
+}
+
+// HELPER FUNCTION - writes every dirty page of the metadata cache to disk
+static int cache_flush(void)
+{
+  int ret = 0;
+  for (int i = 0; i < CACHE_PAGES; i++) {
+    if (cache[i].block && cache[i].dirty) {
+      if (block_write(cache[i].block, cache[i].data)) {
+        ret = -1;
+      } else {
+        cache[i].dirty = false;
+      }
+    }
+  }
+  return ret;
+}
+
+// HELPER FUNCTION - releases the memory of the metadata cache
+static void cache_free(void)
+{
+  for (int i = 0; i < CACHE_PAGES; i++) {
+    if (cache[i].data) {
+      pool_put(cache[i].data);
+    }
+    cache[i].data = NULL;
+    cache[i].block = 0;
   }
+}
 
-  // Read FAT(next blocks of fs)
-  // Allocate memory for 1D array of fat entries
-  fat = malloc(superB->numFATBlocks*ENTRIES_PER_FAT_BLOCK*sizeof(struct FAT*));
-  // Read FAT block[s](total # found in superblock) into 2D buffer
-  struct FAT FATBuffer[superB->numFATBlocks][ENTRIES_PER_FAT_BLOCK];
-  for (int i = 1; i < superB->numFATBlocks + 1; i++) {
-	  block_read(i, FATBuffer[i-1]);
+// HELPER FUNCTION - returns content of metadata block @block, read from disk
+// into the cache if not resident. The page is marked dirty if @write is true.
+// Returns NULL if the block can't be read
+static uint8_t *cache_get(size_t block, bool write)
+{
+  // Read-only mounts share the host's pages rather than caching copies
+  if (diskMap) {
+    return block < superB->numBlocks ? (uint8_t*)diskMap + block * BLOCK_SIZE :
+           NULL;
   }
-  // Set FAT entries to data retrieved from buffer(convert 2D array -> 1D array)
-  for (int i = 0; i < superB->numFATBlocks; i++) {
-    for (int j = 0; j < ENTRIES_PER_FAT_BLOCK; j++) {
-      // fat[i*ENTRIES_PER_FAT_BLOCK + j] = malloc(sizeof(struct FAT *));
-      fat[i*ENTRIES_PER_FAT_BLOCK + j] = FATBuffer[i][j];
+
+  // Consecutive accesses mostly hit the same page
+  struct cachePage *page = &cache[cacheLast];
+  if (page->block != block) {
+    int i = cacheHash[block % CACHE_HASH];
+    while (i != -1 && cache[i].block != block) {
+      i = cache[i].next;
+    }
+
+    if (i == -1) {
+      // Miss: the clock hand picks a page not accessed since last time round
+      while (cache[cacheHand].block && cache[cacheHand].ref) {
+        cache[cacheHand].ref = false;
+        cacheHand = (cacheHand + 1) % CACHE_PAGES;
+      }
+      i = cacheHand;
+      cacheHand = (cacheHand + 1) % CACHE_PAGES;
+      page = &cache[i];
+
+      // Evict the page's block, writing it back if needed
+      if (page->block) {
+        if (page->dirty && block_write(page->block, page->data)) {
+          return NULL;
+        }
+        int *link = &cacheHash[page->block % CACHE_HASH];
+        while (*link != i) {
+          link = &cache[*link].next;
+        }
+        *link = page->next;
+        page->block = 0;
+      }
+
+      if (!page->data && !(page->data = pool_get())) {
+        return NULL;
+      }
+      if (block_read(block, page->data)) {
+        return NULL;
+      }
+      page->block = block;
+      page->dirty = false;
+      page->next = cacheHash[block % CACHE_HASH];
+      cacheHash[block % CACHE_HASH] = i;
     }
+    page = &cache[i];
+    cacheLast = i;
   }
 
-  // ERROR CHECKING
-  // First entry of FAT should always be invalid
-  if (fat[0].entry != FAT_EOC) {
-    fprintf(stderr, "First FAT entry not invalid\n");
-	  return -1;
+  page->ref = true;
+  page->dirty |= write;
+  return page->data;
+}
+
+// HELPER FUNCTION - hashes @count bytes of @buf, a multiple of 64, on top of
+// hash @h. Each of the 8 lanes adds a 32x32-bit product of its words, so the
+// compiler runs several lanes per SIMD multiply. Never returns 0
+static uint64_t dedup_hash(uint64_t h, const char *buf, size_t count)
+{
+  static const uint64_t keys[8] = {
+    0x9E3779B185EBCA87ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull,
+    0x85EBCA77C2B2AE63ull, 0x27D4EB2F165667C5ull, 0xFF51AFD7ED558CCDull,
+    0xC4CEB9FE1A85EC53ull, 0x94D049BB133111EBull,
+  };
+  uint64_t acc[8];
+  for (int l = 0; l < 8; l++) {
+    acc[l] = h ^ keys[l];
+  }
+  for (size_t i = 0; i < count; i += 64) {
+    for (int l = 0; l < 8; l++) {
+      uint64_t word;
+      memcpy(&word, buf + i + l * sizeof(word), sizeof(word));
+      uint64_t mixed = word ^ keys[l];
+      acc[l] += word + (mixed & 0xFFFFFFFF) * (mixed >> 32);
+    }
   }
 
-  // Read root directory(next block of fs, right before data blocks)
-  block_read(superB->rootIndex, rootD);
+  // Lanes are folded with a full avalanche of each
+  h = count;
+  for (int l = 0; l < 8; l++) {
+    uint64_t x = acc[l];
+    x ^= x >> 33;
+    x *= keys[5];
+    x ^= x >> 29;
+    h = (h ^ x) * keys[0];
+  }
+  return h ? h : 1;
+}
 
-  // Initialize array of file descriptors(fds)
-  for (int i = 0; i < FS_OPEN_MAX_COUNT; i++) {
-    fds[i].ID = -1;
-    fds[i].offset = 0;
-    fds[i].index = -1;
+// HELPER FUNCTION - returns dedup key of a cluster whose content hashes to @h,
+// @left clusters from the end of its chain
+static uint64_t dedup_key(uint64_t h, size_t left)
+{
+  return (h ^ left) * 0x9E3779B97F4A7C15ull;
+}
+
+// HELPER FUNCTION - drops cluster @i from the dedup index
+static void dedup_remove(uint32_t i)
+{
+  uint32_t *link = &dedupBuckets[dedupKey[i] & dedupMask];
+  while (*link != i) {
+    link = &dedupNext[*link];
+  }
+  *link = dedupNext[i];
+  dedupHash[i] = 0;
+}
+
+// HELPER FUNCTION - indexes cluster @i, whose content hashes to @h, @left
+// clusters from the end of its chain
+static void dedup_insert(uint32_t i, uint64_t h, size_t left)
+{
+  uint64_t key = dedup_key(h, left);
+  if (dedupHash[i] && dedupKey[i] == key) {
+    return;
+  }
+  if (dedupHash[i]) {
+    dedup_remove(i);
   }
+  dedupHash[i] = h;
+  dedupKey[i] = key;
+  dedupNext[i] = dedupBuckets[key & dedupMask];
+  dedupBuckets[key & dedupMask] = i;
+}
 
-  // Assert FS as true, when filesystem is fully mounted
-  FS = true;
+// HELPER FUNCTION - returns the next cluster after @i(0 for the first) indexed
+// by @key, other than @self. Returns 0 if none
+static uint32_t dedup_find(uint64_t key, uint32_t self, uint32_t i)
+{
+  for (i = i ? dedupNext[i] : dedupBuckets[key & dedupMask]; i;
+       i = dedupNext[i]) {
+    if (dedupKey[i] == key && i != self) {
+      return i;
+    }
+  }
   return 0;
 }
 
-int fs_umount(void)
+// HELPER FUNCTION - frees the dedup index
+static void dedup_free(void)
 {
-	/* TODO: Phase 1 */
-  // ERROR CHECKING
-  // Check if there's a file system currently mounted & if any open FDs
-  if (!FS || numOpenFiles){
-    return -1;
+  free(dedupBuckets);
+  free(dedupNext);
+  free(dedupHash);
+  free(dedupKey);
+  dedupBuckets = NULL;
+  dedupNext = NULL;
+  dedupHash = NULL;
+  dedupKey = NULL;
+}
+
+// HELPER FUNCTION - returns # of entries in a FAT block
+static uint32_t fat_entries(void)
+{
+  return fat16 ? ENTRIES_PER_FAT_BLOCK : ENTRIES_PER_FAT32_BLOCK;
+}
+
+// HELPER FUNCTION - returns FAT entry @i, 16-bit EOC is widened to FAT_EOC
+// An entry whose FAT block can't be read reads as FAT_EOC, & sets metaError
+static uint32_t fat_get(uint32_t i)
+{
+  if (fat16) {
+    uint16_t *block = (uint16_t*)cache_get(1 + i / ENTRIES_PER_FAT_BLOCK,
+                                           false);
+    if (!block) {
+      metaError = true;
+      return FAT_EOC;
+    }
+    uint16_t entry = block[i % ENTRIES_PER_FAT_BLOCK];
+    return entry == FAT16_EOC ? FAT_EOC : entry;
   }
+  uint32_t *block = (uint32_t*)cache_get(1 + i / ENTRIES_PER_FAT32_BLOCK,
+                                         false);
+  if (!block) {
+    metaError = true;
+    return FAT_EOC;
+  }
+  return block[i % ENTRIES_PER_FAT32_BLOCK];
+}
 
-	// Write Superblock, FAT, & Root Directory meta-info back to disk
-	block_write(0, superB);
-  for (int i = 1; i < superB->numFATBlocks + 1; i++) {
-    block_write(i, (fat + ENTRIES_PER_FAT_BLOCK*(i - 1)));
+// HELPER FUNCTION - sets FAT entry @i, FAT_EOC is narrowed on 16-bit disks
+// An update whose FAT block can't be read is lost, & sets metaError
+static void fat_set(uint32_t i, uint32_t entry)
+{
+  if (numFreeKnown || discardOn) {
+    uint32_t old = fat_get(i);
+    if (numFreeKnown) {
+      numFree += (old != 0 && entry == 0) - (old == 0 && entry != 0);
+    }
+    if (discardOn && old != 0 && entry == 0) {
+      discard_add(i);
+    }
+  }
+  // A freed cluster's content is no longer a file's
+  if (entry == 0 && dedupHash && dedupHash[i]) {
+    dedup_remove(i);
+  }
+  if (fatRuns) {
+    fatRuns[i / fat_entries()].stale = true;
+  }
+  if (fat16) {
+    uint16_t *block = (uint16_t*)cache_get(1 + i / ENTRIES_PER_FAT_BLOCK,
+                                           true);
+    if (!block) {
+      metaError = true;
+      return;
+    }
+    block[i % ENTRIES_PER_FAT_BLOCK] = entry == FAT_EOC ? FAT16_EOC : entry;
+  } else {
+    uint32_t *block = (uint32_t*)cache_get(1 + i / ENTRIES_PER_FAT32_BLOCK,
+                                           true);
+    if (!block) {
+      metaError = true;
+      return;
+    }
+    block[i % ENTRIES_PER_FAT32_BLOCK] = entry;
   }
-	block_write(superB->rootIndex, rootD);
+}
 
-  free(fat);
+// HELPER FUNCTION - returns # of free FAT entries
+// Counting pages the whole FAT in, so it's only done once per mount
+static uint32_t fat_free_count(void)
+{
+  if (!numFreeKnown) {
+    numFree = 0;
+    for (uint32_t i = 0; i < numClusters; i++) {
+      if (fat_get(i) == 0) {
+        numFree++;
+      }
+    }
+    numFreeKnown = true;
+  }
+  return numFree;
+}
 
-	// If no disk is currently open, return -1
-	if (block_disk_close()) {
-		return -1;
-	}
-  // Filesystem successfully unmounted
-  FS = false;
-	return 0;
+// HELPER FUNCTION - returns # of directory slots taken by record of @ent
+static int record_slots(const struct root *ent)
+{
+  return ent->flags & (ROOT_FLAG_INLINE | ROOT_FLAG_SPARSE | ROOT_FLAG_EXTENTS) ?
+    RECORD_SLOTS : 1;
 }
 
-int fs_info(void)
+// HELPER FUNCTION - returns position in the chain of file of @ent of its
+// cluster #@k, where it would go if @k is in a hole. Sets @hole if it is, &
+// @run to # of clusters from @k on up to the next hole or to the hole's end
+static size_t file_pos(const struct root *ent, size_t k, bool *hole,
+                       size_t *run)
 {
-	/* TODO: Phase 1 */
-	// Return -1 if no underlying virtual disk was opened
-	if (!FS) {
-		return -1;
-	}
+  *hole = false;
+  *run = SIZE_MAX;
+  if (!(ent->flags & ROOT_FLAG_SPARSE)) {
+    return k;
+  }
+  const struct hole *holes = (const struct hole*)(ent + 1);
+  size_t skipped = 0;
+  for (size_t h = 0; h < SPARSE_MAX_HOLES && holes[h].count; h++) {
+    if (k < holes[h].start) {
+      *run = holes[h].start - k;
+      break;
+    }
+    if (k < (size_t)holes[h].start + holes[h].count) {
+      *hole = true;
+      *run = holes[h].start + holes[h].count - k;
+      return holes[h].start - skipped;
+    }
+    skipped += holes[h].count;
+  }
+  return k - skipped;
+}
 
-  // Retrieve number of empty data blocks & rootD entries
-  int FATFree = 0;
-  int rootDFree = 0;
-  for (int i = 0; i < superB->numDataBlocks; i++) {
-    if(fat[i].entry == 0){
-      FATFree++;
+// HELPER FUNCTION - returns entry of file opened by fds[@fdIndex]
+static struct root *fd_entry(int fdIndex)
+{
+  return files[fds[fdIndex].file].ent;
+}
+
+// HELPER FUNCTION - returns index of the first data block of cluster @i
+static size_t cluster_block(uint32_t i)
+{
+  return superB->dataIndex + (size_t)i * superB->clusterBlocks;
+}
+
+// HELPER FUNCTION - discards the clusters of [@start, @end) still free, a run
+// of them at a time. Returns -1 if the host can't punch holes in the disk
+static int discard_run(uint32_t start, uint32_t end)
+{
+  for (uint32_t i = start; i < end; i++) {
+    if (fat_get(i) != 0) {
+      continue;
+    }
+    uint32_t j = i + 1;
+    while (j < end && fat_get(j) == 0) {
+      j++;
+    }
+    size_t blocks = (size_t)(j - i) * superB->clusterBlocks;
+    if (block_discard(cluster_block(i), blocks)) {
+      return -1;
+    }
+    numDiscarded += blocks;
+    i = j;
+  }
+  return 0;
+}
+
+// HELPER FUNCTION - discards the ranges of clusters freed since the last
+// discard. Clusters allocated again since are skipped, & discarding stops for
+// the mount if the host can't punch holes
+static void discard_flush(void)
+{
+  for (int r = 0; r < numDiscard && discardOn; r++) {
+    if (discard_run(discardStart[r], discardStart[r] + discardCount[r])) {
+      discardOn = false;
     }
   }
+  numDiscard = 0;
+}
 
-  for (int i = 0; i < FS_FILE_MAX_COUNT; i++) {
-    if(rootD[i].fileName[0] == 0){
-      rootDFree++;
+// HELPER FUNCTION - adds freed cluster @i to the ranges to discard, merged
+// into a range it extends, starting with the last one extended. Ranges are
+// discarded once all are taken
+static void discard_add(uint32_t i)
+{
+  for (int k = 0; k < numDiscard; k++) {
+    int r = (discardLast + k) % numDiscard;
+    if (i == discardStart[r] + discardCount[r] || i + 1 == discardStart[r]) {
+      discardStart[r] -= i + 1 == discardStart[r];
+      discardCount[r]++;
+      discardLast = r;
+      return;
+    }
+  }
+  if (numDiscard == DISCARD_RANGES) {
+    discard_flush();
+  }
+  discardStart[numDiscard] = i;
+  discardCount[numDiscard] = 1;
+  discardLast = numDiscard++;
+}
+
+// HELPER FUNCTION - returns # of references to cluster @i beyond the first
+// A count whose block can't be read reads as 0, & sets metaError
+static uint32_t ref_get(uint32_t i)
+{
+  if (!refBlocks) {
+    return 0;
+  }
+  uint32_t *block = (uint32_t*)cache_get(refBlocks[i / REFS_PER_BLOCK], false);
+  if (!block) {
+    metaError = true;
+    return 0;
+  }
+  return block[i % REFS_PER_BLOCK];
+}
+
+// HELPER FUNCTION - sets # of references to cluster @i beyond the first
+// An update whose block can't be read is lost, & sets metaError
+static void ref_set(uint32_t i, uint32_t refs)
+{
+  uint32_t *block = (uint32_t*)cache_get(refBlocks[i / REFS_PER_BLOCK], true);
+  if (!block) {
+    metaError = true;
+    return;
+  }
+  block[i % REFS_PER_BLOCK] = refs;
+}
+
+// HELPER FUNCTION - finds the blocks of the reference count table of the image
+// Returns -1 if its chain is too short
+static int ref_load(uint32_t first)
+{
+  numRefBlocks = (numClusters + REFS_PER_BLOCK - 1) / REFS_PER_BLOCK;
+  refBlocks = malloc(numRefBlocks * sizeof(size_t));
+  if (!refBlocks) {
+    return -1;
+  }
+  uint32_t i = first;
+  for (size_t b = 0; b < numRefBlocks; b++) {
+    if (i == FAT_EOC || i == 0 || i >= numClusters) {
+      free(refBlocks);
+      refBlocks = NULL;
+      return -1;
+    }
+    refBlocks[b] = cluster_block(i) + b % superB->clusterBlocks;
+    if ((b + 1) % superB->clusterBlocks == 0) {
+      i = fat_get(i);
+    }
+  }
+  return 0;
+}
+
+// HELPER FUNCTION - records blocks [@block, @block + @count) as changed in the
+// bitmap, called by the disk after each write
+static void cbt_mark(size_t block, size_t count)
+{
+  for (size_t i = block; i < block + count; i++) {
+    uint8_t bit = 1 << (i % 8);
+    if (!(cbtMap[i / 8] & bit)) {
+      cbtMap[i / 8] |= bit;
+      cbtDirty[i / CBT_BITS_PER_BLOCK] = true;
+    }
+  }
+}
+
+// HELPER FUNCTION - releases the changed block bitmap, & stops tracking
+static void cbt_free(void)
+{
+  if (cbtMap) {
+    block_disk_track(NULL);
+  }
+  free(cbtMap);
+  free(cbtBlocks);
+  free(cbtDirty);
+  cbtMap = NULL;
+  cbtBlocks = NULL;
+  cbtDirty = NULL;
+}
+
+// HELPER FUNCTION - finds the blocks of the changed block bitmap starting at
+// cluster @first & reads it into memory if @read, else clears it. Returns -1
+// if its chain is too short, or if it can't be read
+static int cbt_load(uint32_t first, bool read)
+{
+  numCbtBlocks = (superB->numBlocks + CBT_BITS_PER_BLOCK - 1) /
+    CBT_BITS_PER_BLOCK;
+  cbtBlocks = malloc(numCbtBlocks * sizeof(size_t));
+  cbtDirty = calloc(numCbtBlocks, sizeof(bool));
+  if (posix_memalign((void**)&cbtMap, BLOCK_SIZE, numCbtBlocks * BLOCK_SIZE)) {
+    cbtMap = NULL;
+  }
+  if (!cbtBlocks || !cbtDirty || !cbtMap) {
+    cbt_free();
+    return -1;
+  }
+  memset(cbtMap, 0, numCbtBlocks * BLOCK_SIZE);
+  uint32_t i = first;
+  for (size_t b = 0; b < numCbtBlocks; b++) {
+    if (i == FAT_EOC || i == 0 || i >= numClusters ||
+        (read && block_read(cluster_block(i) + b % superB->clusterBlocks,
+                            cbtMap + b * BLOCK_SIZE))) {
+      cbt_free();
+      return -1;
     }
+    cbtBlocks[b] = cluster_block(i) + b % superB->clusterBlocks;
+    if ((b + 1) % superB->clusterBlocks == 0) {
+      i = fat_get(i);
+    }
+  }
+  return 0;
+}
+
+// HELPER FUNCTION - writes blocks of the changed block bitmap changed since
+// written back. Writing them marks them, until each of their bits is set
+static void cbt_flush(void)
+{
+  bool again = cbtMap != NULL;
+  while (again) {
+    again = false;
+    for (size_t b = 0; b < numCbtBlocks; b++) {
+      if (cbtDirty[b]) {
+        cbtDirty[b] = false;
+        block_write(cbtBlocks[b], cbtMap + b * BLOCK_SIZE);
+        again = true;
+      }
+    }
+  }
+}
+
+// HELPER FUNCTION - loads a 16-bit superblock into the in-memory superblock
+static void superblock_from16(const struct superblock16 *sb16)
+{
+  memset(superB, 0, sizeof(struct superblock));
+  memcpy(superB->signature, sb16->signature, SIGNATURE_BYTES);
+  superB->numBlocks = sb16->numBlocks;
+  superB->rootIndex = sb16->rootIndex;
+  superB->dataIndex = sb16->dataIndex;
+  superB->numDataBlocks = sb16->numDataBlocks;
+  superB->numFATBlocks = sb16->numFATBlocks;
+  superB->clusterBlocks = 1;
+}
+
+// HELPER FUNCTION - stores the in-memory superblock as a 16-bit superblock
+static void superblock_to16(struct superblock16 *sb16)
+{
+  memset(sb16, 0, sizeof(struct superblock16));
+  memcpy(sb16->signature, superB->signature, SIGNATURE_BYTES);
+  sb16->numBlocks = superB->numBlocks;
+  sb16->rootIndex = superB->rootIndex;
+  sb16->dataIndex = superB->dataIndex;
+  sb16->numDataBlocks = superB->numDataBlocks;
+  sb16->numFATBlocks = superB->numFATBlocks;
+}
+
+// HELPER FUNCTION - loads 16-bit root directory entries into rootD
+static void root_from16(const struct root16 *r16)
+{
+  memset(rootD, 0, sizeof(rootD));
+  for (int i = 0; i < FS_FILE_MAX_COUNT; i++) {
+    memcpy(rootD[i].fileName, r16[i].fileName, FILENAME_SIZE);
+    rootD[i].size = r16[i].size;
+    rootD[i].firstIndex = r16[i].firstIndex == FAT16_EOC ? FAT_EOC :
+      r16[i].firstIndex;
+  }
+}
+
+// HELPER FUNCTION - stores rootD as 16-bit root directory entries
+static void root_to16(struct root16 *r16)
+{
+  memset(r16, 0, FS_FILE_MAX_COUNT * sizeof(struct root16));
+  for (int i = 0; i < FS_FILE_MAX_COUNT; i++) {
+    memcpy(r16[i].fileName, rootD[i].fileName, FILENAME_SIZE);
+    r16[i].size = rootD[i].size;
+    r16[i].firstIndex = rootD[i].firstIndex == FAT_EOC ? FAT16_EOC :
+      rootD[i].firstIndex;
+  }
+}
+
+// Create a file system
+int fs_format(const char *diskname, size_t data_blk_count,
+              const struct fs_format_opts *opts)
+{
+  bool format32 = opts && (opts->flags & FS_FORMAT_FAT32);
+  size_t clusterBlocks = opts && opts->cluster_blocks ? opts->cluster_blocks :
+    1;
+
+  // ERROR CHECKING
+  // Invalid diskname or data block count out of the format's range
+  if (!diskname || data_blk_count == 0) {
+    return -1;
+  }
+  if (!format32 && (data_blk_count > FAT16_MAX_DATA_BLOCKS ||
+      (opts && opts->flags & ~(FS_FORMAT_FAT32 | FS_FORMAT_PREALLOCATE)))) {
+    return -1;
+  }
+  // Cluster size must be a power of 2, and only 32-bit images record it
+  if ((clusterBlocks & (clusterBlocks - 1)) || clusterBlocks > UINT16_MAX ||
+      (!format32 && clusterBlocks != 1)) {
+    return -1;
+  }
+
+  // Compute layout: superblock, FAT, root directory, then data blocks
+  // Data blocks are rounded up to a whole number of clusters
+  size_t clusters = (data_blk_count + clusterBlocks - 1) / clusterBlocks;
+  data_blk_count = clusters * clusterBlocks;
+  size_t perFATBlock = format32 ? ENTRIES_PER_FAT32_BLOCK :
+    ENTRIES_PER_FAT_BLOCK;
+  size_t numFATBlocks = (clusters + perFATBlock - 1) / perFATBlock;
+  size_t numBlocks = 1 + numFATBlocks + 1 + data_blk_count;
+  if (numBlocks > INT_MAX || clusters >= FAT_EOC) {
+    return -1;
+  }
+
+  char block[BLOCK_SIZE];
+  memset(block, 0, BLOCK_SIZE);
+  if (format32) {
+    struct superblock *sb = (struct superblock*)block;
+    memcpy(sb->signature, "ECS150FX", SIGNATURE_BYTES);
+    sb->version = FS_VERSION;
+    sb->numBlocks = numBlocks;
+    sb->rootIndex = numFATBlocks + 1;
+    sb->dataIndex = numFATBlocks + 2;
+    sb->numDataBlocks = data_blk_count;
+    sb->numFATBlocks = numFATBlocks;
+    sb->clusterBlocks = clusterBlocks;
+    sb->features = (opts->flags & FS_FORMAT_INLINE ? FEATURE_INLINE : 0) |
+      (opts->flags & FS_FORMAT_COMPRESS ? FEATURE_COMPRESS : 0) |
+      (opts->flags & FS_FORMAT_EXTENTS ? FEATURE_EXTENTS : 0);
+  } else {
+    struct superblock16 *sb = (struct superblock16*)block;
+    memcpy(sb->signature, "ECS150FS", SIGNATURE_BYTES);
+    sb->numBlocks = numBlocks;
+    sb->rootIndex = numFATBlocks + 1;
+    sb->dataIndex = numFATBlocks + 2;
+    sb->numDataBlocks = data_blk_count;
+    sb->numFATBlocks = numFATBlocks;
+  }
+
+  // Size the image first, data blocks are left as holes in the host file
+  int fd = open(diskname, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror("open");
+    return -1;
+  }
+  if (ftruncate(fd, (off_t)numBlocks * BLOCK_SIZE)) {
+    perror("ftruncate");
+    close(fd);
+    return -1;
+  }
+  // posix_fallocate() returns the error rather than setting errno
+  if (opts && opts->flags & FS_FORMAT_PREALLOCATE) {
+    int err = posix_fallocate(fd, 0, (off_t)numBlocks * BLOCK_SIZE);
+    if (err) {
+      fprintf(stderr, "posix_fallocate: %s\n", strerror(err));
+      close(fd);
+      return -1;
+    }
+  }
+
+  // Write superblock, first FAT block (first entry is always EOC) & root
+  // The other FAT blocks are all free entries, which the holes already read as
+  int ret = 0;
+  if (pwrite(fd, block, BLOCK_SIZE, 0) != BLOCK_SIZE) {
+    ret = -1;
+  }
+  memset(block, 0, BLOCK_SIZE);
+  memset(block, 0xFF, format32 ? sizeof(uint32_t) : sizeof(uint16_t));
+  if (!ret && pwrite(fd, block, BLOCK_SIZE, BLOCK_SIZE) != BLOCK_SIZE) {
+    ret = -1;
+  }
+  memset(block, 0, BLOCK_SIZE);
+  if (!ret && pwrite(fd, block, BLOCK_SIZE, (off_t)(numFATBlocks + 1) *
+      BLOCK_SIZE) != BLOCK_SIZE) {
+    ret = -1;
+  }
+  if (ret) {
+    perror("pwrite");
+  }
+
+  close(fd);
+  return ret;
+}
+
+// HELPER FUNCTION - monotonic time in usecs
+static uint64_t usecs_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// HELPER FUNCTION - syncs the disk, timed for the statistics
+static int disk_sync(void)
+{
+  uint64_t start = usecs_now();
+  int ret = block_disk_sync();
+  uint64_t t = usecs_now() - start;
+
+  pthread_mutex_lock(&syncLock);
+  numSyncs++;
+  syncUsecs += t;
+  if (t > syncMaxUsecs) {
+    syncMaxUsecs = t;
+  }
+  pthread_mutex_unlock(&syncLock);
+  return ret;
+}
+
+// HELPER FUNCTION - starts tracking the blocks the mount writes. If the last
+// read-write mount wasn't unmounted, blocks it wrote may be missing from the
+// bitmap, which is then filled. This mount is marked in progress on disk
+// before anything it tracks gets written. Returns -1 if the mark can't be
+static int cbt_start(void)
+{
+  if (superB->cbtOpen) {
+    memset(cbtMap, 0xFF, numCbtBlocks * BLOCK_SIZE);
+    memset(cbtDirty, true, numCbtBlocks * sizeof(bool));
+  }
+  block_disk_track(cbt_mark);
+  superB->cbtOpen = 1;
+  return block_write(0, superB) || disk_sync() ? -1 : 0;
+}
+
+// HELPER FUNCTION - syncer thread, syncs the disk whenever commits were made
+// since its last sync
+static void *syncer_main(void *arg)
+{
+  (void)arg;
+  pthread_mutex_lock(&syncLock);
+  while (!syncStop) {
+    if (syncedGen == commitGen) {
+      pthread_cond_wait(&syncCond, &syncLock);
+      continue;
+    }
+    // Commits made while syncing are covered by the next sync
+    uint64_t gen = commitGen;
+    pthread_mutex_unlock(&syncLock);
+    disk_sync();
+    pthread_mutex_lock(&syncLock);
+    syncedGen = gen;
+  }
+  pthread_mutex_unlock(&syncLock);
+  return NULL;
+}
+
+// HELPER FUNCTION - writes Superblock, Root Directory, entries of open files
+// outside root & modified FAT blocks back to disk
+static void meta_flush(void)
+{
+  if (fat16) {
+    struct superblock16 SB16Buffer BLOCK_ALIGNED;
+    struct root16 root16Buffer[FS_FILE_MAX_COUNT] BLOCK_ALIGNED;
+    superblock_to16(&SB16Buffer);
+    block_write(0, &SB16Buffer);
+    root_to16(root16Buffer);
+    block_write(superB->rootIndex, root16Buffer);
+  } else {
+    block_write(0, superB);
+    block_write(superB->rootIndex, rootD);
+  }
+  for (int i = 0; i < FS_OPEN_MAX_COUNT; i++) {
+    if (files[i].refs && files[i].loc.block != 0) {
+      entry_write(&files[i].loc, files[i].ent);
+    }
+  }
+  // Only FAT blocks modified since mount are written back, & clusters they
+  // free are discarded then
+  if (cache_flush()) {
+    metaError = true;
+  }
+  discard_flush();
+  cbt_flush();
+}
+
+// HELPER FUNCTION - writes buffered data of open files, then metadata back
+static void full_flush(void)
+{
+  for (int i = 0; i < FS_OPEN_MAX_COUNT; i++) {
+    if (fds[i].ID != -1) {
+      wbuf_flush(i);
+    }
+  }
+  meta_flush();
+}
+
+// HELPER FUNCTION - called at the end of operations modifying the FS: frees a
+// batch of clusters of deleted files, & does the group commit of
+// FS_MOUNT_SYNC_PERIODIC: once syncInterval has passed since the last commit,
+// writes buffered data & metadata back & wakes the syncer thread up
+static void sync_tick(void)
+{
+  if (readOnly) {
+    return;
+  }
+  reclaim_run(RECLAIM_BATCH);
+  if (!(syncPolicy & FS_MOUNT_SYNC_PERIODIC)) {
+    return;
+  }
+  uint64_t t = usecs_now();
+  if (t - lastCommit < syncInterval) {
+    return;
+  }
+
+  full_flush();
+  lastCommit = t;
+
+  pthread_mutex_lock(&syncLock);
+  commitGen++;
+  pthread_cond_signal(&syncCond);
+  pthread_mutex_unlock(&syncLock);
+}
+
+// Mount a file system
+int fs_mount(const char *diskname)
+{
+  return fs_mount_opts(diskname, NULL);
+}
+
+int fs_mount_opts(const char *diskname, const struct fs_mount_opts *opts)
+{
+	/* TODO: Phase 1 */
+  // ERROR CHECKING
+  // Check diskname validity, & that the disk can be opened as asked. Read-only
+  // mounts go through the host's page cache, shared with other processes
+  readOnly = opts && (opts->flags & FS_MOUNT_READONLY);
+  directIO = !readOnly && opts && (opts->flags & FS_MOUNT_DIRECT);
+  if ((readOnly ? block_disk_open_readonly : directIO ? block_disk_open_direct :
+       block_disk_open)(diskname)) {
+    fprintf(stderr, "Can't open\n");
+    return -1;
+  }
+
+  // Read superblock(First block of fs)
+  // Buffer to read in superblock
+  static char SBBuffer[BLOCK_SIZE] BLOCK_ALIGNED;
+  static struct superblock SBMem BLOCK_ALIGNED;
+  block_read(0, SBBuffer);
+  superB = &SBMem;
+
+  // ERROR CHECKING
+  // Check correct signature, which also tells the FAT width
+  if (!strncmp(SBBuffer, "ECS150FS", 8)) {
+    fat16 = true;
+    superblock_from16((struct superblock16*)SBBuffer);
+  } else if (!strncmp(SBBuffer, "ECS150FX", 8)) {
+    fat16 = false;
+    memcpy(superB, SBBuffer, BLOCK_SIZE);
+    if (superB->version != FS_VERSION) {
+      fprintf(stderr, "Unsupported version\n");
+      goto close;
+    }
+    if (superB->clusterBlocks == 0) {
+      superB->clusterBlocks = 1;
+    }
+    if (superB->features & ~FEATURES_KNOWN) {
+      fprintf(stderr, "Unsupported features\n");
+      goto close;
+    }
+  } else {
+	  fprintf(stderr, "Wrong signature\n");
+    goto close;
+  }
+  // Check correct number of blocks
+  if (superB->numBlocks != (uint32_t)block_disk_count()) {
+  	fprintf(stderr, "Wrong number of blocks\n");
+    goto close;
+  }
+  // Check correct root index
+  if (superB->rootIndex != (superB->numFATBlocks + 1)) {
+	  fprintf(stderr, "Wrong root index\n");
+    goto close;
+  }
+  // Check correct data index
+  if (superB->dataIndex != (superB->rootIndex + 1)) {
+	  fprintf(stderr, "Wrong data index\n");
+    goto close;
+  }
+  // Check data blocks are a whole number of power of 2 sized clusters, and
+  // that the FAT has an entry for each of them
+  numClusters = superB->numDataBlocks / superB->clusterBlocks;
+  clusterSize = (size_t)superB->clusterBlocks * BLOCK_SIZE;
+  if ((superB->clusterBlocks & (superB->clusterBlocks - 1)) ||
+      superB->numDataBlocks % superB->clusterBlocks ||
+      (uint64_t)superB->numFATBlocks * (fat16 ? ENTRIES_PER_FAT_BLOCK :
+      ENTRIES_PER_FAT32_BLOCK) < numClusters) {
+	  fprintf(stderr, "Wrong cluster size\n");
+    goto close;
+  }
+
+  // Mark of a mount in progress as found, for a failing mount to leave it
+  uint32_t cbtWasOpen = superB->cbtOpen;
+
+  // FAT(next blocks of fs) is paged in on demand, only its first block is
+  // read now. Cache pages & bounce buffers come from the mount's pool.
+  // Read-only mounts read metadata through the disk's mapping instead
+  diskMap = readOnly ? block_disk_map() : NULL;
+  pool_init();
+  cache_init();
+  numFreeKnown = false;
+  metaError = false;
+  if (directIO && posix_memalign((void**)&directStage, BLOCK_SIZE,
+                                 STAGE_BLOCKS * BLOCK_SIZE)) {
+    fprintf(stderr, "Out of memory\n");
+    goto fail;
+  }
+
+  // ERROR CHECKING
+  // First entry of FAT should always be invalid
+  if (fat_get(0) != FAT_EOC) {
+    fprintf(stderr, "First FAT entry not invalid\n");
+    goto fail;
+  }
+  // Blocks of the reference count table of clones, read through the cache
+  refBlocks = NULL;
+  if (!fat16 && (superB->features & FEATURE_CLONE) &&
+      ref_load(superB->refIndex)) {
+    fprintf(stderr, "Wrong reference count table\n");
+    goto fail;
+  }
+  // Changed block bitmap, tracking blocks written from now on. Read-only
+  // mounts write nothing, so leave it alone
+  if (!fat16 && !readOnly && (superB->features & FEATURE_CBT) &&
+      (cbt_load(superB->cbtIndex, true) || cbt_start())) {
+    fprintf(stderr, "Wrong changed block bitmap\n");
+    goto fail;
+  }
+
+  // Read root directory(next block of fs, right before data blocks)
+  if (fat16) {
+    struct root16 root16Buffer[FS_FILE_MAX_COUNT] BLOCK_ALIGNED;
+    block_read(superB->rootIndex, root16Buffer);
+    root_from16(root16Buffer);
+  } else {
+    block_read(superB->rootIndex, rootD);
+  }
+
+  // Initialize array of file descriptors(fds)
+  for (int i = 0; i < FS_OPEN_MAX_COUNT; i++) {
+    fds[i].ID = -1;
+    fds[i].offset = 0;
+    fds[i].file = -1;
+    fds[i].wbuf = NULL;
+    fds[i].wbufLen = 0;
+    fds[i].wbufReserved = 0;
+    files[i].refs = 0;
+  }
+  numReserved = 0;
+  freeHint = 1;
+
+  // Durability policy, with its syncer thread for periodic commits
+  syncPolicy = opts && !readOnly ? opts->flags & (FS_MOUNT_SYNC_CLOSE |
+                                                  FS_MOUNT_SYNC_PERIODIC) : 0;
+  syncInterval = (opts && opts->sync_interval_ms ? opts->sync_interval_ms :
+                  SYNC_INTERVAL_MS) * (uint64_t)1000;
+  numSyncs = 0;
+  syncUsecs = 0;
+  syncMaxUsecs = 0;
+
+  // Chains of deleted files left pending are freed after the mount, in the
+  // background of the operations that follow
+  numReclaimed = 0;
+
+  // Freed clusters are discarded in batches, if asked
+  discardOn = !readOnly && opts && (opts->flags & FS_MOUNT_DISCARD);
+  numDiscard = 0;
+  discardLast = 0;
+  numDiscarded = 0;
+
+  // Dedup index, with a bucket per cluster or more
+  numDeduped = 0;
+  if (!fat16 && !readOnly && opts && (opts->flags & FS_MOUNT_DEDUP)) {
+    for (dedupMask = 1; dedupMask < numClusters; dedupMask <<= 1);
+    dedupBuckets = calloc(dedupMask, sizeof(uint32_t));
+    dedupNext = malloc(numClusters * sizeof(uint32_t));
+    dedupHash = calloc(numClusters, sizeof(uint64_t));
+    dedupKey = malloc(numClusters * sizeof(uint64_t));
+    dedupMask--;
+    if (!dedupBuckets || !dedupNext || !dedupHash || !dedupKey) {
+      fprintf(stderr, "Out of memory\n");
+      goto fail;
+    }
+  }
+  if (syncPolicy & FS_MOUNT_SYNC_PERIODIC) {
+    lastCommit = usecs_now();
+    commitGen = 0;
+    syncedGen = 0;
+    syncStop = false;
+    if (pthread_create(&syncer, NULL, syncer_main, NULL)) {
+      fprintf(stderr, "Can't start syncer\n");
+      goto fail;
+    }
+  }
+
+  // Assert FS as true, when filesystem is fully mounted
+  FS = true;
+  return 0;
+
+fail:
+  // Release what the mount acquired so far. A mount marked in progress on disk
+  // is marked over again, the bitmap on disk still holds every block written
+  if (cbtMap && !cbtWasOpen) {
+    superB->cbtOpen = 0;
+    block_write(0, superB);
+  }
+  cbt_free();
+  dedup_free();
+  free(refBlocks);
+  refBlocks = NULL;
+  free(directStage);
+  directStage = NULL;
+  cache_free();
+  pool_free();
+close:
+  block_disk_close();
+  return -1;
+}
+
+int fs_umount(void)
+{
+	/* TODO: Phase 1 */
+  // ERROR CHECKING
+  // Check if there's a file system currently mounted & if any open FDs
+  if (!FS || numOpenFiles){
+    return -1;
+  }
+
+  // Syncer thread stops, the sync below covers commits it left pending
+  if (syncPolicy & FS_MOUNT_SYNC_PERIODIC) {
+    pthread_mutex_lock(&syncLock);
+    syncStop = true;
+    pthread_cond_signal(&syncCond);
+    pthread_mutex_unlock(&syncLock);
+    pthread_join(syncer, NULL);
+  }
+
+  // Chains of deleted files still pending are freed for good, & Superblock,
+  // FAT, & Root Directory meta-info written back to disk, unless read-only
+  if (!readOnly) {
+    reclaim_run(SIZE_MAX);
+    meta_flush();
+  }
+  // Once the bitmap is on disk, the mount is marked over: the bitmap then
+  // holds each block it wrote
+  if (cbtMap) {
+    disk_sync();
+    superB->cbtOpen = 0;
+    block_write(0, superB);
+  }
+  if (syncPolicy) {
+    disk_sync();
+  }
+  cache_free();
+  pool_free();
+  free(directStage);
+  directStage = NULL;
+  free(compRaw);
+  free(compStage);
+  compRaw = NULL;
+  compStage = NULL;
+  free(fatRuns);
+  fatRuns = NULL;
+  free(refBlocks);
+  refBlocks = NULL;
+  dedup_free();
+  cbt_free();
+
+  diskMap = NULL;
+
+	// If no disk is currently open, return -1
+	if (block_disk_close()) {
+		return -1;
+	}
+  // Filesystem unmounted, a FAT update lost on the way is reported now
+  FS = false;
+  if (metaError) {
+    return -1;
+  }
+	return 0;
+}
+
+int fs_info(void)
+{
+	/* TODO: Phase 1 */
+	// Return -1 if no underlying virtual disk was opened
+	if (!FS) {
+		return -1;
+	}
+
+  // Retrieve number of empty data blocks & rootD entries
+  uint32_t FATFree = fat_free_count();
+  int rootDFree = 0;
+
+  for (int i = 0; i < FS_FILE_MAX_COUNT; i += record_slots(&rootD[i])) {
+    if(rootD[i].fileName[0] == 0){
+      rootDFree++;
+    }
+  }
+
+	// Display fs info
+	printf("FS Info:\n");
+	printf("total_blk_count=%u\n", superB->numBlocks);
+	printf("fat_blk_count=%u\n", superB->numFATBlocks);
+	printf("rdir_blk=%u\n", superB->rootIndex);
+	printf("data_blk=%u\n", superB->dataIndex);
+	printf("data_blk_count=%u\n", superB->numDataBlocks);
+  if (!fat16) {
+    printf("cluster_blk_count=%u\n", superB->clusterBlocks);
+  }
+  printf("fat_free_ratio=%u/%u\n", FATFree, numClusters);
+  printf("rdir_free_ratio=%d/%d\n", rootDFree, FS_FILE_MAX_COUNT);
+	return 0;
+}
+
+int fs_stats(struct fs_stats *stats)
+{
+  // ERROR CHECKING
+  // No filesystem mounted, or NULL stats
+  if (!FS || !stats) {
+    return -1;
+  }
+
+  memset(stats, 0, sizeof(struct fs_stats));
+  stats->cluster_size = clusterSize;
+  stats->total_clusters = numClusters;
+  stats->free_clusters = fat_free_count() - numReserved;
+  block_disk_io_count(&stats->blocks_read, &stats->blocks_written);
+  stats->allocations = numAllocs;
+  stats->dedup_clusters = numDeduped;
+  stats->reclaimed_clusters = numReclaimed;
+  stats->discarded_blocks = numDiscarded;
+  pthread_mutex_lock(&syncLock);
+  stats->syncs = numSyncs;
+  stats->sync_usecs = syncUsecs;
+  stats->sync_max_usecs = syncMaxUsecs;
+  pthread_mutex_unlock(&syncLock);
+  return 0;
+}
+
+int fs_trim(size_t *blocks)
+{
+  // ERROR CHECKING
+  // No filesystem mounted, or mounted read-only
+  if (!FS || readOnly) {
+    return -1;
+  }
+
+  // Free clusters are only discarded once the FAT on disk says so
+  reclaim_run(SIZE_MAX);
+  meta_flush();
+  size_t before = numDiscarded;
+  if (discard_run(1, numClusters)) {
+    return -1;
+  }
+  if (blocks) {
+    *blocks = numDiscarded - before;
+  }
+  return 0;
+}
+
+int fs_checkpoint(void)
+{
+  // ERROR CHECKING
+  // No filesystem mounted, mounted read-only, or 16-bit image
+  if (!FS || readOnly || fat16) {
+    return -1;
+  }
+
+  // Blocks written so far belong to the last checkpoint, the bitmap is added
+  // to the image on its first one
+  full_flush();
+  if (cbt_create()) {
+    return -1;
+  }
+  superB->cbtGen++;
+  memset(cbtMap, 0, numCbtBlocks * BLOCK_SIZE);
+  memset(cbtDirty, true, numCbtBlocks * sizeof(bool));
+  meta_flush();
+  return 0;
+}
+
+// HELPER FUNCTION - writes @len bytes of @buf to host file @fd at @*pos, &
+// moves @*pos past them. Returns -1 if they can't all be written
+static int host_write(int fd, const void *buf, size_t len, off_t *pos)
+{
+  while (len) {
+    ssize_t n = pwrite(fd, buf, len, *pos);
+    if (n <= 0) {
+      return -1;
+    }
+    buf = (const char*)buf + n;
+    len -= n;
+    *pos += n;
+  }
+  return 0;
+}
+
+// HELPER FUNCTION - reads @len bytes of host file @fd at @*pos into @buf, &
+// moves @*pos past them. Returns -1 if they can't all be read
+static int host_read(int fd, void *buf, size_t len, off_t *pos)
+{
+  while (len) {
+    ssize_t n = pread(fd, buf, len, *pos);
+    if (n <= 0) {
+      return -1;
+    }
+    buf = (char*)buf + n;
+    len -= n;
+    *pos += n;
+  }
+  return 0;
+}
+
+// HELPER FUNCTION - returns true if block @i changed since the last checkpoint
+static bool cbt_changed(size_t i)
+{
+  return cbtMap[i / 8] & (1 << (i % 8));
+}
+
+int fs_delta_export(const char *deltaname, unsigned int flags, size_t *blocks)
+{
+  // ERROR CHECKING
+  // No filesystem mounted, or no checkpoint taken yet
+  if (!FS || !cbtMap || !deltaname) {
+    return -1;
+  }
+
+  // The delta holds the image as on disk, once everything is written back,
+  // the superblock included. A checkpoint taken along only counts in the
+  // superblock the delta holds until the delta is written
+  full_flush();
+  struct deltaHeader header BLOCK_ALIGNED;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.signature, DELTA_SIGNATURE, SIGNATURE_BYTES);
+  header.numBlocks = superB->numBlocks;
+  header.baseGen = superB->cbtGen;
+  header.gen = superB->cbtGen + (flags & FS_DELTA_CHECKPOINT ? 1 : 0);
+  for (size_t i = 0; i < superB->numBlocks; i++) {
+    header.numChanged += cbt_changed(i);
+  }
+
+  int fd = open(deltaname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  char *buf = io_alloc(STAGE_BLOCKS * BLOCK_SIZE);
+  off_t pos = 0;
+  int ret = fd == -1 || !buf ? -1 : host_write(fd, &header, BLOCK_SIZE, &pos);
+  for (size_t i = 0; !ret && i < superB->numBlocks; i++) {
+    if (!cbt_changed(i)) {
+      continue;
+    }
+    struct deltaRun run = { .start = i, .count = 0 };
+    while (i < superB->numBlocks && cbt_changed(i)) {
+      run.count++;
+      i++;
+    }
+    ret = host_write(fd, &run, sizeof(run), &pos);
+    // Blocks are staged in batches, the superblock as the image it makes has
+    // it: unmounted, & at the delta's checkpoint
+    for (size_t b = run.start; !ret && b < run.start + run.count;
+         b += STAGE_BLOCKS) {
+      size_t n = run.start + run.count - b < STAGE_BLOCKS ?
+        run.start + run.count - b : STAGE_BLOCKS;
+      ret = block_read_range(b, n, buf);
+      if (!ret && b == 0) {
+        ((struct superblock*)buf)->cbtOpen = 0;
+        ((struct superblock*)buf)->cbtGen = header.gen;
+      }
+      if (!ret) {
+        ret = host_write(fd, buf, n * BLOCK_SIZE, &pos);
+      }
+    }
+  }
+  struct deltaRun end = { .start = 0, .count = 0 };
+  if (!ret) {
+    ret = host_write(fd, &end, sizeof(end), &pos);
+  }
+  if (fd != -1 && close(fd)) {
+    ret = -1;
+  }
+  free(buf);
+  if (ret) {
+    return -1;
+  }
+
+  // The checkpoint is taken once the delta is complete
+  if (flags & FS_DELTA_CHECKPOINT) {
+    superB->cbtGen = header.gen;
+    memset(cbtMap, 0, numCbtBlocks * BLOCK_SIZE);
+    memset(cbtDirty, true, numCbtBlocks * sizeof(bool));
+    meta_flush();
+  }
+  if (blocks) {
+    *blocks = header.numChanged;
+  }
+  return 0;
+}
+
+int fs_delta_apply(const char *diskname, const char *deltaname)
+{
+  // ERROR CHECKING
+  // A filesystem mounted, or a delta that can't be read
+  if (FS || !diskname || !deltaname) {
+    return -1;
+  }
+  int fd = open(deltaname, O_RDONLY);
+  if (fd == -1) {
+    return -1;
+  }
+  struct deltaHeader header BLOCK_ALIGNED;
+  off_t pos = 0;
+  if (host_read(fd, &header, BLOCK_SIZE, &pos) ||
+      memcmp(header.signature, DELTA_SIGNATURE, SIGNATURE_BYTES)) {
+    fprintf(stderr, "Wrong delta\n");
+    close(fd);
+    return -1;
+  }
+
+  // The delta only applies to the image as of its base checkpoint
+  struct superblock sb BLOCK_ALIGNED;
+  if (block_disk_open(diskname)) {
+    fprintf(stderr, "Can't open\n");
+    close(fd);
+    return -1;
+  }
+  if (block_read(0, &sb) || strncmp((char*)sb.signature, "ECS150FX", 8) ||
+      sb.numBlocks != header.numBlocks || !(sb.features & FEATURE_CBT) ||
+      sb.cbtGen != header.baseGen) {
+    fprintf(stderr, "Delta doesn't apply\n");
+    block_disk_close();
+    close(fd);
+    return -1;
+  }
+
+  // The whole delta is checked before anything is written: runs within the
+  // image, as many blocks as the header counts, & all of them in the file
+  struct stat st;
+  struct deltaRun run;
+  off_t dataPos = pos;
+  uint64_t numChanged = 0;
+  int ret = fstat(fd, &st);
+  while (!ret) {
+    ret = host_read(fd, &run, sizeof(run), &pos);
+    if (ret || run.count == 0) {
+      break;
+    }
+    if ((uint64_t)run.start + run.count > header.numBlocks) {
+      ret = -1;
+    }
+    numChanged += run.count;
+    pos += (off_t)run.count * BLOCK_SIZE;
+  }
+  if (!ret && (numChanged != header.numChanged || pos != st.st_size)) {
+    ret = -1;
+  }
+
+  // Then blocks are written, the superblock last: until it is, the image is
+  // still at the delta's base checkpoint, & takes the delta again
+  char *buf = io_alloc(STAGE_BLOCKS * BLOCK_SIZE);
+  char *sbBuf = io_alloc(BLOCK_SIZE);
+  bool sbChanged = false;
+  if (!buf || !sbBuf) {
+    ret = -1;
+  }
+  pos = dataPos;
+  while (!ret) {
+    ret = host_read(fd, &run, sizeof(run), &pos);
+    if (ret || run.count == 0) {
+      break;
+    }
+    for (size_t b = run.start; !ret && b < run.start + run.count;
+         b += STAGE_BLOCKS) {
+      size_t n = run.start + run.count - b < STAGE_BLOCKS ?
+        run.start + run.count - b : STAGE_BLOCKS;
+      ret = host_read(fd, buf, n * BLOCK_SIZE, &pos);
+      if (!ret && b == 0) {
+        memcpy(sbBuf, buf, BLOCK_SIZE);
+        sbChanged = true;
+      }
+      if (!ret && (b > 0 || n > 1)) {
+        ret = b == 0 ? block_write_range(1, n - 1, buf + BLOCK_SIZE) :
+          block_write_range(b, n, buf);
+      }
+    }
+  }
+  if (!ret && sbChanged) {
+    ret = block_disk_sync() || block_write(0, sbBuf) ? -1 : 0;
+  }
+  free(sbBuf);
+  free(buf);
+  close(fd);
+  if (ret) {
+    fprintf(stderr, "Wrong delta\n");
+  }
+  if (block_disk_sync()) {
+    ret = -1;
+  }
+  block_disk_close();
+  return ret;
+}
+
+// HELPER FUNCTION - returns true if a free cluster is left beyond those
+// reserved, once chains of deleted files are reclaimed for one if needed
+static bool cluster_left(void)
+{
+  while (numFreeKnown && numFree <= numReserved) {
+    if (!reclaim_run(RECLAIM_BATCH)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// HELPER FUNCTION - finds free FAT block
+// Search resumes after the last allocation, so appends don't rescan the FAT
+int find_freeFAT(){
+  if (!cluster_left()) {
+    return -1;
+  }
+  for (uint32_t n = 1; n < numClusters; n++) {
+    uint32_t i = freeHint + n - 1;
+    if (i >= numClusters) {
+      i -= numClusters - 1;
+    }
+    if(fat_get(i) == 0){
+      freeHint = i;
+      return i;
+    }
+  }
+
+  // In case of no room, unless deleted files still hold some
+  if (reclaim_run(RECLAIM_BATCH)) {
+    return find_freeFAT();
+  }
+  return -1;
+}
+
+// HELPER FUNCTION - summarizes free runs of FAT block #@b into fatRuns
+static void fat_runs(size_t b)
+{
+  struct fatRuns *r = &fatRuns[b];
+  uint32_t first = b * fat_entries();
+  uint32_t last = first + fat_entries() < numClusters ?
+    first + fat_entries() : numClusters;
+  uint32_t start = first, length = 0;
+  r->head = 0;
+  r->longest = 0;
+  r->start = first;
+  for (uint32_t i = first; i < last; i++) {
+    if (fat_get(i) != 0) {
+      length = 0;
+      continue;
+    }
+    if (length++ == 0) {
+      start = i;
+    }
+    if (start == first) {
+      r->head = length;
+    }
+    if (length > r->longest) {
+      r->start = start;
+      r->longest = length;
+    }
+  }
+  r->tail = length;
+  r->stale = false;
+}
+
+// HELPER FUNCTION - finds where to place a file that keeps growing: in the
+// middle of the largest free gap, leaving room to the files before it, or at
+// the gap's start if nothing precedes it. Returns -1 if no gap holds @clusters.
+// Only FAT blocks changed since the last search are scanned again
+static int find_freeGap(size_t clusters)
+{
+  if (numFreeKnown && numFree < numReserved + clusters) {
+    return -1;
+  }
+  size_t blocks = (numClusters + fat_entries() - 1) / fat_entries();
+  if (!fatRuns) {
+    numAllocs++;
+    if (!(fatRuns = malloc(blocks * sizeof(struct fatRuns)))) {
+      return -1;
+    }
+    for (size_t b = 0; b < blocks; b++) {
+      fatRuns[b].stale = true;
+    }
+  }
+
+  // Runs across blocks join the tail of a block to the head of the next
+  uint32_t start = 0, length = 0, best = 0, bestLength = 0;
+  for (size_t b = 0; b < blocks; b++) {
+    if (fatRuns[b].stale) {
+      fat_runs(b);
+    }
+    const struct fatRuns *r = &fatRuns[b];
+    uint32_t first = b * fat_entries();
+    uint32_t entries = numClusters - first < fat_entries() ?
+      numClusters - first : fat_entries();
+    if (length == 0) {
+      start = first;
+    }
+    length += r->head;
+    if (length > bestLength) {
+      best = start;
+      bestLength = length;
+    }
+    if (r->head == entries) {
+      continue;
+    }
+    if (r->longest > bestLength) {
+      best = r->start;
+      bestLength = r->longest;
+    }
+    start = first + entries - r->tail;
+    length = r->tail;
+  }
+  if (bestLength < clusters) {
+    return -1;
+  }
+  if (best == 1 || bestLength / 2 < clusters) {
+    return best;
+  }
+  return best + bestLength / 2;
+}
+
+// HELPER FUNCTION - finds the first run of @clusters free clusters, searching
+// from the last allocation. Returns its first cluster, or -1 if there is none
+static int find_freeRun(size_t clusters)
+{
+  if (numFreeKnown && numFree < numReserved + clusters) {
+    return -1;
+  }
+  size_t length = 0;
+  for (uint32_t n = 1; n < numClusters; n++) {
+    uint32_t i = freeHint + n - 1;
+    if (i >= numClusters) {
+      i -= numClusters - 1;
+    }
+    // Runs don't wrap around the end of the FAT
+    if (i == 1) {
+      length = 0;
+    }
+    length = fat_get(i) == 0 ? length + 1 : 0;
+    if (length == clusters) {
+      return i + 1 - clusters;
+    }
+  }
+  return -1;
+}
+
+// HELPER FUNCTION - finds index of file in root directory given its name
+static int find_rootDIndex(const char *filename)
+{
+  for (int i = 0; i < FS_FILE_MAX_COUNT; i += record_slots(&rootD[i])) {
+    if (rootD[i].fileName[0] != '\0' &&
+        !strncmp((char*)rootD[i].fileName, filename, FS_FILENAME_LEN)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// HELPER FUNCTION - hashes a file name(FNV-1a) to pick its directory bucket
+static uint32_t name_hash(const char *name)
+{
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < FILENAME_SIZE && name[i] != '\0'; i++) {
+    hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+  }
+  return hash;
+}
+
+// HELPER FUNCTION - writes @slots entries of record @ent to directory slots
+// starting at @loc
+static int entry_write_slots(const struct dirLoc *loc, const struct root *ent,
+                             int slots)
+{
+  if (loc->block == 0) {
+    if (ent != &rootD[loc->slot]) {
+      memcpy(&rootD[loc->slot], ent, slots * sizeof(struct root));
+    }
+    return 0;
+  }
+  struct root bucket[DIR_ENTRIES_PER_BLOCK] BLOCK_ALIGNED;
+  if (block_read(loc->block, bucket)) {
+    return -1;
+  }
+  memcpy(&bucket[loc->slot], ent, slots * sizeof(struct root));
+  return block_write(loc->block, bucket);
+}
+
+// HELPER FUNCTION - writes record @ent as directory entry stored at @loc
+static int entry_write(const struct dirLoc *loc, const struct root *ent)
+{
+  return entry_write_slots(loc, ent, record_slots(ent));
+}
+
+// HELPER FUNCTION - finds disk block holding block #@k of file of @ent
+// Returns -1 if the file's chain is shorter than that
+static int file_block(const struct root *ent, size_t k)
+{
+  uint32_t FATIndex = ent->firstIndex;
+  for (size_t i = k / superB->clusterBlocks; i > 0; i--) {
+    if (FATIndex == FAT_EOC) {
+      return -1;
+    }
+    FATIndex = fat_get(FATIndex);
+  }
+  if (FATIndex == FAT_EOC) {
+    return -1;
+  }
+  return cluster_block(FATIndex) + k % superB->clusterBlocks;
+}
+
+// HELPER FUNCTION - builds the extent map of open file @file, walking its
+// chain twice: to count runs of contiguous clusters, then to fill them in. A
+// map read from the file's entry, or built before its chain grew, is extended
+// from its last cluster on. Returns -1 if out of memory
+static int extent_load(struct openFile *file)
+{
+  size_t known = file->numExtents, pos = 0;
+  uint32_t start = file->ent->firstIndex, last = FAT_EOC;
+  if (known) {
+    const struct extent *e = &file->extents[known - 1];
+    last = e->first + e->count - 1;
+    start = fat_get(last);
+    pos = e->pos + e->count;
+    if (start == FAT_EOC) {
+      return 0;
+    }
+  }
+
+  size_t numExtents = known;
+  for (uint32_t i = start, prev = last; i != FAT_EOC;
+       prev = i, i = fat_get(i)) {
+    numExtents += i != prev + 1;
+  }
+  struct extent *extents = io_alloc(numExtents * sizeof(struct extent));
+  if (!extents) {
+    return -1;
+  }
+  if (known) {
+    memcpy(extents, file->extents, known * sizeof(struct extent));
+  }
+
+  size_t n = known;
+  for (uint32_t i = start, prev = last; i != FAT_EOC;
+       prev = i, i = fat_get(i), pos++) {
+    if (i != prev + 1) {
+      extents[n].pos = pos;
+      extents[n].first = i;
+      extents[n++].count = 0;
+    }
+    extents[n - 1].count++;
+  }
+  free(file->extents);
+  file->extents = extents;
+  file->numExtents = n;
+  return 0;
+}
+
+// HELPER FUNCTION - returns index in the extent map of open file @file of the
+// last extent starting at or before cluster #@pos of its chain
+static size_t extent_find(const struct openFile *file, size_t pos)
+{
+  size_t lo = 0, hi = file->numExtents;
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (file->extents[mid].pos <= pos) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+// HELPER FUNCTION - moves the cursor of fd onto cluster #@target of its chain,
+// or onto the last cluster the extent map knows before it, if walking the
+// chain there would take more than EXTENT_WALK clusters. The map is read from
+// the file's entry or built on first need, & found by binary search
+static void extent_seek(int fdIndex, size_t target)
+{
+  struct fileDesc *fd = &fds[fdIndex];
+  struct openFile *file = &files[fd->file];
+  bool fromCursor = fd->curFAT != FAT_EOC && fd->curBlock <= target;
+  size_t walk = fromCursor ? target - fd->curBlock : target;
+  if (walk <= EXTENT_WALK || file->ent->firstIndex == FAT_EOC ||
+      (!file->extents && extent_load(file))) {
+    return;
+  }
+
+  const struct extent *e = &file->extents[extent_find(file, target)];
+  size_t off = target - e->pos < e->count ? target - e->pos : e->count - 1;
+  // Past the map, the cursor may be closer already
+  if (fromCursor && fd->curBlock > e->pos + off) {
+    return;
+  }
+  fd->curBlock = e->pos + off;
+  fd->curFAT = e->first + off;
+}
+
+// HELPER FUNCTION - forgets where clusters of the chain of open file #@file
+// are, once some of them moved: cursors of its fds & its extent map
+static void chain_moved(int file)
+{
+  for (int i = 0; i < FS_OPEN_MAX_COUNT; i++) {
+    if (fds[i].ID != -1 && fds[i].file == file) {
+      fds[i].curFAT = FAT_EOC;
+    }
+  }
+  free(files[file].extents);
+  files[file].extents = NULL;
+  files[file].numExtents = 0;
+}
+
+// HELPER FUNCTION - appends free clusters to file of @ent until its chain is
+// @clusters long. Returns -1 if the disk runs out of space
+static int chain_grow(struct root *ent, size_t clusters)
+{
+  uint32_t last = FAT_EOC;
+  size_t length = 0;
+  for (uint32_t i = ent->firstIndex; i != FAT_EOC; i = fat_get(i)) {
+    last = i;
+    length++;
+  }
+
+  for (; length < clusters; length++) {
+    int newIndex = find_freeFAT();
+    if (newIndex == -1) {
+      return -1;
+    }
+    fat_set(newIndex, FAT_EOC);
+    if (last == FAT_EOC) {
+      ent->firstIndex = newIndex;
+    } else {
+      fat_set(last, newIndex);
+    }
+    last = newIndex;
+  }
+  return 0;
+}
+
+// HELPER FUNCTION - frees every cluster of the chain starting at @first
+// A chain shared with clones is only freed up to where they meet
+static void chain_free(uint32_t first)
+{
+  uint32_t ind = first;
+  while(ind != FAT_EOC) {
+    uint32_t refs = ref_get(ind);
+    if (refs) {
+      ref_set(ind, refs - 1);
+      break;
+    }
+    uint32_t ind2 = fat_get(ind);
+    fat_set(ind, 0);
+    ind = ind2;
+  }
+}
+
+// HELPER FUNCTION - checks the slots following the entry of open file @file,
+// in rootD or in its bucket. Returns 1 if a whole record fits there, 0 if not,
+// -1 if the bucket can't be read
+static int record_room(const struct openFile *file)
+{
+  struct root bucket[DIR_ENTRIES_PER_BLOCK] BLOCK_ALIGNED;
+  const struct root *slots = rootD;
+  int numSlots = FS_FILE_MAX_COUNT;
+  if (file->loc.block != 0) {
+    if (block_read(file->loc.block, bucket)) {
+      return -1;
+    }
+    slots = bucket;
+    numSlots = DIR_ENTRIES_PER_BLOCK;
+  }
+  for (int i = 1; i < RECORD_SLOTS; i++) {
+    if (file->loc.slot + i >= numSlots ||
+        slots[file->loc.slot + i].fileName[0] != '\0') {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// HELPER FUNCTION - reads the extent list kept in the entry of open file @file
+// into its extent map, so that seeking far doesn't walk its chain. A list
+// out of date, or not matching the disk's geometry, is left alone
+static void extents_read(struct openFile *file)
+{
+  const struct root *ent = file->ent;
+  const struct extentHeader *header = (const struct extentHeader*)(ent + 1);
+  if (!(ent->flags & ROOT_FLAG_EXTENTS) || header->numRuns == 0 ||
+      ent->firstIndex == FAT_EOC) {
+    return;
+  }
+
+  // Past what the record holds, runs are in the overflow cluster
+  const struct extentRun *runs = (const struct extentRun*)(header + 1);
+  char *overflow = NULL;
+  if (header->numRuns > EXTENT_INLINE_RUNS) {
+    size_t blocks = (header->numRuns * sizeof(struct extentRun) +
+                     BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (header->overflow == 0 || header->overflow >= numClusters ||
+        blocks > superB->clusterBlocks ||
+        !(overflow = io_alloc(blocks * BLOCK_SIZE))) {
+      return;
+    }
+    if (data_read_blocks(cluster_block(header->overflow), blocks, overflow)) {
+      free(overflow);
+      return;
+    }
+    runs = (const struct extentRun*)overflow;
+  }
+
+  struct extent *extents = io_alloc(header->numRuns * sizeof(struct extent));
+  size_t pos = 0;
+  for (uint32_t i = 0; extents && i < header->numRuns; i++) {
+    if (runs[i].first == 0 || runs[i].count == 0 ||
+        runs[i].first >= numClusters ||
+        runs[i].count > numClusters - runs[i].first) {
+      free(extents);
+      extents = NULL;
+      break;
+    }
+    extents[i].pos = pos;
+    extents[i].first = runs[i].first;
+    extents[i].count = runs[i].count;
+    pos += runs[i].count;
+  }
+  free(overflow);
+  if (extents && extents[0].first != ent->firstIndex) {
+    free(extents);
+    extents = NULL;
+  }
+  file->extents = extents;
+  file->numExtents = extents ? header->numRuns : 0;
+}
+
+// HELPER FUNCTION - marks the extent list of file of fd out of date before its
+// chain changes. The entry is written through, so that a list on disk never
+// describes a chain other than the file's
+static void extents_stale(int fdIndex)
+{
+  struct openFile *file = &files[fds[fdIndex].file];
+  struct extentHeader *header = (struct extentHeader*)(file->ent + 1);
+  if (!(file->ent->flags & ROOT_FLAG_EXTENTS) || header->numRuns == 0) {
+    return;
+  }
+  header->numRuns = 0;
+  entry_write(&file->loc, file->ent);
+  if (file->loc.block == 0) {
+    block_write(superB->rootIndex, rootD);
+  }
+}
+
+// HELPER FUNCTION - drops the extent list of open file @file, freeing its
+// overflow cluster & the slots it took after the entry
+static void extents_drop(struct openFile *file)
+{
+  struct root *ent = file->ent;
+  const struct extentHeader *header = (const struct extentHeader*)(ent + 1);
+  if (!(ent->flags & ROOT_FLAG_EXTENTS)) {
+    return;
+  }
+  if (header->overflow) {
+    chain_free(header->overflow);
+  }
+  ent->flags &= ~ROOT_FLAG_EXTENTS;
+  memset(ent + 1, 0, INLINE_MAX_BYTES);
+  entry_write_slots(&file->loc, ent, RECORD_SLOTS);
+}
+
+// HELPER FUNCTION - keeps the extent map of open file @file in its entry, as
+// its last fd is closed. Lists too long for the record go to an overflow
+// cluster, & lists too long for that are dropped. A file whose record has no
+// room left after it keeps none
+static void extents_store(struct openFile *file)
+{
+  struct root *ent = file->ent;
+  struct extentHeader *header = (struct extentHeader*)(ent + 1);
+  if (!(superB->features & FEATURE_EXTENTS) ||
+      (ent->flags & (ROOT_FLAG_INLINE | ROOT_FLAG_SPARSE)) ||
+      ((ent->flags & ROOT_FLAG_EXTENTS) && header->numRuns != 0)) {
+    return;
+  }
+  if (ent->firstIndex == FAT_EOC || extent_load(file) ||
+      file->numExtents > clusterSize / sizeof(struct extentRun)) {
+    extents_drop(file);
+    return;
+  }
+  if (!(ent->flags & ROOT_FLAG_EXTENTS) && record_room(file) != 1) {
+    return;
+  }
+
+  // The overflow cluster is kept while the list needs one
+  uint32_t overflow = ent->flags & ROOT_FLAG_EXTENTS ? header->overflow : 0;
+  size_t numRuns = file->numExtents;
+  if (numRuns <= EXTENT_INLINE_RUNS && overflow) {
+    chain_free(overflow);
+    overflow = 0;
+  }
+  if (numRuns > EXTENT_INLINE_RUNS && !overflow) {
+    int newIndex = find_freeFAT();
+    if (newIndex == -1) {
+      extents_drop(file);
+      return;
+    }
+    fat_set(newIndex, FAT_EOC);
+    overflow = newIndex;
+  }
+
+  struct extentRun *runs = (struct extentRun*)(header + 1);
+  char *buf = NULL;
+  size_t blocks = 0;
+  if (overflow) {
+    blocks = (numRuns * sizeof(struct extentRun) + BLOCK_SIZE - 1) /
+      BLOCK_SIZE;
+    if (!(buf = io_alloc(blocks * BLOCK_SIZE))) {
+      chain_free(overflow);
+      header->overflow = 0;
+      extents_drop(file);
+      return;
+    }
+    memset(buf, 0, blocks * BLOCK_SIZE);
+    runs = (struct extentRun*)buf;
+  }
+  for (size_t i = 0; i < numRuns; i++) {
+    runs[i].first = file->extents[i].first;
+    runs[i].count = file->extents[i].count;
+  }
+  // Runs reach the disk before the entry pointing at them
+  if (buf) {
+    int ret = data_write_blocks(cluster_block(overflow), blocks, buf);
+    free(buf);
+    if (ret) {
+      chain_free(overflow);
+      header->overflow = 0;
+      extents_drop(file);
+      return;
+    }
+    memset(header + 1, 0, EXTENT_INLINE_RUNS * sizeof(struct extentRun));
+  }
+  ent->flags |= ROOT_FLAG_EXTENTS;
+  header->overflow = overflow;
+  header->numRuns = numRuns;
+  entry_write(&file->loc, ent);
+}
+
+// HELPER FUNCTION - frees up to @clusters clusters of chains of deleted files,
+// oldest first. Like chain_free(), a chain stops where it is shared, & also at
+// a free cluster, in case its head was saved before a crash. Returns false if
+// no chain was left to free
+static bool reclaim_run(size_t clusters)
+{
+  if (!(superB->features & FEATURE_RECLAIM)) {
+    return false;
+  }
+  bool pending = false;
+  for (int r = 0; r < RECLAIM_MAX; r++) {
+    uint32_t ind = superB->reclaimIndex[r];
+    while (ind != 0 && clusters > 0) {
+      uint32_t next = ind < numClusters ? fat_get(ind) : 0;
+      uint32_t refs = next ? ref_get(ind) : 0;
+      if (refs) {
+        ref_set(ind, refs - 1);
+        next = 0;
+      } else if (next) {
+        fat_set(ind, 0);
+        numReclaimed++;
+        clusters--;
+      }
+      ind = next == FAT_EOC ? 0 : next;
+    }
+    superB->reclaimIndex[r] = ind;
+    pending |= ind != 0;
+  }
+  if (!pending) {
+    superB->features &= ~FEATURE_RECLAIM;
+  }
+  return true;
+}
+
+// HELPER FUNCTION - hands the chain starting at @first to the reclaimer, which
+// frees it in the background of later operations. Chains are freed right away
+// on 16-bit images, which have nowhere to keep them. Without a free pending
+// slot, the oldest chains are freed until one is
+static void reclaim_add(uint32_t first)
+{
+  if (fat16) {
+    chain_free(first);
+    return;
+  }
+  while (first != FAT_EOC) {
+    for (int r = 0; r < RECLAIM_MAX; r++) {
+      if (superB->reclaimIndex[r] == 0) {
+        superB->reclaimIndex[r] = first;
+        superB->features |= FEATURE_RECLAIM;
+        return;
+      }
+    }
+    reclaim_run(RECLAIM_BATCH);
+  }
+}
+
+// HELPER FUNCTION - frees clusters of the chain of fd past its first
+// @clusters. The walk to the new last cluster resumes from the fd's cursor,
+// & only cursors past it are forgotten, along with the file's extent map
+static void chain_truncate(int fdIndex, size_t clusters)
+{
+  struct fileDesc *desc = &fds[fdIndex];
+  struct openFile *file = &files[desc->file];
+  struct root *ent = file->ent;
+  uint32_t last = FAT_EOC;
+  if (ent->firstIndex == FAT_EOC) {
+    return;
+  }
+  if (clusters == 0) {
+    chain_free(ent->firstIndex);
+    ent->firstIndex = FAT_EOC;
+  } else {
+    last = ent->firstIndex;
+    size_t i = 1;
+    if (desc->curFAT != FAT_EOC && desc->curBlock < clusters) {
+      last = desc->curFAT;
+      i = desc->curBlock + 1;
+    }
+    for (; i < clusters && last != FAT_EOC; i++) {
+      last = fat_get(last);
+    }
+    if (last == FAT_EOC || fat_get(last) == FAT_EOC) {
+      return;
+    }
+    chain_free(fat_get(last));
+    fat_set(last, FAT_EOC);
+  }
+
+  for (int i = 0; i < FS_OPEN_MAX_COUNT; i++) {
+    if (fds[i].ID != -1 && fds[i].file == desc->file &&
+        fds[i].curBlock >= clusters) {
+      fds[i].curFAT = FAT_EOC;
+    }
+  }
+  free(file->extents);
+  file->extents = NULL;
+  file->numExtents = 0;
+  // Clusters known not to be shared end with the chain at most
+  if (file->cowPrivate > clusters) {
+    file->cowPrivate = clusters;
+    file->cowLast = last;
+  }
+}
+
+// HELPER FUNCTION - adds a zeroed reference count table to the image, on its
+// first clone. Returns -1 if the disk runs out of space
+static int ref_create(void)
+{
+  if (refBlocks) {
+    return 0;
+  }
+  size_t blocks = (numClusters + REFS_PER_BLOCK - 1) / REFS_PER_BLOCK;
+  struct root table = { .firstIndex = FAT_EOC };
+  char *zero = pool_get();
+  if (!zero || chain_grow(&table, (blocks + superB->clusterBlocks - 1) /
+                          superB->clusterBlocks) ||
+      ref_load(table.firstIndex)) {
+    chain_free(table.firstIndex);
+    if (zero) {
+      pool_put(zero);
+    }
+    return -1;
+  }
+
+  memset(zero, 0, BLOCK_SIZE);
+  for (size_t b = 0; b < numRefBlocks; b++) {
+    block_write(refBlocks[b], zero);
+  }
+  pool_put(zero);
+  superB->refIndex = table.firstIndex;
+  superB->features |= FEATURE_CLONE;
+  return 0;
+}
+
+// HELPER FUNCTION - adds a changed block bitmap to the image, on its first
+// checkpoint, & starts tracking. Returns -1 if the disk runs out of space
+static int cbt_create(void)
+{
+  if (cbtMap) {
+    return 0;
+  }
+  size_t blocks = (superB->numBlocks + CBT_BITS_PER_BLOCK - 1) /
+    CBT_BITS_PER_BLOCK;
+  struct root table = { .firstIndex = FAT_EOC };
+  if (chain_grow(&table, (blocks + superB->clusterBlocks - 1) /
+                 superB->clusterBlocks) ||
+      cbt_load(table.firstIndex, false)) {
+    chain_free(table.firstIndex);
+    return -1;
+  }
+
+  // The whole bitmap gets written, cleared
+  memset(cbtDirty, true, numCbtBlocks * sizeof(bool));
+  superB->cbtIndex = table.firstIndex;
+  superB->cbtGen = 0;
+  superB->features |= FEATURE_CBT;
+  if (cbt_start()) {
+    cbt_free();
+    chain_free(table.firstIndex);
+    superB->features &= ~FEATURE_CBT;
+    return -1;
+  }
+  return 0;
+}
+
+// HELPER FUNCTION - copies data blocks of cluster @src into cluster @dst
+static int cluster_copy(uint32_t dst, uint32_t src)
+{
+  char *buf = pool_get();
+  if (!buf) {
+    return -1;
+  }
+  int ret = 0;
+  for (size_t b = 0; b < superB->clusterBlocks && !ret; b++) {
+    if (block_read(cluster_block(src) + b, buf) ||
+        block_write(cluster_block(dst) + b, buf)) {
+      ret = -1;
+    }
+  }
+  pool_put(buf);
+  return ret;
+}
+
+// HELPER FUNCTION - makes the first @clusters clusters of the chain of fd its
+// own, before they are written. The first cluster shared with a clone, & all
+// those after it up to the last of them, are replaced by copies. The rest of
+// the shared chain gets one more reference, from the last copy. Returns -1 if
+// the disk runs out of space, copies made until then are kept
+static int cow_prepare(int fdIndex, size_t clusters)
+{
+  struct openFile *file = &files[fds[fdIndex].file];
+  if (!refBlocks || file->cowPrivate >= clusters) {
+    return 0;
+  }
+
+  struct root *ent = file->ent;
+  uint32_t last = file->cowPrivate ? file->cowLast : FAT_EOC;
+  uint32_t cur = last == FAT_EOC ? ent->firstIndex : fat_get(last);
+  bool copying = false;
+  int ret = 0;
+  while (file->cowPrivate < clusters && cur != FAT_EOC) {
+    if (copying || ref_get(cur)) {
+      int copy = find_freeFAT();
+      if (copy == -1 || cluster_copy(copy, cur)) {
+        ret = -1;
+        break;
+      }
+      fat_set(copy, FAT_EOC);
+      // The chain stops referencing the shared cluster it ran into
+      if (!copying) {
+        ref_set(cur, ref_get(cur) - 1);
+        copying = true;
+      }
+      if (last == FAT_EOC) {
+        ent->firstIndex = copy;
+      } else {
+        fat_set(last, copy);
+      }
+      last = copy;
+    } else {
+      last = cur;
+    }
+    cur = fat_get(cur);
+    file->cowPrivate++;
+  }
+  file->cowLast = last;
+
+  if (copying) {
+    fat_set(last, cur);
+    if (cur != FAT_EOC) {
+      ref_set(cur, ref_get(cur) + 1);
+    }
+    // Cursors of fds of the file may be on clusters replaced
+    chain_moved(fds[fdIndex].file);
+  }
+  return ret;
+}
+
+// HELPER FUNCTION - hashes the content of cluster @i into @h, reading it block
+// by block into @buf. Returns -1 if it can't be read
+static int cluster_hash(uint32_t i, char *buf, uint64_t *h)
+{
+  *h = 0;
+  for (size_t b = 0; b < superB->clusterBlocks; b++) {
+    if (block_read(cluster_block(i) + b, buf)) {
+      return -1;
+    }
+    *h = dedup_hash(*h, buf, BLOCK_SIZE);
+  }
+  return 0;
+}
+
+// HELPER FUNCTION - compares the chains starting at clusters @a & @b, reading
+// them into @bufA & @bufB. Returns true if they hold the same data up to the
+// same end. # of identical clusters they start with goes to @same
+static bool chain_same(uint32_t a, uint32_t b, char *bufA, char *bufB,
+                       size_t *same)
+{
+  for (*same = 0; a != FAT_EOC && b != FAT_EOC; (*same)++) {
+    if (a == b) {
+      return true;
+    }
+    for (size_t k = 0; k < superB->clusterBlocks; k++) {
+      if (block_read(cluster_block(a) + k, bufA) ||
+          block_read(cluster_block(b) + k, bufB) ||
+          memcmp(bufA, bufB, BLOCK_SIZE)) {
+        return false;
+      }
+    }
+    a = fat_get(a);
+    b = fat_get(b);
+  }
+  return a == b;
+}
+
+// HELPER FUNCTION - flushes write-back buffers of fds other than fd whose
+// file's chain runs into the one from cluster @i: the data they hold must be
+// compared as it will be on disk, & land in clusters that are still private.
+// Chains that meet share their end, so only last clusters are compared
+static void wbuf_flush_chain(int fdIndex, uint32_t i)
+{
+  uint32_t last = FAT_EOC;
+  for (int f = 0; f < FS_OPEN_MAX_COUNT; f++) {
+    if (f == fdIndex || fds[f].ID == -1 || fds[f].wbufLen == 0) {
+      continue;
+    }
+    if (last == FAT_EOC) {
+      last = i;
+      while (fat_get(last) != FAT_EOC) {
+        last = fat_get(last);
+      }
+    }
+    // Appenders have their cursor close to the end of the chain
+    uint32_t end = fds[f].curFAT != FAT_EOC ? fds[f].curFAT :
+      fd_entry(f)->firstIndex;
+    while (end != FAT_EOC && fat_get(end) != FAT_EOC) {
+      end = fat_get(end);
+    }
+    if (end == last) {
+      wbuf_flush(f);
+      last = FAT_EOC;
+    }
+  }
+}
+
+// HELPER FUNCTION - dedup pass of the file of fd, on its last close: hashes
+// the clusters written since the last pass, & links the chain to the first
+// cluster another file holds the same data from up to its end, freeing the
+// file's own copy. Clusters with one successor each only share chain ends, so
+// clusters are looked up by content & distance to the end together
+static void dedup_file(int fdIndex)
+{
+  struct openFile *file = &files[fds[fdIndex].file];
+  struct root *ent = file->ent;
+  size_t from = file->dedupFrom;
+  file->dedupFrom = SIZE_MAX;
+  if (!dedupBuckets || from == SIZE_MAX ||
+      (ent->flags & (ROOT_FLAG_INLINE | ROOT_FLAG_COMPRESSED))) {
+    return;
+  }
+  bool hole;
+  size_t run;
+  from = file_pos(ent, from, &hole, &run);
+  char *a = pool_get();
+  char *b = pool_get();
+  if (!a || !b) {
+    pool_put(a);
+    pool_put(b);
+    return;
+  }
+  // Clusters before the ones written are indexed again only if the chain grew,
+  // & those known different from the candidate before are skipped
+  size_t length = 0;
+  for (uint32_t i = ent->firstIndex; i != FAT_EOC; i = fat_get(i)) {
+    length++;
+  }
+  size_t skip = 0;
+  uint32_t prev = FAT_EOC;
+  size_t k = 0;
+  for (uint32_t cur = ent->firstIndex; cur != FAT_EOC && !ref_get(cur);
+       prev = cur, cur = fat_get(cur), k++) {
+    uint64_t h = dedupHash[cur];
+    if (k < from) {
+      if (h) {
+        dedup_insert(cur, h, length - k);
+      }
+      continue;
+    }
+    if (cluster_hash(cur, a, &h)) {
+      break;
+    }
+    // A few candidates are compared, the same content being often found at
+    // the same distance from the end of chains that differ after
+    uint64_t key = dedup_key(h, length - k);
+    uint32_t match = 0;
+    size_t same = 0, differ = 0;
+    bool found = false;
+    for (int tries = 0; tries < DEDUP_TRIES && !skip && !found; tries++) {
+      match = dedup_find(key, cur, match);
+      if (!match) {
+        break;
+      }
+      wbuf_flush_chain(fdIndex, match);
+      found = chain_same(cur, match, a, b, &same);
+      differ = !found && same > differ ? same : differ;
+    }
+    skip = skip ? skip - 1 : differ;
+    if (found && ref_get(match) < UINT32_MAX && !ref_create()) {
+      if (prev == FAT_EOC) {
+        ent->firstIndex = match;
+      } else {
+        fat_set(prev, match);
+      }
+      ref_set(match, ref_get(match) + 1);
+      chain_free(cur);
+      numDeduped += same;
+      // Chains of open files may run into the clusters shared now, & cursors
+      // of the file's fds onto clusters freed
+      for (int i = 0; i < FS_OPEN_MAX_COUNT; i++) {
+        files[i].cowPrivate = 0;
+      }
+      chain_moved(fds[fdIndex].file);
+      break;
+    }
+    dedup_insert(cur, h, length - k);
+  }
+  pool_put(a);
+  pool_put(b);
+}
+
+// HELPER FUNCTION - writes cached entries of open files back to their
+// directory block. Only files in directory starting at @dirFirst, or all
+// files if @dirFirst is FAT_EOC
+static void files_sync(uint32_t dirFirst)
+{
+  for (int i = 0; i < FS_OPEN_MAX_COUNT; i++) {
+    if (files[i].refs && files[i].loc.block != 0 &&
+        (dirFirst == FAT_EOC || files[i].parentFirst == dirFirst)) {
+      entry_write(&files[i].loc, files[i].ent);
+    }
+  }
+}
+
+// HELPER FUNCTION - finds entry named @name in directory @d
+// Fills its location & a copy of its record(up to RECORD_SLOTS entries),
+// returns -1 if there is no such entry
+static int dir_find(const struct dir *d, const char *name, struct dirLoc *loc,
+                    struct root *ent)
+{
+  if (d->isRoot) {
+    int i = find_rootDIndex(name);
+    if (i == -1) {
+      return -1;
+    }
+    loc->block = 0;
+    loc->slot = i;
+    memcpy(ent, &rootD[i], record_slots(&rootD[i]) * sizeof(struct root));
+    return 0;
+  }
+
+  // Hashed directory: the entry can only be in one bucket(one block read, or
+  // none from the disk's mapping)
+  size_t numBuckets = d->ent.size / BLOCK_SIZE;
+  int block = file_block(&d->ent, name_hash(name) & (numBuckets - 1));
+  struct root bucketBuffer[DIR_ENTRIES_PER_BLOCK] BLOCK_ALIGNED;
+  const struct root *bucket = bucketBuffer;
+  if (block == -1) {
+    return -1;
+  }
+  if (diskMap) {
+    bucket = (const struct root*)(diskMap + (size_t)block * BLOCK_SIZE);
+  } else if (block_read(block, bucketBuffer)) {
+    return -1;
+  }
+  for (size_t i = 0; i < DIR_ENTRIES_PER_BLOCK; i += record_slots(&bucket[i])) {
+    if (bucket[i].fileName[0] != '\0' &&
+        !strncmp((char*)bucket[i].fileName, name, FS_FILENAME_LEN)) {
+      loc->block = block;
+      loc->slot = i;
+      memcpy(ent, &bucket[i], record_slots(&bucket[i]) * sizeof(struct root));
+      return 0;
+    }
+  }
+  return -1;
+}
+
+// HELPER FUNCTION - doubles the # of buckets of hashed directory @d
+// Bucket i is split between buckets i and i + old # of buckets
+static int dir_grow(struct dir *d)
+{
+  size_t numBuckets = d->ent.size / BLOCK_SIZE;
+  if (numBuckets >= DIR_MAX_BUCKETS) {
+    return -1;
+  }
+  size_t clusters = (2 * numBuckets + superB->clusterBlocks - 1) /
+    superB->clusterBlocks;
+  if (chain_grow(&d->ent, clusters)) {
+    return -1;
+  }
+
+  // Entries of open files must be on disk before they get moved around
+  files_sync(d->ent.firstIndex);
+
+  struct root bucket[DIR_ENTRIES_PER_BLOCK] BLOCK_ALIGNED;
+  struct root low[DIR_ENTRIES_PER_BLOCK] BLOCK_ALIGNED;
+  struct root high[DIR_ENTRIES_PER_BLOCK] BLOCK_ALIGNED;
+  for (size_t b = 0; b < numBuckets; b++) {
+    int lowBlock = file_block(&d->ent, b);
+    int highBlock = file_block(&d->ent, b + numBuckets);
+    if (block_read(lowBlock, bucket)) {
+      return -1;
+    }
+    memset(low, 0, sizeof(low));
+    memset(high, 0, sizeof(high));
+    size_t numLow = 0, numHigh = 0;
+    for (size_t i = 0; i < DIR_ENTRIES_PER_BLOCK; i += record_slots(&bucket[i])) {
+      if (bucket[i].fileName[0] == '\0') {
+        continue;
+      }
+      // Records move as a whole, which always fits as both halves are packed
+      size_t slots = record_slots(&bucket[i]);
+      if (name_hash((char*)bucket[i].fileName) & numBuckets) {
+        memcpy(&high[numHigh], &bucket[i], slots * sizeof(struct root));
+        numHigh += slots;
+      } else {
+        memcpy(&low[numLow], &bucket[i], slots * sizeof(struct root));
+        numLow += slots;
+      }
+    }
+    block_write(lowBlock, low);
+    block_write(highBlock, high);
+  }
+
+  d->ent.size = 2 * numBuckets * BLOCK_SIZE;
+  entry_write(&d->loc, &d->ent);
+
+  // Open files of this directory may have moved to another bucket
+  for (int i = 0; i < FS_OPEN_MAX_COUNT; i++) {
+    if (files[i].refs && files[i].loc.block != 0 &&
+        files[i].parentFirst == d->ent.firstIndex) {
+      struct root ent[RECORD_SLOTS];
+      dir_find(d, (char*)files[i].ent->fileName, &files[i].loc, ent);
+    }
+  }
+  return 0;
+}
+
+// HELPER FUNCTION - finds @need free slots in a row among @numSlots directory
+// slots. Prefers a slot followed by room for inline data, so the file can
+// later become inline. Slots right after an empty file are left for its own
+// inline data, unless no other slot is free. Returns -1 if all slots are taken
+static int find_freeSlot(const struct root *slots, int numSlots, int need)
+{
+  // First fitting slot, & first ones among slots left for inline data, with
+  // room for a whole record or not
+  int found = -1, foundTaken = -1, foundTakenRecord = -1;
+  int spare = -1;
+  for (int i = 0; i < numSlots; i += record_slots(&slots[i])) {
+    if (slots[i].fileName[0] != '\0') {
+      // An empty file may still claim the slots after it to go inline
+      const struct root *ent = &slots[i];
+      spare = record_slots(ent) == 1 && !(ent->flags & ROOT_FLAG_DIR) &&
+        ent->size == 0 && ent->firstIndex == FAT_EOC ? i : -1;
+      continue;
+    }
+    int free = 1;
+    while (free < RECORD_SLOTS && i + free < numSlots &&
+           slots[i + free].fileName[0] == '\0') {
+      free++;
+    }
+    bool taken = spare != -1 && i - spare <= INLINE_SLOTS;
+    if (!taken && free == RECORD_SLOTS) {
+      return i;
+    }
+    if (free < need) {
+      continue;
+    }
+    if (!taken && found == -1) {
+      found = i;
+    } else if (taken && free == RECORD_SLOTS && foundTakenRecord == -1) {
+      foundTakenRecord = i;
+    } else if (taken && foundTaken == -1) {
+      foundTaken = i;
+    }
+  }
+  if (found != -1) {
+    return found;
+  }
+  return foundTakenRecord != -1 ? foundTakenRecord : foundTaken;
+}
+
+// HELPER FUNCTION - adds entry @ent to directory @d & fills its location
+// Returns -1 if the directory is full
+static int dir_insert(struct dir *d, const struct root *ent,
+                      struct dirLoc *loc)
+{
+  if (d->isRoot) {
+    // Find empty entry in root directory
+    int i = find_freeSlot(rootD, FS_FILE_MAX_COUNT, record_slots(ent));
+    if (i == -1) {
+      return -1;
+    }
+    memcpy(&rootD[i], ent, record_slots(ent) * sizeof(struct root));
+    loc->block = 0;
+    loc->slot = i;
+    return 0;
+  }
+
+  // Hashed directory: double the buckets until the entry's bucket has room
+  struct root bucket[DIR_ENTRIES_PER_BLOCK] BLOCK_ALIGNED;
+  while (1) {
+    size_t numBuckets = d->ent.size / BLOCK_SIZE;
+    int block = file_block(&d->ent, name_hash((char*)ent->fileName) &
+                           (numBuckets - 1));
+    if (block == -1 || block_read(block, bucket)) {
+      return -1;
+    }
+    int i = find_freeSlot(bucket, DIR_ENTRIES_PER_BLOCK, record_slots(ent));
+    if (i != -1) {
+      memcpy(&bucket[i], ent, record_slots(ent) * sizeof(struct root));
+      loc->block = block;
+      loc->slot = i;
+      return block_write(block, bucket);
+    }
+    if (dir_grow(d)) {
+      return -1;
+    }
+  }
+}
+
+// HELPER FUNCTION - true if hashed directory of @ent has no entries
+static bool dir_empty(const struct root *ent)
+{
+  struct root bucket[DIR_ENTRIES_PER_BLOCK] BLOCK_ALIGNED;
+  for (size_t b = 0; b < ent->size / BLOCK_SIZE; b++) {
+    if (block_read(file_block(ent, b), bucket)) {
+      return false;
+    }
+    for (size_t i = 0; i < DIR_ENTRIES_PER_BLOCK; i++) {
+      if (bucket[i].fileName[0] != '\0') {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// HELPER FUNCTION - resolves every component of @path but the last one
+// Fills directory @parent holding the last component, & copies the last
+// component into @name. Returns -1 if @path is invalid, or if a directory
+// along the way doesn't exist
+static int path_resolve(const char *path, struct dir *parent,
+                        char name[FILENAME_SIZE])
+{
+  if (!path) {
+    return -1;
+  }
+  if (path[0] == '/') {
+    path++;
+  }
+
+  memset(parent, 0, sizeof(struct dir));
+  parent->isRoot = true;
+  while (1) {
+    // Split next component off the path
+    const char *slash = strchr(path, '/');
+    size_t len = slash ? (size_t)(slash - path) : strlen(path);
+    if (len == 0 || len >= FS_FILENAME_LEN) {
+      return -1;
+    }
+    memset(name, 0, FILENAME_SIZE);
+    memcpy(name, path, len);
+    if (!slash) {
+      return 0;
+    }
+
+    // Intermediate component must be a directory, only 32-bit disks have them
+    struct dir child;
+    struct root rec[RECORD_SLOTS];
+    memset(&child, 0, sizeof(struct dir));
+    if (fat16 || dir_find(parent, name, &child.loc, rec) ||
+        !(rec->flags & ROOT_FLAG_DIR)) {
+      return -1;
+    }
+    child.ent = *rec;
+    *parent = child;
+    path = slash + 1;
+  }
+}
+
+int fs_create(const char *filename)
+{
+	/* TODO: Phase 2 */
+  // ERROR CHECKING
+  // No filesystem mounted or mounted read-only, or null filename
+  if (!FS || readOnly || !filename) {
+		return -1;
+	}
+
+  // Resolve directory to create the file in, checks length of filename too
+  struct dir parent;
+  char name[FILENAME_SIZE];
+  if (path_resolve(filename, &parent, name)) {
+    return -1;
+  }
+
+  // Check if filename already exists
+  struct dirLoc loc;
+  struct root ent[RECORD_SLOTS];
+  if (!dir_find(&parent, name, &loc, ent)) {
+    return -1;
+  }
+
+  // Set new entry to new filename, & add it to the directory
+  // If no room was found, directory is full
+  memset(ent, 0, sizeof(struct root));
+  strcpy((char*)ent->fileName, name);
+  ent->size = 0;
+  ent->firstIndex = FAT_EOC;
+  if (superB->features & FEATURE_COMPRESS) {
+    ent->flags = ROOT_FLAG_COMPRESSED;
+  }
+  if (dir_insert(&parent, ent, &loc)) {
+    return -1;
+  }
+  sync_tick();
+  return 0;
+}
+
+int fs_mkdir(const char *dirname)
+{
+  // ERROR CHECKING
+  // No filesystem mounted or mounted read-only, null dirname, or 16-bit
+  // disk(no directories)
+  if (!FS || readOnly || !dirname || fat16) {
+		return -1;
+	}
+
+  // Resolve directory to create the directory in
+  struct dir parent;
+  char name[FILENAME_SIZE];
+  if (path_resolve(dirname, &parent, name)) {
+    return -1;
+  }
+
+  // Check if dirname already exists
+  struct dirLoc loc;
+  struct root ent[RECORD_SLOTS];
+  if (!dir_find(&parent, name, &loc, ent)) {
+    return -1;
+  }
+
+  // New directory starts with a single empty bucket
+  memset(ent, 0, sizeof(struct root));
+  strcpy((char*)ent->fileName, name);
+  ent->size = BLOCK_SIZE;
+  ent->firstIndex = FAT_EOC;
+  ent->flags = ROOT_FLAG_DIR;
+  struct root bucket[DIR_ENTRIES_PER_BLOCK] BLOCK_ALIGNED;
+  memset(bucket, 0, sizeof(bucket));
+  if (chain_grow(ent, 1) ||
+      block_write(cluster_block(ent->firstIndex), bucket) ||
+      dir_insert(&parent, ent, &loc)) {
+    chain_free(ent->firstIndex);
+    return -1;
+  }
+  sync_tick();
+  return 0;
+}
+
+int fs_delete(const char *filename)
+{
+	/* TODO: Phase 2 */
+  // ERROR CHECKING
+  // No filesystem mounted or mounted read-only, or NULL filename
+  if (!FS || readOnly || !filename) {
+		return -1;
+	}
+
+  // Find file in its directory
+  struct dir parent;
+  char name[FILENAME_SIZE];
+  struct dirLoc loc;
+  struct root ent[RECORD_SLOTS];
+
+  // If file isn't found, return -1
+  if (path_resolve(filename, &parent, name) ||
+      dir_find(&parent, name, &loc, ent)) {
+    return -1;
+  }
+
+  // If file is currently open, or is a non-empty directory, return -1
+  for (int i = 0; i < FS_OPEN_MAX_COUNT; i++) {
+    if (files[i].refs && files[i].loc.block == loc.block &&
+        files[i].loc.slot == loc.slot) {
+      return -1;
+    }
+  }
+  if ((ent->flags & ROOT_FLAG_DIR) && !dir_empty(ent)) {
+    return -1;
+  }
+
+  // Else, reset name(& inline data) and hand FAT data blocks to the
+  // reclaimer, so that deleting a large file doesn't wait for its chain
+  uint32_t first = ent->firstIndex;
+  int slots = record_slots(ent);
+  if (ent->flags & ROOT_FLAG_EXTENTS &&
+      ((struct extentHeader*)(ent + 1))->overflow) {
+    chain_free(((struct extentHeader*)(ent + 1))->overflow);
+  }
+  memset(ent, 0, sizeof(ent));
+  if (entry_write_slots(&loc, ent, slots)) {
+    return -1;
+  }
+  reclaim_add(first);
+
+  sync_tick();
+  return 0;
+}
+
+int fs_clone(const char *src, const char *dst)
+{
+  // ERROR CHECKING
+  // No filesystem mounted or mounted read-only, 16-bit image, or null paths
+  if (!FS || readOnly || fat16 || !src || !dst) {
+    return -1;
+  }
+
+  // Source must be a file, & the clone must not exist yet
+  struct dir srcParent, dstParent;
+  char srcName[FILENAME_SIZE], dstName[FILENAME_SIZE];
+  struct dirLoc srcLoc, dstLoc;
+  struct root ent[RECORD_SLOTS], clone[RECORD_SLOTS];
+  if (path_resolve(src, &srcParent, srcName) ||
+      dir_find(&srcParent, srcName, &srcLoc, ent) ||
+      (ent->flags & ROOT_FLAG_DIR) ||
+      path_resolve(dst, &dstParent, dstName) ||
+      !dir_find(&dstParent, dstName, &dstLoc, clone)) {
+    return -1;
+  }
+
+  // An open source is cloned as its fds see it, buffered data included. Its
+  // clusters are all shared from now on
+  for (int i = 0; i < FS_OPEN_MAX_COUNT; i++) {
+    if (files[i].refs && files[i].loc.block == srcLoc.block &&
+        files[i].loc.slot == srcLoc.slot) {
+      for (int j = 0; j < FS_OPEN_MAX_COUNT; j++) {
+        if (fds[j].ID != -1 && fds[j].file == i) {
+          wbuf_flush(j);
+        }
+      }
+      memcpy(ent, files[i].ent, record_slots(files[i].ent) *
+             sizeof(struct root));
+      files[i].cowPrivate = 0;
+    }
+  }
+
+  // Clone shares the whole chain, counted on its first cluster
+  uint32_t first = ent->firstIndex;
+  if (first != FAT_EOC && (ref_get(first) == UINT32_MAX || ref_create())) {
+    return -1;
+  }
+  memcpy(clone, ent, record_slots(ent) * sizeof(struct root));
+  memset(clone->fileName, 0, FILENAME_SIZE);
+  strcpy((char*)clone->fileName, dstName);
+  // Inline data has no cluster to share, it is written to the clone below. The
+  // extent list stays with the source, whose overflow cluster it may use
+  if (ent->flags & ROOT_FLAG_INLINE) {
+    clone->flags &= ~ROOT_FLAG_INLINE;
+    clone->size = 0;
+  }
+  clone->flags &= ~ROOT_FLAG_EXTENTS;
+  if (dir_insert(&dstParent, clone, &dstLoc)) {
+    return -1;
+  }
+  if (first != FAT_EOC) {
+    ref_set(first, ref_get(first) + 1);
+  }
+
+  if (ent->flags & ROOT_FLAG_INLINE) {
+    int fd = fs_open(dst);
+    if (fd == -1 || fs_write(fd, ent + 1, ent->size) != (int)ent->size) {
+      if (fd != -1) {
+        fs_close(fd);
+      }
+      fs_delete(dst);
+      return -1;
+    }
+    fs_close(fd);
+  }
+  sync_tick();
+  return 0;
+}
+
+int fs_ls(void)
+{
+	/* TODO: Phase 2 */
+  // ERROR CHECKING
+  // No filesystem mounted
+  if (!FS) {
+    return -1;
+  }
+
+  // Find and list non-empty files in the root directory
+  printf("FS Ls:\n");
+  for (int i = 0; i < FS_FILE_MAX_COUNT; i += record_slots(&rootD[i])) {
+    if (rootD[i].fileName[0] != '\0') {
+      printf("%s: %s, size: %llu, data_blk: %u\n",
+      rootD[i].flags & ROOT_FLAG_DIR ? "dir" : "file", rootD[i].fileName,
+      (unsigned long long)rootD[i].size,
+      fat16 && rootD[i].firstIndex == FAT_EOC ? FAT16_EOC :
+      rootD[i].firstIndex);
+    }
+  }
+  return 0;
+}
+
+int fs_readdir(struct fs_dirent *entries, size_t max, unsigned int flags)
+{
+  // ERROR CHECKING
+  // No filesystem mounted, or NULL entries to fill
+  if (!FS || (max && !entries)) {
+    return -1;
+  }
+  // Chains only hold buffered data once written back
+  if (flags & FS_READDIR_EXTENTS) {
+    for (int i = 0; i < FS_OPEN_MAX_COUNT; i++) {
+      if (fds[i].ID != -1) {
+        wbuf_flush(i);
+      }
+    }
+  }
+
+  // Fill entries of non-empty files in the root directory, as fs_ls() lists
+  // them
+  size_t count = 0;
+  for (int i = 0; i < FS_FILE_MAX_COUNT; i += record_slots(&rootD[i])) {
+    const struct root *ent = &rootD[i];
+    if (ent->fileName[0] == '\0') {
+      continue;
+    }
+    if (count < max) {
+      struct fs_dirent *d = &entries[count];
+      memcpy(d->name, ent->fileName, FS_FILENAME_LEN);
+      d->name[FS_FILENAME_LEN - 1] = '\0';
+      d->size = ent->size;
+      d->data_blk = fat16 && ent->firstIndex == FAT_EOC ? FAT16_EOC :
+        ent->firstIndex;
+      d->flags = ent->flags & ROOT_FLAG_DIR ? FS_DIRENT_DIR : 0;
+      d->extents = 0;
+      if ((flags & FS_READDIR_EXTENTS) && !(ent->flags & (ROOT_FLAG_DIR |
+          ROOT_FLAG_INLINE | ROOT_FLAG_COMPRESSED))) {
+        d->extents = entry_extents(ent, NULL, 0);
+      }
+    }
+    count++;
+  }
+  return count;
+}
+
+int fs_open(const char *filename)
+{
+	/* TODO: Phase 3 */
+  // ERROR CHECKING
+  // No filesystem mounted
+  if (!FS || !filename) {
+    return -1;
+  }
+  // FS_OPEN_MAX_COUNT amount of open files already
+  if (numOpenFiles == FS_OPEN_MAX_COUNT) {
+    return -1;
+  }
+
+  // Find the file in its directory
+  struct dir parent;
+  char name[FILENAME_SIZE];
+  struct dirLoc loc;
+  struct root ent[RECORD_SLOTS];
+
+  // If file isn't found, or is a directory, return -1
+  if (path_resolve(filename, &parent, name) ||
+      dir_find(&parent, name, &loc, ent) || (ent->flags & ROOT_FLAG_DIR)) {
+    return -1;
+  }
+
+  // Share open file if already opened through another fd, else grab a free
+  // one. Files in root point straight into rootD, others keep their own copy
+  int file = -1;
+  for (int i = 0; i < FS_OPEN_MAX_COUNT; i++) {
+    if (files[i].refs && files[i].loc.block == loc.block &&
+        files[i].loc.slot == loc.slot) {
+      file = i;
+      break;
+    }
+    if (!files[i].refs && file == -1) {
+      file = i;
+    }
+  }
+  if (!files[file].refs) {
+    files[file].loc = loc;
+    files[file].parentFirst = parent.isRoot ? FAT_EOC : parent.ent.firstIndex;
+    memcpy(files[file].entry, ent, sizeof(ent));
+    files[file].ent = loc.block ? files[file].entry : &rootD[loc.slot];
+    files[file].frames = NULL;
+    files[file].cache = NULL;
+    files[file].cowPrivate = 0;
+    files[file].dedupFrom = SIZE_MAX;
+    files[file].extents = NULL;
+    files[file].numExtents = 0;
+    extents_read(&files[file]);
+  }
+
+  // Find empty file descriptor entry
+  for (int i = 0; i < FS_OPEN_MAX_COUNT; i++) {
+    if (fds[i].ID == -1) {
+      fds[i].ID = currentID;
+      fds[i].file = file;
+      fds[i].offset = 0;
+      fds[i].curBlock = 0;
+      fds[i].curFAT = FAT_EOC;
+      fds[i].wbufLen = 0;
+      fds[i].wbufReserved = 0;
+      files[file].refs++;
+      currentID++;
+      numOpenFiles++;
+      return fds[i].ID;
+    }
+  }
+
+  // If file descriptor array is full
+  return -1;
+}
+
+// HELPER FUNCTION - finds index of fds given fds.ID
+int find_fdsIndex(int fd) {
+  // ERROR CHECKING
+  // Invalid fd(out of bounds or not currently open)
+  if (fd > currentID || fd < 0) {
+    return -1;
+  }
+
+  // Find file in fds
+  for (int i = 0; i < FS_OPEN_MAX_COUNT; i++) {
+    // If found, return index of file in fds array
+    if (fds[i].ID == fd) {
+      return i;
+    }
+  }
+
+  // If given fd is not in array of file descriptors
+  return -1;
+}
+
+int fs_close(int fd)
+{
+	/* TODO: Phase 3 */
+  // ERROR CHECKING
+  // No filesystem mounted
+  if (!FS) {
+    return -1;
+  }
+  // Invalid fd(not currently open or out of bounds)
+  if (fd < 0 || fd > currentID) {
+    return -1;
+  }
+
+  // Find given FD in fds
+  int ind = find_fdsIndex(fd);
+
+  // If given fd is not in array of file descriptors
+  if (ind == -1) {
+    return -1;
+  }
+
+  // Buffered data goes to disk before the entry
+  wbuf_flush(ind);
+  free(fds[ind].wbuf);
+  fds[ind].wbuf = NULL;
+  fds[ind].wbufSize = 0;
+
+  // Last fd on a file shares the clusters it wrote that other files hold,
+  // keeps its extent map in its entry, & writes the entry back to its
+  // directory if outside root
+  struct openFile *file = &files[fds[ind].file];
+  if (file->refs == 1) {
+    dedup_file(ind);
+    if (!readOnly) {
+      extents_store(file);
+    }
+  }
+  if (--file->refs == 0 && file->loc.block != 0 && !readOnly) {
+    entry_write(&file->loc, file->ent);
+  }
+  // Frame index of a compressed file & extent map are rebuilt on next open
+  if (file->refs == 0) {
+    free(file->frames);
+    free(file->cache);
+    free(file->extents);
+    file->frames = NULL;
+    file->cache = NULL;
+    file->extents = NULL;
+    file->numExtents = 0;
+  }
+
+  // If found, reset FD values in fds
+  fds[ind].ID = -1;
+  fds[ind].offset = 0;
+  fds[ind].file = -1;
+  numOpenFiles--;
+
+  if (syncPolicy & FS_MOUNT_SYNC_CLOSE) {
+    meta_flush();
+    if (disk_sync()) {
+      return -1;
+    }
+  }
+  sync_tick();
+  return 0;
+}
+
+int fs_stat(int fd)
+{
+	/* TODO: Phase 3 */
+  // ERROR CHECKING
+  // No filesystem mounted
+  if (!FS) {
+    return -1;
+  }
+  // Invalid fd(not currently open or out of bounds)
+  if (fd < 0 || fd > currentID) {
+    return -1;
+  }
+
+  // Find given FD in fds
+  int ind = find_fdsIndex(fd);
+
+  // If given fd is not in array of file descriptors
+  if (ind == -1) {
+    return -1;
+  }
+
+  // Sizes past INT_MAX can't be reported through this interface
+  if (fd_entry(ind)->size > INT_MAX) {
+    return -1;
+  }
+
+  // If found, grab and return size of file pointed to by FD
+  return fd_entry(ind)->size;
+}
+
+int fs_lseek(int fd, size_t offset)
+{
+	/* TODO: Phase 3 */
+  // ERROR CHECKING
+  // No filesystem mounted
+  if (!FS) {
+    return -1;
+  }
+
+  // Find file in fds
+  int ind = find_fdsIndex(fd);
+
+  // If given fd is not in array of file descriptors
+  if (ind == -1) {
+    return -1;
+  }
+
+  // Offset past the end of a compressed file, whose stream can't have a gap
+  if (fd_entry(ind)->size < offset &&
+      (fd_entry(ind)->flags & ROOT_FLAG_COMPRESSED)) {
+    return -1;
+  }
+
+  // Buffered writes must stay sequential, flush them when moving away
+  if (offset != fds[ind].wbufStart + fds[ind].wbufLen) {
+    wbuf_flush(ind);
+  }
+
+  // If found, set offset of file to given offset
+  fds[ind].offset = offset;
+  return 0;
+}
+
+// HELPER FUNCTION - finds first data block of the cluster holding offset of fd
+// Walks the chain from the fd's cursor when possible, so sequential access
+// doesn't restart from the first cluster every time
+int find_DBIndex(int fdIndex) {
+  // Grab position in the chain of cluster within file containing the offset
+  bool hole;
+  size_t run;
+  size_t target = file_pos(fd_entry(fdIndex), fds[fdIndex].offset /
+                           clusterSize, &hole, &run);
+  // Grab index of first cluster
+  uint32_t DBIndex = fd_entry(fdIndex)->firstIndex;
+  size_t block = 0;
+
+  // If empty file, return -1
+  if (DBIndex == FAT_EOC) {
+    return -1;
+  }
+
+  // Resume from cursor if it isn't past the target, after moving it there
+  // through the extent map if it is far
+  extent_seek(fdIndex, target);
+  if (fds[fdIndex].curFAT != FAT_EOC && fds[fdIndex].curBlock <= target) {
+    DBIndex = fds[fdIndex].curFAT;
+    block = fds[fdIndex].curBlock;
+  }
+
+  // Iterate through file's clusters until cluster containing offset of file
+  while (block < target) {
+    // Grab next cluster of file
+    uint32_t next = fat_get(DBIndex);
+    // If next index wasn't allocated, out of bounds of file
+    if (next == FAT_EOC) {
+      fds[fdIndex].curBlock = block;
+      fds[fdIndex].curFAT = DBIndex;
+      return -1;
+    }
+    DBIndex = next;
+    block++;
+  }
+
+  fds[fdIndex].curBlock = block;
+  fds[fdIndex].curFAT = DBIndex;
+
+  // Actual index of first data block of cluster containing offset of file
+  // Need to account for actual data block start index from superblock
+  return cluster_block(DBIndex);
+}
+
+// HELPER FUNCTION - appends a free cluster to file of fd
+// Returns the new cluster's FAT index, or -1 if the disk is full
+static int append_DB(int fdIndex)
+{
+  struct root *ent = fd_entry(fdIndex);
+  int newIndex = find_freeFAT();
+  if (newIndex == -1) {
+    return -1;
+  }
+
+  fat_set(newIndex, FAT_EOC);
+  if (ent->firstIndex == FAT_EOC) {
+    // Empty file, new cluster becomes the first cluster
+    ent->firstIndex = newIndex;
+  } else {
+    // Iterate until entry that points to FAT_EOC, resuming from the cursor,
+    // else from the end of the extent map
+    if (fds[fdIndex].curFAT == FAT_EOC) {
+      extent_seek(fdIndex, SIZE_MAX);
+    }
+    uint32_t FATIndex = fds[fdIndex].curFAT;
+    if (FATIndex == FAT_EOC) {
+      FATIndex = ent->firstIndex;
+      fds[fdIndex].curBlock = 0;
+    }
+    while (fat_get(FATIndex) != FAT_EOC) {
+      FATIndex = fat_get(FATIndex);
+      fds[fdIndex].curBlock++;
+    }
+    fds[fdIndex].curFAT = FATIndex;
+    fat_set(FATIndex, newIndex);
+  }
+  return newIndex;
+}
+
+// HELPER FUNCTION - extends the cluster at the cursor of fd into a run of up to
+// @max physically contiguous clusters of the file, following the chain while
+// it is contiguous & appending the next free clusters at its end. Leaves the
+// cursor on the last cluster of the run & returns its length
+static size_t cluster_run(int fdIndex, size_t max)
+{
+  size_t run = 1;
+  for (; run < max; run++) {
+    uint32_t cur = fds[fdIndex].curFAT;
+    uint32_t next = fat_get(cur);
+    if (next == FAT_EOC && cur + 1 < numClusters && fat_get(cur + 1) == 0 &&
+        cluster_left()) {
+      fat_set(cur + 1, FAT_EOC);
+      fat_set(cur, cur + 1);
+      freeHint = cur + 1;
+    } else if (next != cur + 1) {
+      break;
+    }
+    fds[fdIndex].curFAT = cur + 1;
+    fds[fdIndex].curBlock++;
+  }
+  return run;
+}
+
+// HELPER FUNCTION - # of clusters, up to @max, contiguous on disk in the chain
+// of fd from the current one on. Like cluster_run(), without extending the
+// chain. Runs the extent map holds are taken whole
+static size_t chain_run(int fdIndex, size_t max)
+{
+  struct fileDesc *fd = &fds[fdIndex];
+  const struct openFile *file = &files[fd->file];
+  if (file->numExtents) {
+    const struct extent *e = &file->extents[extent_find(file, fd->curBlock)];
+    size_t off = fd->curBlock - e->pos;
+    if (off < e->count && e->first + off == fd->curFAT) {
+      size_t run = e->count - off < max ? e->count - off : max;
+      fd->curBlock += run - 1;
+      fd->curFAT += run - 1;
+      return run;
+    }
+  }
+
+  size_t run = 1;
+  for (; run < max; run++) {
+    uint32_t cur = fds[fdIndex].curFAT;
+    if (fat_get(cur) != cur + 1) {
+      break;
+    }
+    fds[fdIndex].curFAT = cur + 1;
+    fds[fdIndex].curBlock++;
+  }
+  return run;
+}
+
+// HELPER FUNCTION - makes the file of fd sparse, with an empty hole table in
+// the slots following its entry. The record moves to free slots of its
+// directory block if these are taken. Returns -1 if there is no room
+static int sparse_claim(int fdIndex)
+{
+  struct openFile *file = &files[fds[fdIndex].file];
+  struct root *ent = file->ent;
+  if (ent->flags & ROOT_FLAG_SPARSE) {
+    return 0;
+  }
+  if (fat16 || (ent->flags & (ROOT_FLAG_INLINE | ROOT_FLAG_COMPRESSED))) {
+    return -1;
+  }
+  // The hole table takes the slots of the extent list
+  extents_drop(file);
+
+  // Check the slots following the entry, in rootD or in its bucket
+  struct root bucket[DIR_ENTRIES_PER_BLOCK] BLOCK_ALIGNED;
+  struct root *slots = rootD;
+  int numSlots = FS_FILE_MAX_COUNT;
+  if (file->loc.block != 0) {
+    if (block_read(file->loc.block, bucket)) {
+      return -1;
+    }
+    slots = bucket;
+    numSlots = DIR_ENTRIES_PER_BLOCK;
+  }
+  int slot = file->loc.slot;
+  for (int i = 1; i < RECORD_SLOTS; i++) {
+    if (slot + i >= numSlots || slots[slot + i].fileName[0] != '\0') {
+      slot = -1;
+      break;
+    }
+  }
+  // Else the record moves, possibly over its own slot
+  struct root record = *ent;
+  if (slot == -1) {
+    memset(&slots[file->loc.slot], 0, sizeof(struct root));
+    slot = find_freeSlot(slots, numSlots, RECORD_SLOTS);
+    if (slot == -1) {
+      slots[file->loc.slot] = record;
+      return -1;
+    }
+  }
+
+  record.flags |= ROOT_FLAG_SPARSE;
+  slots[slot] = record;
+  memset(&slots[slot + 1], 0, INLINE_MAX_BYTES);
+  if (file->loc.block != 0) {
+    memcpy(file->entry, &slots[slot], RECORD_SLOTS * sizeof(struct root));
+    if (block_write(file->loc.block, bucket)) {
+      return -1;
+    }
+  } else {
+    file->ent = &rootD[slot];
+  }
+  file->loc.slot = slot;
+  superB->features |= FEATURE_SPARSE;
+  return 0;
+}
+
+// HELPER FUNCTION - adds a hole of @count clusters from cluster #@start, past
+// the other holes, to the file of fd. Returns -1 if the file can't have
+// another hole
+static int hole_add(int fdIndex, size_t start, size_t count)
+{
+  if (start + count > UINT32_MAX || sparse_claim(fdIndex)) {
+    return -1;
+  }
+  struct hole *holes = (struct hole*)(fd_entry(fdIndex) + 1);
+  size_t h = 0;
+  while (h < SPARSE_MAX_HOLES && holes[h].count) {
+    h++;
+  }
+  if (h > 0 && holes[h - 1].start + holes[h - 1].count == start) {
+    holes[h - 1].count += count;
+    return 0;
+  }
+  if (h == SPARSE_MAX_HOLES) {
+    return -1;
+  }
+  holes[h].start = start;
+  holes[h].count = count;
+  return 0;
+}
+
+// HELPER FUNCTION - allocates cluster #@k of the file of fd, in a hole: links
+// it into the chain at its position & takes it out of the hole, zeroed if
+// @zero. Splitting a hole takes an entry of the hole table, without a free one
+// the hole is filled from its start instead. Returns -1 if the disk is full
+static int hole_alloc(int fdIndex, size_t k, bool zero)
+{
+  struct root *ent = fd_entry(fdIndex);
+  struct hole *holes = (struct hole*)(ent + 1);
+  size_t h = 0;
+  while (k < holes[h].start || k >= (size_t)holes[h].start + holes[h].count) {
+    h++;
+  }
+  size_t end = (size_t)holes[h].start + holes[h].count;
+  if (k != holes[h].start && k != end - 1 &&
+      holes[SPARSE_MAX_HOLES - 1].count) {
+    while (holes[h].start < k) {
+      if (hole_alloc(fdIndex, holes[h].start, true)) {
+        return -1;
+      }
+    }
+  }
+
+  int newIndex = find_freeFAT();
+  if (newIndex == -1) {
+    return -1;
+  }
+  if (zero) {
+    char *buf = pool_get();
+    if (!buf) {
+      return -1;
+    }
+    memset(buf, 0, BLOCK_SIZE);
+    for (size_t b = 0; b < superB->clusterBlocks; b++) {
+      block_write(cluster_block(newIndex) + b, buf);
+    }
+    pool_put(buf);
+  }
+
+  // Link the cluster after the one at the position before, resuming from the
+  // cursor or the extent map. Cursors of other fds on the file may be past it
+  bool hole;
+  size_t run;
+  size_t pos = file_pos(ent, k, &hole, &run);
+  if (pos == 0) {
+    fat_set(newIndex, ent->firstIndex);
+    ent->firstIndex = newIndex;
+    fds[fdIndex].curFAT = FAT_EOC;
+  } else {
+    extent_seek(fdIndex, pos - 1);
+    if (fds[fdIndex].curFAT == FAT_EOC || fds[fdIndex].curBlock > pos - 1) {
+      fds[fdIndex].curFAT = ent->firstIndex;
+      fds[fdIndex].curBlock = 0;
+    }
+    while (fds[fdIndex].curBlock < pos - 1) {
+      fds[fdIndex].curFAT = fat_get(fds[fdIndex].curFAT);
+      fds[fdIndex].curBlock++;
+    }
+    uint32_t prev = fds[fdIndex].curFAT;
+    fat_set(newIndex, fat_get(prev));
+    fat_set(prev, newIndex);
+  }
+  chain_moved(fds[fdIndex].file);
+  files[fds[fdIndex].file].cowPrivate = 0;
+
+  // Take the cluster out of the hole, splitting it if needed
+  if (k == holes[h].start) {
+    holes[h].start++;
+    holes[h].count--;
+  } else if (k == end - 1) {
+    holes[h].count--;
+  } else {
+    memmove(&holes[h + 2], &holes[h + 1],
+            (SPARSE_MAX_HOLES - h - 2) * sizeof(struct hole));
+    holes[h + 1].start = k + 1;
+    holes[h + 1].count = end - k - 1;
+    holes[h].count = k - holes[h].start;
+  }
+  if (holes[h].count == 0) {
+    memmove(&holes[h], &holes[h + 1],
+            (SPARSE_MAX_HOLES - h - 1) * sizeof(struct hole));
+    memset(&holes[SPARSE_MAX_HOLES - 1], 0, sizeof(struct hole));
+  }
+  return 0;
+}
+
+// HELPER FUNCTION - writes @count bytes at offset of fd into its data blocks
+// Returns # of bytes written, fewer than @count if the disk runs out of space
+static size_t file_write(int fdIndex, const char *buf, size_t count)
+{
+  // Entry of file in its directory
+  struct root *ent = fd_entry(fdIndex);
+  // Offset of buffer holding stuff to write
+  size_t bufferOffset = 0;
+  // Remaing # of bytes to write
+  size_t remainBytes = count;
+  // Left offset within cluster, # of bytes written
+  size_t lOffset, writtenBytes;
+
+  // Loop until no more bytes to write, one cluster at a time
+  while (remainBytes != 0) {
+    // Left offset != 0 only if offset isn't aligned on a cluster
+    lOffset = fds[fdIndex].offset % clusterSize;
+    writtenBytes = clusterSize - lOffset;
+    if (writtenBytes > remainBytes) {
+      writtenBytes = remainBytes;
+    }
+
+    // Cluster in a hole is allocated, zeroed unless the write covers it. Runs
+    // of clusters stop at the next hole
+    size_t k = fds[fdIndex].offset / clusterSize;
+    bool hole;
+    size_t span;
+    file_pos(ent, k, &hole, &span);
+    bool newCluster = false;
+    if (hole) {
+      if (hole_alloc(fdIndex, k, writtenBytes != clusterSize)) {
+        break;
+      }
+      file_pos(ent, k, &hole, &span);
+      newCluster = true;
+    }
+
+    int DBIndex = find_DBIndex(fdIndex);
+    if (DBIndex == -1) {
+      // If can't find cluster, allocate new cluster
+      // If no free FAT entries, write as many bytes as possible
+      if (append_DB(fdIndex) == -1) {
+        break;
+      }
+      DBIndex = find_DBIndex(fdIndex);
+      newCluster = true;
+    }
+
+    if (writtenBytes == clusterSize) {
+      // Whole clusters, write them straight from the caller's buffer, in one
+      // go for as long as they are contiguous on disk
+      size_t max = remainBytes / clusterSize;
+      size_t run = cluster_run(fdIndex, max < span ? max : span);
+      writtenBytes = run * clusterSize;
+      data_write_blocks(DBIndex, run * superB->clusterBlocks,
+                        buf+bufferOffset);
+    } else {
+      // Partial cluster, only blocks covered by the write are touched. Whole
+      // blocks go straight from the caller's buffer, the partially written
+      // head & tail blocks through a bounce buffer from the pool
+      size_t block = DBIndex + lOffset / BLOCK_SIZE;
+      size_t blockOffset = lOffset % BLOCK_SIZE;
+      const char *src = buf+bufferOffset;
+      size_t left = writtenBytes;
+
+      char *bounceBuffer = NULL;
+      if (blockOffset || left % BLOCK_SIZE) {
+        if (!(bounceBuffer = pool_get())) {
+          break;
+        }
+      }
+
+      if (blockOffset) {
+        size_t len = BLOCK_SIZE - blockOffset;
+        if (len > left) {
+          len = left;
+        }
+        if (newCluster) {
+          memset(bounceBuffer, 0, BLOCK_SIZE);
+        } else {
+          block_read(block, bounceBuffer);
+        }
+        memcpy(bounceBuffer+blockOffset, src, len);
+        block_write(block++, bounceBuffer);
+        src += len;
+        left -= len;
+      }
+      if (left >= BLOCK_SIZE) {
+        size_t numBlocks = left / BLOCK_SIZE;
+        data_write_blocks(block, numBlocks, src);
+        block += numBlocks;
+        src += numBlocks * BLOCK_SIZE;
+        left -= numBlocks * BLOCK_SIZE;
+      }
+      if (left) {
+        if (newCluster) {
+          memset(bounceBuffer, 0, BLOCK_SIZE);
+        } else {
+          block_read(block, bounceBuffer);
+        }
+        memcpy(bounceBuffer, src, left);
+        block_write(block, bounceBuffer);
+      }
+
+      if (bounceBuffer) {
+        pool_put(bounceBuffer);
+      }
+    }
+
+    // Update variables
+    fds[fdIndex].offset += writtenBytes;
+    bufferOffset += writtenBytes;
+    remainBytes -= writtenBytes;
+  }
+
+  // File grows only if written past its previous end
+  if (fds[fdIndex].offset > ent->size) {
+    ent->size = fds[fdIndex].offset;
+  }
+  return count - remainBytes;
+}
+
+// HELPER FUNCTION - appends @clusters clusters to the chain of fd, as one run
+// when free space allows: right after the chain's last cluster, else in a free
+// gap with room to grow if @growing, else at the first free run long enough.
+// Returns -1 if the disk runs out of space
+static int chain_append_run(int fdIndex, size_t clusters, bool growing)
+{
+  struct root *ent = fd_entry(fdIndex);
+  uint32_t last = FAT_EOC;
+  if (ent->firstIndex != FAT_EOC) {
+    // Find the chain's last cluster, resuming from the cursor, else from the
+    // end of the extent map
+    if (fds[fdIndex].curFAT == FAT_EOC) {
+      extent_seek(fdIndex, SIZE_MAX);
+    }
+    last = fds[fdIndex].curFAT;
+    if (last == FAT_EOC) {
+      last = ent->firstIndex;
+      fds[fdIndex].curBlock = 0;
+    }
+    while (fat_get(last) != FAT_EOC) {
+      last = fat_get(last);
+      fds[fdIndex].curBlock++;
+    }
+    fds[fdIndex].curFAT = last;
+  }
+
+  // Once no run is long enough, fall back to the first free clusters
+  bool runs = true;
+  for (; clusters > 0; clusters--) {
+    int next = -1;
+    if (!cluster_left()) {
+      return -1;
+    }
+    if (last != FAT_EOC && last + 1 < numClusters && fat_get(last + 1) == 0) {
+      next = last + 1;
+    } else if (growing && (next = find_freeGap(clusters)) != -1) {
+      growing = false;
+    } else if (runs && (next = find_freeRun(clusters)) == -1) {
+      runs = false;
+    }
+    if (next == -1 && (next = find_freeFAT()) == -1) {
+      return -1;
+    }
+    fat_set(next, FAT_EOC);
+    if (last == FAT_EOC) {
+      ent->firstIndex = next;
+    } else {
+      fat_set(last, next);
+    }
+    last = next;
+    freeHint = next;
+  }
+  return 0;
+}
+
+// HELPER FUNCTION - writes the write-back buffer of fd to its data blocks
+// Clusters reserved for the buffer are allocated now that its length is known,
+// @growing if the file is still being appended to
+static void wbuf_writeback(int fdIndex, bool growing)
+{
+  struct fileDesc *desc = &fds[fdIndex];
+  if (desc->wbufLen == 0) {
+    return;
+  }
+
+  // Compressed files: room reserved for the frames at worst is given back for
+  // comp_write() to allocate what they take. The rest stays reserved for the
+  // data still to come if @growing
+  struct openFile *file = &files[desc->file];
+  if (file->ent->flags & ROOT_FLAG_COMPRESSED) {
+    size_t held = desc->wbufChain + desc->wbufReserved;
+    numReserved -= desc->wbufReserved;
+    desc->wbufReserved = 0;
+    size_t offset = desc->offset;
+    desc->offset = desc->wbufStart;
+    data_write(fdIndex, desc->wbuf + desc->wbufStart % BLOCK_SIZE,
+               desc->wbufLen);
+    desc->offset = offset;
+    desc->wbufLen = 0;
+    // Data that didn't make it is lost, the file ends with its frames
+    if (file->ent->size > file->rawSize) {
+      file->ent->size = file->rawSize;
+      if (desc->offset > file->rawSize) {
+        desc->offset = file->rawSize;
+      }
+    }
+    desc->wbufChain = (file->frames[file->numFrames] + clusterSize - 1) /
+      clusterSize;
+    if (growing && held > desc->wbufChain) {
+      desc->wbufReserved = held - desc->wbufChain;
+      numReserved += desc->wbufReserved;
+    }
+    return;
+  }
+
+  size_t clusters = (desc->wbufStart + desc->wbufLen + clusterSize - 1) /
+    clusterSize;
+  if (clusters > desc->wbufChain) {
+    size_t n = clusters - desc->wbufChain;
+    numReserved -= n;
+    desc->wbufReserved -= n;
+    desc->wbufChain = clusters;
+    chain_append_run(fdIndex, n, growing);
+  }
+
+  size_t offset = desc->offset;
+  desc->offset = desc->wbufStart;
+  file_write(fdIndex, desc->wbuf + desc->wbufStart % BLOCK_SIZE,
+             desc->wbufLen);
+  desc->offset = offset;
+  desc->wbufLen = 0;
+}
+
+// HELPER FUNCTION - writes the write-back buffer of fd to its data blocks
+static void wbuf_flush(int fdIndex)
+{
+  wbuf_writeback(fdIndex, false);
+}
+
+// HELPER FUNCTION - flushes write-back buffers of the other fds on the file of
+// fd, before fd reads or writes the file's data blocks
+static void wbuf_flush_others(int fdIndex)
+{
+  for (int i = 0; i < FS_OPEN_MAX_COUNT; i++) {
+    if (i != fdIndex && fds[i].ID != -1 && fds[i].file == fds[fdIndex].file) {
+      wbuf_flush(i);
+    }
+  }
+}
+
+// HELPER FUNCTION - gathers @count bytes written at offset of fd in its
+// write-back buffer, which grows up to WBUF_MAX_BYTES & is then flushed.
+// Clusters past the end of the chain are only reserved, & allocated on flush.
+// Returns # of bytes written, fewer than @count if the disk runs out of space
+static size_t wbuf_write(int fdIndex, const char *buf, size_t count)
+{
+  struct fileDesc *desc = &fds[fdIndex];
+  struct openFile *file = &files[desc->file];
+  struct root *ent = file->ent;
+  bool comp = ent->flags & ROOT_FLAG_COMPRESSED;
+  if (desc->wbufLen && desc->offset != desc->wbufStart + desc->wbufLen) {
+    wbuf_flush(fdIndex);
+  }
+  if (comp && !file->frames && comp_index(fdIndex)) {
+    return 0;
+  }
+  if (!desc->wbuf) {
+    if (!(desc->wbuf = io_alloc(WBUF_BYTES))) {
+      return data_write(fdIndex, buf, count);
+    }
+    desc->wbufSize = WBUF_BYTES;
+  }
+
+  // Without buffered data, the chain holds exactly the file's clusters, or
+  // the stream of a compressed file
+  if (desc->wbufLen == 0 && desc->wbufReserved == 0) {
+    desc->wbufChain = ((comp ? file->frames[file->numFrames] : ent->size) +
+                       clusterSize - 1) / clusterSize;
+  }
+  // Reserve the clusters past the chain up to the end of the write. Frames of
+  // a compressed file are rewritten from the buffer's start to the file's end,
+  // & may take as much room as stored uncompressed
+  size_t clusters = (desc->offset + count + clusterSize - 1) / clusterSize;
+  if (comp) {
+    uint64_t end = desc->offset + count > ent->size ? desc->offset + count :
+      ent->size;
+    size_t first = (desc->wbufLen ? desc->wbufStart : desc->offset) /
+      COMP_FRAME_BYTES;
+    clusters = (comp_worst(fdIndex, first, end) + clusterSize - 1) /
+      clusterSize;
+  }
+  size_t held = desc->wbufChain + desc->wbufReserved;
+  if (clusters > held) {
+    size_t avail = fat_free_count() - numReserved;
+    while (clusters - held > avail && reclaim_run(RECLAIM_BATCH)) {
+      avail = fat_free_count() - numReserved;
+    }
+    // Compressed files short on room write through, as much as fits
+    if (comp && clusters - held > avail) {
+      wbuf_flush(fdIndex);
+      return data_write(fdIndex, buf, count);
+    }
+    if (clusters - held > avail) {
+      clusters = held + avail;
+      count = clusters * clusterSize > desc->offset ?
+        clusters * clusterSize - desc->offset : 0;
+    }
+    if (clusters > held) {
+      numReserved += clusters - held;
+      desc->wbufReserved += clusters - held;
+    }
+  }
+
+  size_t done = 0;
+  while (done < count) {
+    if (desc->wbufLen == 0) {
+      desc->wbufStart = desc->offset;
+    }
+    // The buffer ends on a block boundary, so flushes write whole blocks
+    size_t room = desc->wbufSize - desc->wbufStart % BLOCK_SIZE -
+      desc->wbufLen;
+    size_t n = count - done < room ? count - done : room;
+    memcpy(desc->wbuf + desc->wbufStart % BLOCK_SIZE + desc->wbufLen,
+           buf + done, n);
+    desc->wbufLen += n;
+    desc->offset += n;
+    done += n;
+    if (n < room) {
+      continue;
+    }
+    // Full, grow the buffer so that the allocator sees longer runs
+    char *grown = NULL;
+    if (desc->wbufSize < WBUF_MAX_BYTES) {
+      grown = io_alloc(2 * desc->wbufSize);
+    }
+    if (grown) {
+      memcpy(grown, desc->wbuf, desc->wbufSize);
+      free(desc->wbuf);
+      desc->wbuf = grown;
+      desc->wbufSize *= 2;
+    } else {
+      wbuf_writeback(fdIndex, true);
+    }
+  }
+
+  if (desc->offset > ent->size) {
+    ent->size = desc->offset;
+  }
+  return count;
+}
+
+// HELPER FUNCTION - reads @count bytes at offset of fd from its data blocks
+// @count must not go past the end of the file
+static int file_read(int fdIndex, char *buf, size_t count)
+{
+  struct root *ent = fd_entry(fdIndex);
+  // Read buffer offset
+  size_t bufferOffset = 0;
+  // Remaing # of bytes to read
+  size_t remainBytes = count;
+  // Left offset within cluster, # of bytes read
+  size_t lOffset, readBytes;
+
+  // Loop until no more bytes left to read, one cluster at a time
+  while (remainBytes != 0) {
+    lOffset = fds[fdIndex].offset % clusterSize;
+    readBytes = clusterSize - lOffset;
+    if (readBytes > remainBytes) {
+      readBytes = remainBytes;
+    }
+
+    // Holes read as zeros without touching the disk, & runs of clusters stop
+    // at the next one
+    bool hole;
+    size_t span;
+    file_pos(ent, fds[fdIndex].offset / clusterSize, &hole, &span);
+    if (hole) {
+      readBytes = span * clusterSize - lOffset;
+      if (readBytes > remainBytes) {
+        readBytes = remainBytes;
+      }
+      memset(buf+bufferOffset, 0, readBytes);
+      fds[fdIndex].offset += readBytes;
+      bufferOffset += readBytes;
+      remainBytes -= readBytes;
+      continue;
+    }
+
+    int DBIndex = find_DBIndex(fdIndex);
+    if (DBIndex == -1) {
+      fprintf(stderr, "Block reading ERROR\n");
+      return -1;
+    }
+
+    if (readBytes == clusterSize) {
+      // Whole clusters, read them straight into the caller's buffer, in one
+      // go for as long as they are contiguous on disk
+      size_t max = remainBytes / clusterSize;
+      size_t run = chain_run(fdIndex, max < span ? max : span);
+      readBytes = run * clusterSize;
+      if (data_read_blocks(DBIndex, run * superB->clusterBlocks,
+                           buf+bufferOffset) == -1) {
+        fprintf(stderr, "Block reading ERROR\n");
+        return -1;
+      }
+    } else {
+      // Partial cluster, only blocks covered by the read are fetched. Whole
+      // blocks go straight into the caller's buffer, the partially read head
+      // & tail blocks through a bounce buffer from the pool
+      size_t block = DBIndex + lOffset / BLOCK_SIZE;
+      size_t blockOffset = lOffset % BLOCK_SIZE;
+      char *dst = buf+bufferOffset;
+      size_t left = readBytes;
+      int ret = 0;
+
+      char *bounceBuffer = NULL;
+      if (blockOffset || left % BLOCK_SIZE) {
+        if (!(bounceBuffer = pool_get())) {
+          return -1;
+        }
+      }
+
+      if (blockOffset) {
+        size_t len = BLOCK_SIZE - blockOffset;
+        if (len > left) {
+          len = left;
+        }
+        ret |= block_read(block++, bounceBuffer);
+        memcpy(dst, bounceBuffer+blockOffset, len);
+        dst += len;
+        left -= len;
+      }
+      if (left >= BLOCK_SIZE) {
+        size_t numBlocks = left / BLOCK_SIZE;
+        ret |= data_read_blocks(block, numBlocks, dst);
+        block += numBlocks;
+        dst += numBlocks * BLOCK_SIZE;
+        left -= numBlocks * BLOCK_SIZE;
+      }
+      if (left) {
+        ret |= block_read(block, bounceBuffer);
+        memcpy(dst, bounceBuffer, left);
+      }
+
+      if (bounceBuffer) {
+        pool_put(bounceBuffer);
+      }
+      if (ret == -1) {
+        fprintf(stderr, "Block reading ERROR\n");
+        return -1;
+      }
+    }
+
+    // Update variables
+    fds[fdIndex].offset += readBytes;
+    bufferOffset += readBytes;
+    remainBytes -= readBytes;
   }
 
-	// Display fs info
-	printf("FS Info:\n");
-	printf("total_blk_count=%d\n", superB->numBlocks);
-	printf("fat_blk_count=%d\n", superB->numFATBlocks);
-	printf("rdir_blk=%d\n", superB->rootIndex);
-	printf("data_blk=%d\n", superB->dataIndex);
-	printf("data_blk_count=%d\n", superB->numDataBlocks);
-  printf("fat_free_ratio=%d/%d\n", FATFree, superB->numDataBlocks);
-  printf("rdir_free_ratio=%d/%d\n", rootDFree, FS_FILE_MAX_COUNT);
-	return 0;
+  return count - remainBytes;
 }
 
-// HELPER FUNCTION - finds free FAT block
-int find_freeFAT(){
-  for (int i = 1; i < superB->numDataBlocks; i++) {
-    if(fat[i].entry == 0){
-      return i;
-    }
-  }
+// HELPER FUNCTION - returns # of bytes of frame #@k of a file of @size bytes
+static size_t comp_frame_len(uint64_t size, size_t k)
+{
+  uint64_t left = size - (uint64_t)k * COMP_FRAME_BYTES;
+  return left < COMP_FRAME_BYTES ? left : COMP_FRAME_BYTES;
+}
 
-  // In case of no room
-  return -1;
+// HELPER FUNCTION - reads @count bytes at byte @pos of the chain of fd
+// Used on compressed files, whose chain holds a stream of frames
+static int stream_read(int fdIndex, uint64_t pos, void *buf, size_t count)
+{
+  size_t offset = fds[fdIndex].offset;
+  fds[fdIndex].offset = pos;
+  int ret = file_read(fdIndex, buf, count);
+  fds[fdIndex].offset = offset;
+  return ret == (int)count ? 0 : -1;
 }
 
-int fs_create(const char *filename)
+// HELPER FUNCTION - writes @count bytes at byte @pos of the chain of fd
+// The chain must be long enough already, & the file's size is left alone
+static int stream_write(int fdIndex, uint64_t pos, const void *buf,
+                        size_t count)
 {
-	/* TODO: Phase 2 */
-  // ERROR CHECKING
-  // No filesystem mounted, or null filename
-  if (!FS || !filename) {
-		return -1;
-	}
-  // Length of filename too long
-  if (strlen(filename) > FS_FILENAME_LEN) {
+  struct root *ent = fd_entry(fdIndex);
+  size_t offset = fds[fdIndex].offset;
+  uint64_t size = ent->size;
+  fds[fdIndex].offset = pos;
+  size_t ret = file_write(fdIndex, buf, count);
+  fds[fdIndex].offset = offset;
+  ent->size = size;
+  return ret == count ? 0 : -1;
+}
+
+// HELPER FUNCTION - builds the frame index of compressed file of fd
+// Only frame headers are read, frame data stays on disk until needed
+static int comp_index(int fdIndex)
+{
+  struct openFile *file = &files[fds[fdIndex].file];
+  uint64_t size = file->ent->size;
+  size_t numFrames = (size + COMP_FRAME_BYTES - 1) / COMP_FRAME_BYTES;
+  uint64_t *frames = io_alloc((numFrames + 1) * sizeof(uint64_t));
+  char *cache = io_alloc(COMP_FRAME_BYTES);
+  if (!frames || !cache) {
+    free(frames);
+    free(cache);
     return -1;
   }
 
-  // Check if filename already exists
-  for (int i = 0; i < FS_FILE_MAX_COUNT; i++) {
-    if (!strncmp((char*)rootD[i].fileName, filename, strlen(filename))) {
+  uint64_t pos = 0;
+  for (size_t k = 0; k < numFrames; k++) {
+    struct frameHeader hdr;
+    if (stream_read(fdIndex, pos, &hdr, sizeof(hdr)) ||
+        hdr.rawLen != comp_frame_len(size, k) ||
+        (hdr.compLen & ~COMP_FRAME_RAW) > COMP_FRAME_BYTES) {
+      fprintf(stderr, "Corrupted compressed file\n");
+      free(frames);
+      free(cache);
       return -1;
     }
+    frames[k] = pos;
+    pos += sizeof(hdr) + (hdr.compLen & ~COMP_FRAME_RAW);
   }
+  frames[numFrames] = pos;
 
-  // Find empty entry in root directory
-  int foundI = -1;
-  for (int i = 0; i < FS_FILE_MAX_COUNT; i++) {
-    // If entry is empty, grab index
-    if((char)rootD[i].fileName[0] == '\0'){
-      foundI = i;
-      break;
-    }
-  }
-
-  // If index was never found, root directory is full
-  if (foundI == -1) {
-    return foundI;
-  }
-  
-  // Else, set found empty entry to new filename
-  strcpy((char*)rootD[foundI].fileName, filename);
-  rootD[foundI].size = 0;
-  rootD[foundI].firstIndex = FAT_EOC;
-  // fat[rootD[foundI].firstIndex].entry = FAT_EOC;
+  file->frames = frames;
+  file->numFrames = numFrames;
+  file->rawSize = size;
+  file->cache = cache;
+  file->cacheFrame = SIZE_MAX;
   return 0;
 }
 
-int fs_delete(const char *filename)
+// HELPER FUNCTION - decompresses frame #@k of compressed file of fd into @out
+static int comp_frame_read(int fdIndex, size_t k, char *out)
 {
-	/* TODO: Phase 2 */
-  // ERROR CHECKING
-  // No filesystem mounted, or NULL filename
-  if (!FS || !filename) {
-		return -1;
-	}
+  struct openFile *file = &files[fds[fdIndex].file];
+  uint64_t pos = file->frames[k];
+  size_t len = file->frames[k + 1] - pos;
+  size_t rawLen = comp_frame_len(file->rawSize, k);
+  int ret = -1;
 
-  // Find file in root directory
-  int foundI = -1;
-  for (int i = 0; i < FS_FILE_MAX_COUNT; i++) {
-    if(!strncmp((char*)rootD[i].fileName, filename, strlen(filename))) {
-      foundI = i;
-      break;
+  // Header & data are read at once
+  char *data = io_alloc(len);
+  if (data && !stream_read(fdIndex, pos, data, len)) {
+    struct frameHeader *hdr = (struct frameHeader*)data;
+    char *payload = data + sizeof(struct frameHeader);
+    size_t payloadLen = len - sizeof(struct frameHeader);
+    if (hdr->rawLen != rawLen) {
+      ret = -1;
+    } else if (hdr->compLen & COMP_FRAME_RAW) {
+      if (payloadLen == rawLen) {
+        memcpy(out, payload, rawLen);
+        ret = 0;
+      }
+    } else {
+      ret = lz_decompress(payload, payloadLen, out, rawLen);
     }
   }
+  free(data);
+  if (ret) {
+    fprintf(stderr, "Corrupted compressed file\n");
+  }
+  return ret;
+}
 
-  // If file isn't found, return -1
-  if (foundI == -1) {
+// HELPER FUNCTION - reads @count bytes at offset of fd from compressed file
+// @count must not go past the end of the file
+static int comp_read(int fdIndex, char *buf, size_t count)
+{
+  struct openFile *file = &files[fds[fdIndex].file];
+  if (!file->frames && comp_index(fdIndex)) {
     return -1;
   }
 
-  // Else, reset name and empty FAT data blocks
-  rootD[foundI].fileName[0] = '\0';
-  // Iterate through FAT data blocks, stop at beginning of next file
-  uint16_t ind = rootD[foundI].firstIndex;
-  while(ind != FAT_EOC) {
-    uint16_t ind2 = fat[ind].entry;
-    fat[ind].entry = 0;
-    ind = ind2;
+  size_t done = 0;
+  while (done < count) {
+    size_t k = fds[fdIndex].offset / COMP_FRAME_BYTES;
+    size_t lOffset = fds[fdIndex].offset % COMP_FRAME_BYTES;
+    size_t readBytes = comp_frame_len(file->rawSize, k) - lOffset;
+    if (readBytes > count - done) {
+      readBytes = count - done;
+    }
+
+    if (readBytes == COMP_FRAME_BYTES) {
+      // Whole frame, decompress it straight into the caller's buffer
+      if (comp_frame_read(fdIndex, k, buf + done)) {
+        return -1;
+      }
+    } else {
+      // Partial frame, keep it around for the reads that follow
+      if (file->cacheFrame != k) {
+        file->cacheFrame = SIZE_MAX;
+        if (comp_frame_read(fdIndex, k, file->cache)) {
+          return -1;
+        }
+        file->cacheFrame = k;
+      }
+      memcpy(buf + done, file->cache + lOffset, readBytes);
+    }
+
+    fds[fdIndex].offset += readBytes;
+    done += readBytes;
   }
-  
-  return 0;
+  return done;
 }
 
-int fs_ls(void)
+// HELPER FUNCTION - decompresses old frames of compressed file of fd, from
+// #@*loaded up to the last one starting before byte @pos of the stream, into
+// @old(indexed from frame #@first)
+static int comp_load(int fdIndex, size_t first, size_t *loaded, char **old,
+                     uint64_t pos)
 {
-	/* TODO: Phase 2 */
-  // ERROR CHECKING
-  // No filesystem mounted
-  if (!FS) {
-    return -1;
-  }
-
-  // Find and list non-empty files in the root directory
-  printf("FS Ls:\n");
-  for (int i = 0; i < FS_FILE_MAX_COUNT; i++) {
-    if (rootD[i].fileName[0] != '\0') {
-      printf("file: %s, size: %d, data_blk: %d\n", rootD[i].fileName, 
-      rootD[i].size, rootD[i].firstIndex);
+  struct openFile *file = &files[fds[fdIndex].file];
+  for (; *loaded < file->numFrames && file->frames[*loaded] < pos;
+       (*loaded)++) {
+    old[*loaded - first] = io_alloc(COMP_FRAME_BYTES);
+    if (!old[*loaded - first] ||
+        comp_frame_read(fdIndex, *loaded, old[*loaded - first])) {
+      return -1;
     }
   }
   return 0;
 }
 
-int fs_open(const char *filename)
+// HELPER FUNCTION - returns # of bytes the stream of compressed file of fd
+// takes at worst once frames from #@first on hold the file up to byte @end,
+// every one of them stored uncompressed
+static uint64_t comp_worst(int fdIndex, size_t first, uint64_t end)
 {
-	/* TODO: Phase 3 */
-  // ERROR CHECKING
-  // No filesystem mounted
-  if (!FS) {
-    return -1;
+  struct openFile *file = &files[fds[fdIndex].file];
+  uint64_t bytes = end - (uint64_t)first * COMP_FRAME_BYTES;
+  return file->frames[first] + bytes + (bytes + COMP_FRAME_BYTES - 1) /
+    COMP_FRAME_BYTES * sizeof(struct frameHeader);
+}
+
+// HELPER FUNCTION - writes @count bytes at offset of fd into compressed file
+// Frames from the one holding the offset on are compressed again, so an
+// append only rewrites the last frame. Old frames are decompressed before the
+// new stream overwrites them. Returns # of bytes written, fewer than @count
+// if the disk runs out of space
+static size_t comp_write(int fdIndex, const char *buf, size_t count)
+{
+  struct openFile *file = &files[fds[fdIndex].file];
+  struct root *ent = file->ent;
+  size_t frameCost = sizeof(struct frameHeader) + COMP_FRAME_BYTES;
+  if (count == 0 || (!file->frames && comp_index(fdIndex))) {
+    return 0;
   }
-  // FS_FILE_MAX_COUNT amount of open files already
-  if (numOpenFiles == FS_FILE_MAX_COUNT) {
-    return -1;
+  // Frames are assembled & compressed in buffers kept until unmount
+  if ((!compRaw && !(compRaw = io_alloc(COMP_FRAME_BYTES))) ||
+      (!compStage && !(compStage = io_alloc(COMP_STAGE_FRAMES * frameCost)))) {
+    return 0;
   }
 
-  // Find the file in the root directory
-  int foundI = -1;
-  for (int i = 0; i < FS_FILE_MAX_COUNT; i++) {
-    if (!strncmp((char*)rootD[i].fileName, filename, strlen(filename))) {
-      foundI = i;
-      break;
+  uint64_t size = file->rawSize, off = fds[fdIndex].offset;
+  uint64_t end = off + count > size ? off + count : size;
+  size_t first = off / COMP_FRAME_BYTES, oldFrames = file->numFrames;
+  uint64_t start = (uint64_t)first * COMP_FRAME_BYTES;
+  uint64_t base = file->frames[first];
+
+  // The chain holds the stream, grow it for the worst case. Should the disk
+  // run short, clamp the write to what surely fits: existing data must fit
+  // whatever happens
+  size_t chain = (file->frames[oldFrames] + clusterSize - 1) / clusterSize;
+  size_t clusters = (comp_worst(fdIndex, first, end) + clusterSize - 1) /
+    clusterSize;
+  if (clusters > chain && chain_append_run(fdIndex, clusters - chain, false)) {
+    uint64_t capacity = 0;
+    for (uint32_t i = ent->firstIndex; i != FAT_EOC; i = fat_get(i)) {
+      capacity += clusterSize;
     }
+    uint64_t avail = capacity > base ? capacity - base : 0;
+    uint64_t fit = avail / frameCost * COMP_FRAME_BYTES;
+    if (avail % frameCost > sizeof(struct frameHeader)) {
+      fit += avail % frameCost - sizeof(struct frameHeader);
+    }
+    end = start + fit;
+    count = end >= size && end > off ? end - off : 0;
   }
 
-  // If file isn't found, return -1
-  if (foundI == -1) {
-    return -1;
+  size_t newFrames = (end + COMP_FRAME_BYTES - 1) / COMP_FRAME_BYTES;
+  uint64_t *frames = io_alloc((newFrames + 1) * sizeof(uint64_t));
+  // Old frames are decompressed into buffers of their own, listed in a calloc'd
+  // array: io_alloc() counts the former, the latter is counted here
+  numAllocs++;
+  char **old = calloc(oldFrames - first + 1, sizeof(char*));
+  char *raw = compRaw, *stage = compStage;
+  size_t loaded = first;
+  uint64_t stagePos = base;
+  size_t stageLen = 0;
+  bool written = false;
+  if (count == 0 || !frames || !old) {
+    goto fail;
   }
+  // Frames before the first rewritten one don't move
+  memcpy(frames, file->frames, first * sizeof(uint64_t));
+  for (size_t k = first; k < newFrames; k++) {
+    uint64_t frameStart = (uint64_t)k * COMP_FRAME_BYTES;
+    size_t rawLen = comp_frame_len(end, k);
 
-  // Find empty file descriptor entry
-  for (int i = 0; i < FS_OPEN_MAX_COUNT; i++) {
-    if (fds[i].ID == -1) {
-      fds[i].ID = currentID;
-      fds[i].index = i;
-      fds[i].offset = 0;
-      currentID++;
-      numOpenFiles++;
-      return fds[i].ID;
+    // Old content of the frame, then the part of the write landing in it
+    if (k < oldFrames) {
+      if (comp_load(fdIndex, first, &loaded, old, file->frames[k] + 1)) {
+        goto fail;
+      }
+      memcpy(raw, old[k - first], comp_frame_len(size, k));
+      free(old[k - first]);
+      old[k - first] = NULL;
+    }
+    uint64_t from = off > frameStart ? off : frameStart;
+    uint64_t to = off + count < frameStart + rawLen ? off + count :
+      frameStart + rawLen;
+    if (from < to) {
+      memcpy(raw + (from - frameStart), buf + (from - off), to - from);
     }
-  }
 
-  // If file descriptor array is full
-  return -1;
-}
+    // Flush the staging buffer when full, once the old frames it overwrites
+    // are safe in memory
+    if (stageLen + frameCost > COMP_STAGE_FRAMES * frameCost) {
+      if (comp_load(fdIndex, first, &loaded, old, stagePos + stageLen) ||
+          stream_write(fdIndex, stagePos, stage, stageLen)) {
+        goto fail;
+      }
+      stagePos += stageLen;
+      stageLen = 0;
+    }
 
-// HELPER FUNCTION - finds index of fds given fds.ID
-int find_fdsIndex(int fd) {
-  // ERROR CHECKING
-  // Invalid fd(out of bounds or not currently open)
-  if (fd > currentID || fd < 0) {
-    return -1;
+    // Compress the frame, it is stored as is if that doesn't save anything
+    struct frameHeader *hdr = (struct frameHeader*)(stage + stageLen);
+    char *payload = stage + stageLen + sizeof(struct frameHeader);
+    size_t compLen = lz_compress(raw, rawLen, payload, rawLen - 1);
+    hdr->rawLen = rawLen;
+    hdr->compLen = compLen;
+    if (compLen == 0) {
+      memcpy(payload, raw, rawLen);
+      compLen = rawLen;
+      hdr->compLen = rawLen | COMP_FRAME_RAW;
+    }
+    frames[k] = stagePos + stageLen;
+    stageLen += sizeof(struct frameHeader) + compLen;
   }
+  if (comp_load(fdIndex, first, &loaded, old, stagePos + stageLen) ||
+      stream_write(fdIndex, stagePos, stage, stageLen)) {
+    goto fail;
+  }
+  frames[newFrames] = stagePos + stageLen;
 
-  // Find file in fds
-  for (int i = 0; i < FS_OPEN_MAX_COUNT; i++) {
-    // If found, return index of file in fds array
-    if (fds[i].ID == fd) {
-      return i;
-    }
+  free(file->frames);
+  file->frames = frames;
+  file->numFrames = newFrames;
+  file->cacheFrame = SIZE_MAX;
+  file->rawSize = end;
+  if (end > ent->size) {
+    ent->size = end;
   }
+  fds[fdIndex].offset = off + count;
+  written = true;
 
-  // If given fd is not in array of file descriptors
-  return -1;
+fail:
+  if (!written) {
+    count = 0;
+    free(frames);
+  }
+  // Give back clusters past the end of the stream. The fd's cursor was left
+  // near it by the writes
+  chain_truncate(fdIndex, (file->frames[file->numFrames] + clusterSize - 1) /
+                 clusterSize);
+  for (size_t k = 0; old && k < oldFrames - first + 1; k++) {
+    free(old[k]);
+  }
+  free(old);
+  return count;
 }
 
-int fs_close(int fd)
+// HELPER FUNCTION - writes @count bytes at offset of fd into its data blocks,
+// through compression for compressed files
+static size_t data_write(int fdIndex, const char *buf, size_t count)
 {
-	/* TODO: Phase 3 */
-  // ERROR CHECKING
-  // No filesystem mounted
-  if (!FS) {
-    return -1;
+  if (fd_entry(fdIndex)->flags & ROOT_FLAG_COMPRESSED) {
+    return comp_write(fdIndex, buf, count);
   }
-  // Invalid fd(not currently open or out of bounds)
-  if (fd < 0 || fd > currentID) {
+  return file_write(fdIndex, buf, count);
+}
+
+// HELPER FUNCTION - turns empty file of fd into an inline file
+// Needs FEATURE_INLINE & the slots right after the file's entry to be free.
+// The record is written through, so the slots are taken on disk right away
+static int inline_claim(int fdIndex)
+{
+  struct openFile *file = &files[fds[fdIndex].file];
+  struct root *ent = file->ent;
+  if (fat16 || !(superB->features & FEATURE_INLINE) ||
+      ent->size != 0 || ent->firstIndex != FAT_EOC) {
     return -1;
   }
 
-  // Find given FD in fds
-  int ind = find_fdsIndex(fd);
-
-  // If given fd is not in array of file descriptors
-  if (ind == -1) {
+  if (record_room(file) != 1) {
     return -1;
   }
 
-  // If found, reset FD values in fds
-  fds[ind].ID = -1;
-  fds[ind].offset = 0;
-  fds[ind].index = -1;
-  numOpenFiles--;
-  return 0;
+  ent->flags |= ROOT_FLAG_INLINE;
+  memset(ent + 1, 0, INLINE_MAX_BYTES);
+  return entry_write(&file->loc, ent);
 }
 
-int fs_stat(int fd)
+// HELPER FUNCTION - moves data of inline file of fd to a regular data block
+// Frees the record's inline slots. Returns -1 if the disk is full
+static int inline_spill(int fdIndex)
 {
-	/* TODO: Phase 3 */
-  // ERROR CHECKING
-  // No filesystem mounted
-  if (!FS) {
-    return -1;
-  }
-  // Invalid fd(not currently open or out of bounds)
-  if (fd < 0 || fd > currentID) {
+  struct openFile *file = &files[fds[fdIndex].file];
+  struct root *ent = file->ent;
+  char data[INLINE_MAX_BYTES];
+  if (find_freeFAT() == -1) {
     return -1;
   }
 
-  // Find given FD in fds
-  int ind = find_fdsIndex(fd);
-
-  // If given fd is not in array of file descriptors
-  if (ind == -1) {
+  memcpy(data, ent + 1, ent->size);
+  ent->flags &= ~ROOT_FLAG_INLINE;
+  memset(ent + 1, 0, INLINE_MAX_BYTES);
+  if (entry_write_slots(&file->loc, ent, RECORD_SLOTS)) {
     return -1;
   }
 
-  // If found, grab and return size of file pointed to by FD
-  return rootD[fds[ind].index].size;
+  // Rewrite the data at the start of the now regular file
+  size_t offset = fds[fdIndex].offset;
+  size_t size = ent->size;
+  fds[fdIndex].offset = 0;
+  ent->size = 0;
+  data_write(fdIndex, data, size);
+  fds[fdIndex].offset = offset;
+  return 0;
 }
 
-int fs_lseek(int fd, size_t offset)
+// HELPER FUNCTION - fills the gap between the end of the file of fd & its
+// offset past it. Clusters wholly in the gap become a hole, & the rest of the
+// gap is zeroed. Zeros are written over the whole gap if the file can't have
+// another hole. Returns -1, leaving the file as it was, if the disk hasn't
+// room for the zeros & the cluster at the offset
+static int sparse_extend(int fdIndex)
 {
-	/* TODO: Phase 3 */
-  // Grab size of file using fs_stat function
-  int fsize = fs_stat(fd);
-
-  // ERROR CHECKING
-  // fs_stat fails or given offset > than actual file size
-  if (fsize == -1 || fsize < (int)offset) {
+  size_t offset = fds[fdIndex].offset;
+  wbuf_flush(fdIndex);
+  struct root *ent = fd_entry(fdIndex);
+  size_t first = (ent->size + clusterSize - 1) / clusterSize;
+  size_t last = offset / clusterSize;
+  // Clusters in a hole take no room, the one at the offset does either way
+  size_t avail = fat_free_count() - numReserved;
+  while (last >= first && avail == 0 && reclaim_run(RECLAIM_BATCH)) {
+    avail = fat_free_count() - numReserved;
+  }
+  if (last >= first && avail == 0) {
     return -1;
   }
-  
-  // Find file in fds
-  int ind = find_fdsIndex(fd);
-
-  // If given fd is not in array of file descriptors
-  if (ind == -1) {
+  bool hole = last > first && !hole_add(fdIndex, first, last - first);
+  while (!hole && avail < last + 1 - first && reclaim_run(RECLAIM_BATCH)) {
+    avail = fat_free_count() - numReserved;
+  }
+  if (!hole && avail < last + 1 - first) {
     return -1;
   }
 
-  // If found, set offset of file to given offset
-  fds[ind].offset = offset;
-  return 0;
-}
-
-// HELPER FUNCTION - finds index of data block indicated by offset of fd
-int find_DBIndex(int fd) {
-  // Grab index of fds from fds.ID
-  int fdIndex = find_fdsIndex(fd);
-  // Grab index of file in root directory
-  int rootDIndex = fds[fdIndex].index;
-  // Grab index of first data block
-  uint16_t DBIndex = rootD[rootDIndex].firstIndex;
-  // Grab file offset
-  int offset = fds[fd].offset;
-
-  // If empty file, return -1
-  if (DBIndex == FAT_EOC) {
+  ent = fd_entry(fdIndex);
+  char *zero = pool_get();
+  if (!zero) {
     return -1;
   }
-
-  // Iterate through file's datablocks until datablock containing offset of file
-  while (offset >= BLOCK_SIZE) {
-    // Grab next data block of file
-    DBIndex = fat[DBIndex].entry;
-    // If next index wasn't allocated, out of bounds of file
-    if (DBIndex == FAT_EOC) {
-      return -1;
+  memset(zero, 0, BLOCK_SIZE);
+  int ret = 0;
+  fds[fdIndex].offset = ent->size;
+  while (fds[fdIndex].offset < offset && !ret) {
+    // Clusters of the hole are skipped
+    if (hole && fds[fdIndex].offset == first * clusterSize) {
+      fds[fdIndex].offset = last * clusterSize;
+      ent->size = fds[fdIndex].offset;
+      continue;
+    }
+    size_t stop = hole && fds[fdIndex].offset < first * clusterSize ?
+      first * clusterSize : offset;
+    size_t n = stop - fds[fdIndex].offset;
+    if (n > BLOCK_SIZE) {
+      n = BLOCK_SIZE;
     }
-    // Subtract BLOCK_SIZE after entering a new data block
-    offset = offset - BLOCK_SIZE;
+    ret = data_write(fdIndex, zero, n) == n ? 0 : -1;
   }
-
-  // Actual index of data block containing offset of file
-  // Need to account for actual data block start index from superblock
-  return DBIndex + superB->dataIndex;
+  pool_put(zero);
+  fds[fdIndex].offset = offset;
+  return ret;
 }
 
 int fs_write(int fd, void *buf, size_t count)
 {
 	/* TODO: Phase 4 */
   // ERROR CHECKING
-  // No filesystem mounted or buf is NULL
-  if (!FS || !buf) {
+  // No filesystem mounted or mounted read-only, or buf is NULL
+  if (!FS || readOnly || !buf) {
     return -1;
   }
-  
+
   // Grab index of file in fds
   int fdIndex = find_fdsIndex(fd);
 
@@ -523,94 +4682,83 @@ int fs_write(int fd, void *buf, size_t count)
   if (fdIndex == -1) {
     return -1;
   }
+  // Nothing to write, the file doesn't grow up to the offset either
+  if (count == 0) {
+    return 0;
+  }
 
-  // Index of file in root directory
-  int rootDIndex = fds[fdIndex].index;
-  // Offset of buffer holding stuff to write
-  int bufferOffset = 0;
-  // Remaing # of bytes to write
-  size_t remainBytes = count;
-  // Left & right offsets, # of bytes written
-  size_t lOffset, rOffset, writtenBytes;
-
-  int DBIndex = -1;
+  // Data buffered through other fds on the file goes first
+  wbuf_flush_others(fdIndex);
 
-  // Loop until no more bytes to write
-  int ind = 0;
-  while (remainBytes != 0) {
-    lOffset = 0;
-    // Left offset != 0 only during first block read
-    if (ind == 0) {
-      lOffset = fds[fdIndex].offset % BLOCK_SIZE;
+  // Tiny files live in their directory record, & never touch FAT or data
+  // blocks. A file moves to a data block once it outgrows the record
+  struct root *ent = fd_entry(fdIndex);
+  size_t end = fds[fdIndex].offset + count;
+  if (!(ent->flags & ROOT_FLAG_INLINE) && end <= INLINE_MAX_BYTES) {
+    inline_claim(fdIndex);
+  }
+  if (ent->flags & ROOT_FLAG_INLINE) {
+    if (end > INLINE_MAX_BYTES && inline_spill(fdIndex)) {
+      // Disk is full, write as many bytes as the record holds, none if the
+      // offset is past it
+      if (fds[fdIndex].offset >= INLINE_MAX_BYTES) {
+        return 0;
+      }
+      count = INLINE_MAX_BYTES - fds[fdIndex].offset;
+      end = INLINE_MAX_BYTES;
     }
-
-    rOffset = 0;
-    // Right offset != 0 if don't need to read another block
-    if (remainBytes + lOffset < BLOCK_SIZE) {
-      rOffset = BLOCK_SIZE - remainBytes - lOffset;
+    if (end <= INLINE_MAX_BYTES) {
+      memcpy((char*)(ent + 1) + fds[fdIndex].offset, buf, count);
+      fds[fdIndex].offset = end;
+      if (end > ent->size) {
+        ent->size = end;
+      }
+      sync_tick();
+      return count;
     }
+  }
 
-    DBIndex = find_DBIndex(fd);
+  // The extent list kept in the entry no longer holds once the chain changes
+  extents_stale(fdIndex);
 
-    // Bounce buffer to read entire data block into
-    void *bounceBuffer = malloc(BLOCK_SIZE);
-    // If can't find data block & no free FAT blocks
-    if (DBIndex == -1 && find_freeFAT() == -1) {
-      rootD[rootDIndex].size += count - remainBytes;
-      fprintf(stderr, "count: %ld, remainBytes %ld\n", count, remainBytes);
-      return count - remainBytes;
-    }
-    // If can't find data block & free FAT blocks, allocate new data block
-    if (DBIndex == -1) {
-      // Check for free FAT blocks
-      int newIndex = find_freeFAT();
-      // Grab index of first data block of file
-      uint16_t FATIndex = rootD[rootDIndex].firstIndex;
-      // If empty file size = 0,(first DBBlock == FAT_EOC), set first DBindex of file
-      if (FATIndex == FAT_EOC && newIndex != -1 && rootD[rootDIndex].size == 0) {
-        // index of first data block equal to newIndex
-        // i.e. 0xFFFF 0 0 3 0 0 0 0 0 0 ... 
-        rootD[rootDIndex].firstIndex = newIndex;
-        // fat[65535] = 3
-        FATIndex = newIndex;
-        // fat[3] = 0xFFFF
-        fat[newIndex].entry = FAT_EOC;
-      }
-      // Iterate through FAT until entry that points to index of FAT_EOC
-      while (fat[FATIndex].entry != FAT_EOC) {
-        FATIndex = fat[FATIndex].entry;
-      }
-      // FATIndex is now index of FAT_EOC
-      // If available FAT block(s), expand FAT link by 1 to found free FAT block
-      if (fat[FATIndex].entry != newIndex && newIndex != -1) {
-        fat[FATIndex].entry = newIndex;
-        fat[fat[FATIndex].entry].entry = FAT_EOC;
-      }
-    }
-    // If there is a data block, read DB into bounceBuffer
-    if (DBIndex != -1) {
-      block_read(DBIndex, bounceBuffer);
-    }
-
-    // Write into bounceBuffer, keep offsets in mind
-    writtenBytes = BLOCK_SIZE - lOffset - rOffset;
-    memcpy((char*)bounceBuffer+lOffset, (char*)buf+bufferOffset, writtenBytes);
-
-    DBIndex = find_DBIndex(fd);
-    // Write back to disk
-    block_write(DBIndex, bounceBuffer);
-
-    // Update variables & free allocated mem for bounce buffer each iteration
-    fds[fd].offset += writtenBytes;
-    bufferOffset += writtenBytes;
-    remainBytes -= writtenBytes;
-    free(bounceBuffer);
-    bounceBuffer = NULL;
-    ind++;
+  // Clusters shared with clones are copied before being written, all of them
+  // for compressed files, whose stream is rewritten from a frame boundary
+  if (cow_prepare(fdIndex, ent->flags & ROOT_FLAG_COMPRESSED ? SIZE_MAX :
+                  (end + clusterSize - 1) / clusterSize)) {
+    return 0;
+  }
+  struct openFile *file = &files[fds[fdIndex].file];
+  if (fds[fdIndex].offset / clusterSize < file->dedupFrom) {
+    file->dedupFrom = fds[fdIndex].offset / clusterSize;
   }
 
-  rootD[rootDIndex].size += count - remainBytes;
-  return count - remainBytes;
+  // Writing past the end leaves a gap, a hole if it spans whole clusters
+  if (fds[fdIndex].offset > ent->size && sparse_extend(fdIndex)) {
+    return 0;
+  }
+  ent = fd_entry(fdIndex);
+
+  // Small writes are gathered in the fd's buffer, compressed files only
+  // compressing them on flush, but for writes within sparse files, which may
+  // have to fill a hole
+  if (count < WBUF_BYTES &&
+      !((ent->flags & ROOT_FLAG_SPARSE) && fds[fdIndex].offset < ent->size)) {
+    int ret = wbuf_write(fdIndex, buf, count);
+    sync_tick();
+    return ret;
+  }
+  wbuf_flush(fdIndex);
+  // Large writes get the clusters they add as one run as well
+  if (!(ent->flags & ROOT_FLAG_COMPRESSED)) {
+    size_t chain = (ent->size + clusterSize - 1) / clusterSize;
+    size_t clusters = (end + clusterSize - 1) / clusterSize;
+    if (clusters > chain) {
+      chain_append_run(fdIndex, clusters - chain, true);
+    }
+  }
+  int ret = data_write(fdIndex, buf, count);
+  sync_tick();
+  return ret;
 }
 
 int fs_read(int fd, void *buf, size_t count)
@@ -630,45 +4778,125 @@ int fs_read(int fd, void *buf, size_t count)
     return -1;
   }
 
-  // Read buffer offset
-  int bufferOffset = 0;
-  // Remaing # of bytes to read
-  size_t remainBytes = count;
-  // Left & right offsets, # of bytes read
-  size_t lOffset, rOffset, readBytes;
+  // Never read past the end of the file
+  uint64_t size = fd_entry(fdIndex)->size;
+  if (fds[fdIndex].offset >= size) {
+    return 0;
+  }
+  if (count > size - fds[fdIndex].offset) {
+    count = size - fds[fdIndex].offset;
+  }
 
-  // Loop until no more bytes left to read
-  int ind = 0;
-  while (remainBytes != 0) {
-    lOffset = 0;
-    if (ind == 0) {
-      lOffset = fds[fdIndex].offset % BLOCK_SIZE;
-    }
+  // Buffered data must reach the data blocks before they are read
+  wbuf_flush_others(fdIndex);
+  if (fds[fdIndex].offset < fds[fdIndex].wbufStart + fds[fdIndex].wbufLen &&
+      fds[fdIndex].offset + count > fds[fdIndex].wbufStart) {
+    wbuf_flush(fdIndex);
+  }
 
-    rOffset = 0;
-    if (remainBytes + lOffset < BLOCK_SIZE) {
-      rOffset = BLOCK_SIZE - remainBytes - lOffset;
-    }
+  // Inline files are read straight from their directory record
+  struct root *ent = fd_entry(fdIndex);
+  if (ent->flags & ROOT_FLAG_INLINE) {
+    memcpy(buf, (char*)(ent + 1) + fds[fdIndex].offset, count);
+    fds[fdIndex].offset += count;
+    return count;
+  }
+  if (ent->flags & ROOT_FLAG_COMPRESSED) {
+    return comp_read(fdIndex, buf, count);
+  }
 
-    // Read data block into bounceBuffer
-    void *bounceBuffer = malloc(BLOCK_SIZE);
-    if (block_read(find_DBIndex(fd), bounceBuffer) == -1) {
-      fprintf(stderr, "Block reading ERROR\n");
-      return -1;
-    }
+  return file_read(fdIndex, buf, count);
+}
 
-    // Copy bounceBuffer into read buffer, keep offsets in mind
-    readBytes = BLOCK_SIZE - lOffset - rOffset;
-    memcpy((char*)buf+bufferOffset, (char*)bounceBuffer+lOffset, readBytes);
+// Map a file onto the virtual disk file
+int fs_extents(int fd, struct fs_extent *extents, size_t max)
+{
+  // ERROR CHECKING
+  // No filesystem mounted, or invalid fd
+  if (!FS || fd < 0 || fd > currentID) {
+    return -1;
+  }
+  int fdIndex = find_fdsIndex(fd);
+  if (fdIndex == -1) {
+    return -1;
+  }
+  // Inline & compressed content isn't in data blocks as is
+  struct root *ent = fd_entry(fdIndex);
+  wbuf_flush_others(fdIndex);
+  wbuf_flush(fdIndex);
+  if (ent->flags & (ROOT_FLAG_INLINE | ROOT_FLAG_COMPRESSED)) {
+    return -1;
+  }
+  return entry_extents(ent, extents, max);
+}
 
-    // Update variables
-    fds[fd].offset += readBytes;
-    bufferOffset += readBytes;
-    remainBytes -= readBytes;
-    free(bounceBuffer);
-    ind++;
+// HELPER FUNCTION - resolves the chain of entry @ent into extents, filling the
+// first @max of @extents. Returns the # of extents of the file
+static size_t entry_extents(const struct root *ent, struct fs_extent *extents,
+                            size_t max)
+{
+  size_t count = 0;
+  uint64_t offset = 0;
+  // Counting only, runs kept in the record spare walking the chain
+  const struct extentHeader *header = (const struct extentHeader*)(ent + 1);
+  if (!extents && (ent->flags & ROOT_FLAG_EXTENTS) && header->numRuns != 0 &&
+      header->numRuns <= EXTENT_INLINE_RUNS) {
+    const struct extentRun *runs = (const struct extentRun*)(header + 1);
+    for (uint32_t r = 0; r < header->numRuns && offset < ent->size; r++) {
+      offset += (uint64_t)runs[r].count * clusterSize;
+      count++;
+    }
+    return count;
   }
+  uint32_t i = ent->firstIndex;
+  while (i != FAT_EOC && offset < ent->size) {
+    // Holes have no extent, & stop the one before
+    bool hole;
+    size_t run;
+    file_pos(ent, offset / clusterSize, &hole, &run);
+    if (hole) {
+      offset += (uint64_t)run * clusterSize;
+      continue;
+    }
+    // Extend the extent while the next cluster follows on disk
+    uint32_t first = i;
+    uint32_t next = fat_get(i);
+    size_t clusters = 1;
+    while (next == i + 1 && clusters < run) {
+      i = next;
+      next = fat_get(i);
+      clusters++;
+    }
 
-  return count - remainBytes;
+    uint64_t length = (uint64_t)clusters * clusterSize;
+    if (length > ent->size - offset) {
+      length = ent->size - offset;
+    }
+    if (count < max) {
+      extents[count].file_offset = offset;
+      extents[count].disk_offset = cluster_block(first) * BLOCK_SIZE;
+      extents[count].length = length;
+    }
+    count++;
+    offset += length;
+    i = next;
+  }
+  return count;
 }
 
+// Flush buffered writes of a file descriptor
+int fs_flush(int fd)
+{
+  // ERROR CHECKING
+  // No filesystem mounted, or invalid fd
+  if (!FS) {
+    return -1;
+  }
+  int fdIndex = find_fdsIndex(fd);
+  if (fdIndex == -1) {
+    return -1;
+  }
+
+  wbuf_flush(fdIndex);
+  return 0;
+}
@@ -16,6 +16,52 @@
 /** Maximum number of open files */
 #define FS_OPEN_MAX_COUNT 32
 
+/** Format flag: 32-bit FAT entries and block counts, 64-bit file sizes */
+#define FS_FORMAT_FAT32 0x1
+/** Format flag: store files of up to 64 bytes in their directory entry */
+#define FS_FORMAT_INLINE 0x2
+/** Format flag: compress the content of files created on the image */
+#define FS_FORMAT_COMPRESS 0x4
+/** Format flag: reserve host disk space for the whole image up front */
+#define FS_FORMAT_PREALLOCATE 0x8
+/** Format flag: keep the extent list of each file in its directory entry */
+#define FS_FORMAT_EXTENTS 0x10
+
+/**
+ * struct fs_format_opts - File system format options
+ * @flags: Bitwise OR of %FS_FORMAT_* flags. Flags other than %FS_FORMAT_FAT32
+ * and %FS_FORMAT_PREALLOCATE require %FS_FORMAT_FAT32
+ * @cluster_blocks: Data blocks per cluster, the FAT's allocation unit. Must be
+ * a power of 2, and only %FS_FORMAT_FAT32 images can use more than 1 (0 means
+ * 1)
+ */
+struct fs_format_opts {
+	unsigned int flags;
+	unsigned int cluster_blocks;
+};
+
+/**
+ * fs_format - Create a new file system
+ * @diskname: Name of the virtual disk file
+ * @data_blk_count: Number of data blocks
+ * @opts: Format options, or NULL for the original 16-bit format
+ *
+ * Create (or truncate) the virtual disk file @diskname and write an empty file
+ * system with @data_blk_count data blocks into it, rounded up to a whole number
+ * of clusters. The original 16-bit format holds at most 8192 data blocks,
+ * %FS_FORMAT_FAT32 lifts that limit. Only the superblock, the first FAT block
+ * and the root directory are written: the rest of the FAT and the data blocks
+ * remain holes in the virtual disk file, so formatting takes the same time
+ * whatever the size. %FS_FORMAT_PREALLOCATE reserves host space for the holes
+ * without writing them.
+ *
+ * Return: -1 if @diskname is invalid or cannot be created, or if
+ * @data_blk_count is out of range for the requested format, or if host space
+ * cannot be reserved. 0 otherwise.
+ */
+int fs_format(const char *diskname, size_t data_blk_count,
+	      const struct fs_format_opts *opts);
+
 /**
  * fs_mount - Mount a file system
  * @diskname: Name of the virtual disk file
@@ -29,6 +75,76 @@
  */
 int fs_mount(const char *diskname);
 
+/** Mount flag: bypass the host's page cache, libfs caches metadata only */
+#define FS_MOUNT_DIRECT 0x1
+/** Mount flag: make the file system durable on every fs_close() */
+#define FS_MOUNT_SYNC_CLOSE 0x2
+/** Mount flag: make the file system durable periodically, in the background */
+#define FS_MOUNT_SYNC_PERIODIC 0x4
+/** Mount flag: share clusters of files holding the same data (32-bit only) */
+#define FS_MOUNT_DEDUP 0x8
+/** Mount flag: give the host disk space of freed clusters back to it */
+#define FS_MOUNT_DISCARD 0x10
+/** Mount flag: never write, sharing metadata with other read-only mounts */
+#define FS_MOUNT_READONLY 0x20
+
+/**
+ * struct fs_mount_opts - File system mount options
+ * @flags: Bitwise OR of %FS_MOUNT_* flags
+ * @sync_interval_ms: Minimum time between two commits of
+ * %FS_MOUNT_SYNC_PERIODIC, in milliseconds (0 means 100)
+ */
+struct fs_mount_opts {
+	unsigned int flags;
+	unsigned int sync_interval_ms;
+};
+
+/**
+ * fs_mount_opts - Mount a file system with options
+ * @diskname: Name of the virtual disk file
+ * @opts: Mount options, or NULL for the defaults of fs_mount()
+ *
+ * Mount the file system of virtual disk file @diskname like fs_mount() does.
+ * With %FS_MOUNT_DIRECT, the virtual disk file is accessed with direct I/O:
+ * reading and writing files neither fills nor depends on the host's page cache,
+ * and each read of file content goes to the disk. Buffers of any alignment can
+ * still be given to fs_read() and fs_write().
+ *
+ * By default, nothing is made durable before fs_umount(), and only as far as
+ * the host flushes its page cache. %FS_MOUNT_SYNC_CLOSE writes the metadata
+ * back and syncs the virtual disk file in each fs_close(), & in fs_umount().
+ * %FS_MOUNT_SYNC_PERIODIC commits instead: the first fs_write(), fs_close(),
+ * fs_create(), fs_mkdir() or fs_delete() at least @sync_interval_ms after the
+ * previous commit writes all buffered data and metadata back, and a background
+ * thread syncs the virtual disk file, one sync covering the commits of all
+ * writers made while the previous one ran.
+ *
+ * With %FS_MOUNT_DEDUP, the last fs_close() of a file hashes the clusters
+ * written since it was opened. If, from one of them on, the file holds the same
+ * data as another file up to their end, the file shares these clusters with it,
+ * copying them back on its next write there, like fs_clone(). Only clusters of
+ * files closed since mount are found, and the flag is ignored on 16-bit images.
+ *
+ * With %FS_MOUNT_DISCARD, clusters freed by fs_delete() or by rewriting files
+ * are punched out of the virtual disk file, handing their space to the host.
+ * Freed ranges are merged and discarded in batches, once the FAT freeing them
+ * is written back. Discarding stops if the host file system cannot punch holes;
+ * fs_trim() discards all free clusters at once instead.
+ *
+ * With %FS_MOUNT_READONLY, the virtual disk file is opened for reading only and
+ * nothing is ever written to it, not even by fs_umount(). fs_create(),
+ * fs_mkdir(), fs_delete(), fs_clone(), fs_write() and fs_trim() fail. The FAT
+ * and directory blocks are read through a shared read-only mapping of the file
+ * instead of the metadata cache, so that processes mounting the same image
+ * read-only all use one copy in the host's page cache. The other flags are
+ * ignored, and the image must not be modified while mounted so.
+ *
+ * Return: -1 if virtual disk file @diskname cannot be opened (or does not
+ * support direct I/O, or cannot be mapped), or if no valid file system can be
+ * located. 0 otherwise.
+ */
+int fs_mount_opts(const char *diskname, const struct fs_mount_opts *opts);
+
 /**
  * fs_umount - Unmount file system
  *
@@ -36,7 +152,10 @@ int fs_mount(const char *diskname);
  * disk file.
  *
  * Return: -1 if no FS is currently mounted, or if the virtual disk cannot be
- * closed, or if there are still open file descriptors. 0 otherwise.
+ * closed, or if there are still open file descriptors. -1 as well, once the
+ * file system is unmounted, if a block of the FAT or of the reference count
+ * table could not be read or written back while it was mounted: updates to it
+ * may then be lost. 0 otherwise.
  */
 int fs_umount(void);
 
@@ -49,6 +168,171 @@ int fs_umount(void);
  */
 int fs_info(void);
 
+/**
+ * struct fs_stats - File system statistics
+ * @cluster_size: Size of a cluster (the allocation unit) in bytes
+ * @total_clusters: Number of data clusters
+ * @free_clusters: Number of free data clusters, not counting those reserved by
+ * buffered writes
+ * @blocks_read: Number of blocks read from the virtual disk since mount
+ * @blocks_written: Number of blocks written to the virtual disk since mount
+ * @allocations: Number of heap allocations made by reads & writes since mount,
+ * beyond the mount's block buffer pool
+ * @syncs: Number of syncs of the virtual disk file since mount
+ * @sync_usecs: Total time spent in these syncs, in microseconds
+ * @sync_max_usecs: Longest of these syncs, in microseconds
+ * @dedup_clusters: Number of clusters found identical to those of another file
+ * and shared with it since mount, by %FS_MOUNT_DEDUP
+ * @reclaimed_clusters: Number of clusters of deleted files freed since mount
+ * @discarded_blocks: Number of blocks punched out of the virtual disk file since
+ * mount, by %FS_MOUNT_DISCARD or fs_trim()
+ */
+struct fs_stats {
+	size_t cluster_size;
+	size_t total_clusters;
+	size_t free_clusters;
+	size_t blocks_read;
+	size_t blocks_written;
+	size_t allocations;
+	size_t syncs;
+	size_t sync_usecs;
+	size_t sync_max_usecs;
+	size_t dedup_clusters;
+	size_t reclaimed_clusters;
+	size_t discarded_blocks;
+};
+
+/**
+ * fs_stats - Get file system statistics
+ * @stats: Statistics to fill
+ *
+ * Fill @stats with space usage and I/O counters of the currently mounted file
+ * system. Comparing the space used by files with their size gives the
+ * compression ratio of %FS_FORMAT_COMPRESS images.
+ *
+ * Return: -1 if no FS is currently mounted, or if @stats is NULL. 0 otherwise.
+ */
+int fs_stats(struct fs_stats *stats);
+
+/**
+ * fs_trim - Discard the free space of the file system
+ * @blocks: Number of blocks discarded, or NULL
+ *
+ * Write the metadata of the currently mounted file system back, finish freeing
+ * the clusters of deleted files, and punch every free cluster out of the
+ * virtual disk file, so that the host reclaims its space. Works whether the
+ * file system is mounted with %FS_MOUNT_DISCARD or not. Clusters never written
+ * are discarded as well and cost nothing.
+ *
+ * Return: -1 if no FS is currently mounted or it is mounted read-only, or if
+ * the host file system cannot punch holes in the virtual disk file. 0
+ * otherwise.
+ */
+int fs_trim(size_t *blocks);
+
+/**
+ * fs_checkpoint - Start tracking changes of the file system
+ *
+ * Write everything of the currently mounted file system back, then forget the
+ * blocks of its virtual disk file changed so far. Blocks written from now on
+ * are tracked, across mounts, for fs_delta_export() to copy. The first
+ * checkpoint adds a bitmap of changed blocks to the image (32-bit only); an
+ * image mounted again after a crash counts every block as changed.
+ *
+ * Return: -1 if no FS is currently mounted, if it is mounted read-only, if it
+ * is a 16-bit image, or if the disk runs out of space for the bitmap. 0
+ * otherwise.
+ */
+int fs_checkpoint(void);
+
+/** Delta flag: take a checkpoint once the delta is written */
+#define FS_DELTA_CHECKPOINT 0x1
+
+/**
+ * fs_delta_export - Write the blocks changed since the last checkpoint
+ * @deltaname: Name of the delta file to create
+ * @flags: Bitwise OR of %FS_DELTA_* flags
+ * @blocks: Number of blocks written to the delta, or NULL
+ *
+ * Write everything of the currently mounted file system back, then copy every
+ * block of its virtual disk file changed since the last fs_checkpoint() to
+ * delta file @deltaname. Applied with fs_delta_apply() to a copy of the image
+ * made at that checkpoint, the delta turns it into a copy of the image as it
+ * is now. With %FS_DELTA_CHECKPOINT, a checkpoint is taken along, so that the
+ * next delta applies on top of this one.
+ *
+ * Return: -1 if no FS is currently mounted, if no checkpoint was ever taken or
+ * it is mounted read-only, or if @deltaname cannot be written. 0 otherwise.
+ */
+int fs_delta_export(const char *deltaname, unsigned int flags, size_t *blocks);
+
+/**
+ * fs_delta_apply - Bring a copy of an image up to date
+ * @diskname: Name of the virtual disk file to update
+ * @deltaname: Name of a delta file written by fs_delta_export()
+ *
+ * Write the blocks of delta file @deltaname to virtual disk file @diskname,
+ * which must not be mounted, and make them durable. The image must be a copy
+ * of the one the delta was exported from, as of the checkpoint the delta
+ * starts at, or as of a later delta exported without %FS_DELTA_CHECKPOINT.
+ * The whole delta is checked before any block is written, and the superblock
+ * is written last: an image left partly updated by a failure still takes the
+ * delta again.
+ *
+ * Return: -1 if a FS is currently mounted, if either file cannot be opened, if
+ * the delta does not apply to @diskname, or if it is truncated. 0 otherwise.
+ */
+int fs_delta_apply(const char *diskname, const char *deltaname);
+
+/** Check flag: fix the problems found */
+#define FS_CHECK_REPAIR 0x1
+
+/**
+ * struct fs_check_report - Problems found by fs_check()
+ * @files: Number of files and directories checked
+ * @cycles: Number of chains looping back onto themselves
+ * @cross_links: Number of chains running into a cluster owned by another file
+ * @bad_links: Number of chains going out of the FAT or into a free cluster
+ * @size_mismatches: Number of files whose size does not match their chain
+ * @leaks: Number of allocated clusters that no file owns
+ * @ref_mismatches: Number of clusters shared by cloned files whose reference
+ * count is wrong
+ * @extent_mismatches: Number of files whose extent list does not match their
+ * chain
+ * @repaired: Number of problems fixed
+ */
+struct fs_check_report {
+	size_t files;
+	size_t cycles;
+	size_t cross_links;
+	size_t bad_links;
+	size_t size_mismatches;
+	size_t leaks;
+	size_t ref_mismatches;
+	size_t extent_mismatches;
+	size_t repaired;
+};
+
+/**
+ * fs_check - Check the consistency of a file system
+ * @diskname: Name of the virtual disk file
+ * @flags: Bitwise OR of %FS_CHECK_* flags
+ * @threads: Number of threads to check with, 0 meaning one per CPU
+ * @report: Report to fill with the problems found
+ *
+ * Check the file system in virtual disk file @diskname, which must not be
+ * mounted. The superblock is validated like fs_mount() does, then the chain of
+ * every file of every directory is walked. Each problem found is printed.
+ * With %FS_CHECK_REPAIR, broken chains are cut, sizes are fixed to match the
+ * chains, leaked clusters are freed and extent lists that do not match their
+ * chain are cleared, to be rebuilt when the file is next closed.
+ *
+ * Return: -1 if @diskname cannot be opened, or if it holds no valid file
+ * system, or if @report is NULL. 0 otherwise, even if problems were found.
+ */
+int fs_check(const char *diskname, unsigned int flags, unsigned int threads,
+	     struct fs_check_report *report);
+
 /**
  * fs_create - Create a new file
  * @filename: File name
@@ -56,27 +340,73 @@ int fs_info(void);
  * Create a new and empty file named @filename in the root directory of the
  * mounted file system. String @filename must be NULL-terminated and its total
  * length cannot exceed %FS_FILENAME_LEN characters (including the NULL
- * character).
+ * character). On 32-bit images, @filename can also be a path such as
+ * "dir/sub/file", whose components each follow that length rule, to create the
+ * file in an existing subdirectory.
  *
- * Return: -1 if no FS is currently mounted, or if @filename is invalid, or if a
- * file named @filename already exists, or if string @filename is too long, or
- * if the root directory already contains %FS_FILE_MAX_COUNT files. 0 otherwise.
+ * Return: -1 if no FS is currently mounted or it is mounted read-only, or if
+ * @filename is invalid, or if a file named @filename already exists, or if
+ * string @filename is too long, or if the root directory already contains
+ * %FS_FILE_MAX_COUNT files. 0 otherwise.
  */
 int fs_create(const char *filename);
 
+/**
+ * fs_mkdir - Create a new directory
+ * @dirname: Directory path
+ *
+ * Create a new and empty directory at path @dirname, following the same rules
+ * as fs_create(). Subdirectories are hashed: a name lookup reads a single
+ * block however many entries the directory holds. Only 32-bit images support
+ * subdirectories.
+ *
+ * Return: -1 if no FS is currently mounted or it is mounted read-only, or if
+ * the mounted FS is a 16-bit image, or if @dirname is invalid or already
+ * exists, or if its parent directory is full. 0 otherwise.
+ */
+int fs_mkdir(const char *dirname);
+
 /**
  * fs_delete - Delete a file
  * @filename: File name
  *
  * Delete the file named @filename from the root directory of the mounted file
- * system.
+ * system. @filename can be a path as in fs_create(), and can name an empty
+ * directory.
+ *
+ * On 32-bit images, the file's clusters are not freed before returning: the
+ * later operations that modify the file system free them a batch at a time,
+ * and allocations reclaim them first when no other cluster is free. Clusters
+ * still pending are freed by fs_umount(), or after the next fs_mount() if the
+ * image was not unmounted.
  *
  * Return: -1 if no FS is currently mounted, or if @filename is invalid, or if
- * Return: -1 if @filename is invalid, if there is no file named @filename to
- * delete, or if file @filename is currently open. 0 otherwise.
+ * Return: -1 if the FS is mounted read-only, if @filename is invalid, if there
+ * is no file named @filename to delete, or if file @filename is currently open,
+ * or if directory @filename is not empty. 0 otherwise.
  */
 int fs_delete(const char *filename);
 
+/**
+ * fs_clone - Clone a file
+ * @src: Path of the file to clone
+ * @dst: Path of the clone to create
+ *
+ * Create file @dst with the same content as file @src, following the same
+ * rules as fs_create(). The clone shares the clusters of @src instead of
+ * copying them, so cloning takes the same time whatever the size of @src.
+ * Clusters are copied when either file is written: as a shared cluster can
+ * only be replaced along with the clusters before it in the file, writing at a
+ * given offset copies the shared clusters up to that offset. Files of up to 64
+ * bytes stored inline are copied. Only 32-bit images support cloning.
+ *
+ * Return: -1 if no FS is currently mounted or it is mounted read-only, or if
+ * the mounted FS is a 16-bit image, or if @src does not exist or is a
+ * directory, or if @dst is invalid or already exists, or if the disk has no
+ * room left for its reference counts. 0 otherwise.
+ */
+int fs_clone(const char *src, const char *dst);
+
 /**
  * fs_ls - List files on file system
  *
@@ -86,13 +416,54 @@ int fs_delete(const char *filename);
  */
 int fs_ls(void);
 
+/** Directory entry flag: the entry is a directory */
+#define FS_DIRENT_DIR 0x1
+
+/**
+ * struct fs_dirent - Entry of the root directory
+ * @name: File name, NULL-terminated
+ * @size: Size of the file in bytes
+ * @data_blk: Index of the first data block of the file, as fs_ls() shows it
+ * @flags: Bitwise OR of %FS_DIRENT_* flags
+ * @extents: Number of extents of the file, as fs_extents() counts them, with
+ * %FS_READDIR_EXTENTS (0 otherwise, and for files with no such mapping)
+ */
+struct fs_dirent {
+	char name[FS_FILENAME_LEN];
+	size_t size;
+	unsigned int data_blk;
+	unsigned int flags;
+	size_t extents;
+};
+
+/** Readdir flag: count the extents of each file */
+#define FS_READDIR_EXTENTS 0x1
+
+/**
+ * fs_readdir - Read the entries of the root directory
+ * @entries: Array of entries to fill, in directory order
+ * @max: Number of entries of @entries, which can be NULL if @max is 0
+ * @flags: Bitwise OR of %FS_READDIR_* flags
+ *
+ * Fill @entries with the files fs_ls() lists, in one pass over the root
+ * directory, without opening them and without allocating. Sizes include data
+ * written to open files. With %FS_READDIR_EXTENTS, buffered writes of open
+ * files are flushed and the chain of each file is walked to count its extents.
+ *
+ * Return: -1 if no FS is currently mounted, or if @entries is NULL while @max
+ * is not 0. Otherwise return the number of entries of the root directory, of
+ * which only the first @max are filled.
+ */
+int fs_readdir(struct fs_dirent *entries, size_t max, unsigned int flags);
+
 /**
  * fs_open - Open a file
  * @filename: File name
  *
  * Open file named @filename for reading and writing, and return the
- * corresponding file descriptor. The file descriptor is a non-negative integer
- * that is used subsequently to access the contents of the file. The file offset
+ * corresponding file descriptor. @filename can be a path as in fs_create().
+ * The file descriptor is a non-negative integer that is used subsequently to
+ * access the contents of the file. The file offset
  * of the file descriptor is set to 0 initially (beginning of the file). If the
  * same file is opened multiple files, fs_open() must return distinct file
  * descriptors. A maximum of %FS_OPEN_MAX_COUNT files can be open
@@ -109,13 +480,37 @@ int fs_open(const char *filename);
  * fs_close - Close a file
  * @fd: File descriptor
  *
- * Close file descriptor @fd.
+ * Close file descriptor @fd. On images formatted with %FS_FORMAT_EXTENTS,
+ * closing the last file descriptor of a file keeps the extent list of the
+ * file in its directory entry, which fs_open() reads back so that seeks and
+ * reads don't walk the FAT chain.
  *
  * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
  * invalid (out of bounds or not currently open). 0 otherwise.
  */
 int fs_close(int fd);
 
+/**
+ * fs_flush - Flush buffered writes of a file descriptor
+ * @fd: File descriptor
+ *
+ * Small writes through file descriptor @fd are gathered in memory, and only
+ * reach the virtual disk when its buffer fills up, on fs_lseek() to another
+ * offset, on fs_close(), or when calling this function. Reads through any file
+ * descriptor see the buffered data. Disk space is reserved when the data is
+ * buffered, so flushing cannot run out of space, but clusters are only picked
+ * on flush. Knowing how much data follows lets the allocator place it in one
+ * contiguous run, even while several files grow at once.
+ *
+ * Buffers of compressed files are compressed on flush, only rewriting the
+ * frame the buffered data starts in and those after it. Space is reserved for
+ * these frames stored uncompressed, and what they don't take is freed again.
+ *
+ * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
+ * invalid (out of bounds or not currently open). 0 otherwise.
+ */
+int fs_flush(int fd);
+
 /**
  * fs_stat - Get file status
  * @fd: File descriptor
@@ -137,9 +532,14 @@ int fs_stat(int fd);
  * descriptor @fd to the argument @offset. To append to a file, one can call
  * fs_lseek(fd, fs_stat(fd));
  *
+ * @offset can be past the end of the file: the next write leaves a gap, which
+ * reads as zeros. On 32-bit images, whole clusters of the gap become a hole
+ * that takes no space on disk until written to, up to 8 holes per file. Other
+ * gaps are filled with zeros when written past.
+ *
  * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
  * invalid (i.e., out of bounds, or not currently open), or if @offset is larger
- * than the current file size. 0 otherwise.
+ * than the current size of a compressed file. 0 otherwise.
  */
 int fs_lseek(int fd, size_t offset);
 
@@ -159,9 +559,9 @@ int fs_lseek(int fd, size_t offset);
  * as many bytes as possible. The number of written bytes can therefore be
  * smaller than @count (it can even be 0 if there is no more space on disk).
  *
- * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
- * invalid (out of bounds or not currently open), or if @buf is NULL. Otherwise
- * return the number of bytes actually written.
+ * Return: -1 if no FS is currently mounted or it is mounted read-only, or if
+ * file descriptor @fd is invalid (out of bounds or not currently open), or if
+ * @buf is NULL. Otherwise return the number of bytes actually written.
  */
 int fs_write(int fd, void *buf, size_t count);
 
@@ -186,4 +586,36 @@ int fs_write(int fd, void *buf, size_t count);
  */
 int fs_read(int fd, void *buf, size_t count);
 
+/**
+ * struct fs_extent - Contiguous piece of a file in the virtual disk file
+ * @file_offset: Offset of the piece in the file
+ * @disk_offset: Offset of the piece in the virtual disk file
+ * @length: Length of the piece in bytes
+ */
+struct fs_extent {
+	size_t file_offset;
+	size_t disk_offset;
+	size_t length;
+};
+
+/**
+ * fs_extents - Map a file onto the virtual disk file
+ * @fd: File descriptor
+ * @extents: Array of extents to fill, in file order
+ * @max: Number of entries of @extents, which can be NULL if @max is 0
+ *
+ * Resolve the content of the file referenced by file descriptor @fd into the
+ * ranges of the virtual disk file that hold it, merging physically contiguous
+ * clusters. The last extent stops at the end of the file. The content can then
+ * be copied straight from the virtual disk file, for instance with
+ * copy_file_range(). Files stored in their directory entry or compressed have
+ * no such mapping.
+ *
+ * Return: -1 if no FS is currently mounted, or if file descriptor @fd is
+ * invalid (out of bounds or not currently open), or if the file content is not
+ * stored as is in data blocks. Otherwise return the number of extents of the
+ * file, of which only the first @max are filled.
+ */
+int fs_extents(int fd, struct fs_extent *extents, size_t max);
+
 #endif /* _FS_H */
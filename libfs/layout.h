@@ -0,0 +1,236 @@
+#ifndef _LAYOUT_H
+#define _LAYOUT_H
+
+// On-disk format of the file system, shared by fs.c & check.c. Private to
+// libfs, applications only see fs.h
+
+#include <stdint.h>
+
+#include "disk.h"
+
+#define SUPERBLOCK_UNUSED_BYTES 4079
+#define SUPERBLOCK32_UNUSED_BYTES 3978
+#define ENTRIES_PER_FAT_BLOCK 2048
+#define ENTRIES_PER_FAT32_BLOCK 1024
+#define SIGNATURE_BYTES 8
+#define FILENAME_SIZE 16
+#define ROOT_UNUSED_BYTES 10
+#define ROOT32_UNUSED_BYTES 3
+#define FAT16_EOC 0xFFFF
+#define FAT_EOC 0xFFFFFFFF
+#define FS_VERSION 2
+#define FAT16_MAX_DATA_BLOCKS 8192
+#define ROOT_FLAG_DIR 0x1
+#define ROOT_FLAG_INLINE 0x2
+#define ROOT_FLAG_COMPRESSED 0x4
+#define ROOT_FLAG_SPARSE 0x8
+#define ROOT_FLAG_EXTENTS 0x10
+#define INLINE_SLOTS 2
+#define INLINE_MAX_BYTES (INLINE_SLOTS * sizeof(struct root))
+#define RECORD_SLOTS (1 + INLINE_SLOTS)
+#define FEATURE_INLINE 0x1
+#define FEATURE_COMPRESS 0x2
+#define FEATURE_CLONE 0x4
+#define FEATURE_SPARSE 0x8
+#define FEATURE_RECLAIM 0x10
+#define FEATURE_CBT 0x20
+#define FEATURE_EXTENTS 0x40
+#define FEATURES_KNOWN (FEATURE_INLINE | FEATURE_COMPRESS | FEATURE_CLONE | \
+                        FEATURE_SPARSE | FEATURE_RECLAIM | FEATURE_CBT | \
+                        FEATURE_EXTENTS)
+#define COMP_FRAME_BYTES (64 * 1024)
+#define COMP_FRAME_RAW 0x80000000
+#define DIR_ENTRIES_PER_BLOCK (BLOCK_SIZE / sizeof(struct root))
+#define DIR_MAX_BUCKETS (1 << 20)
+#define REFS_PER_BLOCK (BLOCK_SIZE / sizeof(uint32_t))
+#define SPARSE_MAX_HOLES (INLINE_MAX_BYTES / sizeof(struct hole))
+#define RECLAIM_MAX 16
+#define EXTENT_INLINE_RUNS ((INLINE_MAX_BYTES - sizeof(struct extentHeader)) / \
+                            sizeof(struct extentRun))
+#define CBT_BITS_PER_BLOCK (BLOCK_SIZE * 8)
+#define DELTA_SIGNATURE "ECS150FD"
+
+// Struct representation of a 16-bit superblock(4096 bytes)
+// Original on-disk format, signature "ECS150FS"
+struct __attribute__((__packed__)) superblock16 {
+  // Signature(8 bytes)
+  uint8_t signature[SIGNATURE_BYTES];
+  // Total # of blocks of virtual disk(2 bytes)
+  uint16_t numBlocks;
+  // Root directory block index(2 bytes)
+  uint16_t rootIndex;
+  // Data block start index(2 bytes)
+  uint16_t dataIndex;
+  // Amount of data blocks(2 bytes)
+  uint16_t numDataBlocks;
+  // # of blocks for FAT(1 byte)
+  uint8_t numFATBlocks;
+  // Unused/Padding(4079 bytes)
+  uint8_t padding[SUPERBLOCK_UNUSED_BYTES];
+};
+
+// Struct representation of a 32-bit superblock(4096 bytes)
+// Extended on-disk format, signature "ECS150FX", also used in memory for both
+struct __attribute__((__packed__)) superblock {
+  // Signature(8 bytes)
+  uint8_t signature[SIGNATURE_BYTES];
+  // Format version(2 bytes)
+  uint16_t version;
+  // Total # of blocks of virtual disk(4 bytes)
+  uint32_t numBlocks;
+  // Root directory block index(4 bytes)
+  uint32_t rootIndex;
+  // Data block start index(4 bytes)
+  uint32_t dataIndex;
+  // Amount of data blocks(4 bytes)
+  uint32_t numDataBlocks;
+  // # of blocks for FAT(4 bytes)
+  uint32_t numFATBlocks;
+  // # of data blocks per cluster, FAT entries index clusters(4 bytes)
+  // 0 on images formatted before clusters existed, meaning 1
+  uint32_t clusterBlocks;
+  // FEATURE_* bits of format extensions the image uses(4 bytes)
+  uint32_t features;
+  // First cluster of the reference count table, with FEATURE_CLONE(4 bytes)
+  uint32_t refIndex;
+  // Chains of deleted files left to free, with FEATURE_RECLAIM(64 bytes)
+  // 0 for unused ones, see below
+  uint32_t reclaimIndex[RECLAIM_MAX];
+  // First cluster of the changed block bitmap, with FEATURE_CBT(4 bytes)
+  uint32_t cbtIndex;
+  // # of checkpoints of the bitmap(4 bytes)
+  uint32_t cbtGen;
+  // Nonzero while mounted read-write, with FEATURE_CBT(4 bytes)
+  uint32_t cbtOpen;
+  // Unused/Padding(3978 bytes)
+  uint8_t padding[SUPERBLOCK32_UNUSED_BYTES];
+};
+
+// FAT entries are not a struct anymore: a 16-bit FAT block holds 2048
+// uint16_t entries, a 32-bit FAT block holds 1024 uint32_t entries, and both
+// are accessed through fat_get()/fat_set(). FAT blocks are paged in on first
+// access through the metadata cache below, so mounting doesn't read the FAT
+
+// Struct representation of a 16-bit root directory entry(32 bytes)
+struct __attribute__((__packed__)) root16 {
+  // Filename(16 bytes)
+  uint8_t fileName[FILENAME_SIZE];
+  // Size of the file(4 bytes)
+  uint32_t size;
+  // Index of the first data block(2 bytes)
+  uint16_t firstIndex;
+  // Unused/Padding(10 bytes)
+  uint8_t padding[ROOT_UNUSED_BYTES];
+};
+
+// Struct representation of a 32-bit root directory entry(32 bytes)
+// Extended on-disk format, also used in memory for both
+struct __attribute__((__packed__)) root {
+  // Filename(16 bytes)
+  uint8_t fileName[FILENAME_SIZE];
+  // Size of the file(8 bytes)
+  uint64_t size;
+  // Index of the first data block(4 bytes)
+  uint32_t firstIndex;
+  // ROOT_FLAG_* bits, 0 for a regular file(1 byte)
+  uint8_t flags;
+  // Unused/Padding(3 bytes)
+  uint8_t padding[ROOT32_UNUSED_BYTES];
+};
+
+// With FEATURE_INLINE, a file of at most INLINE_MAX_BYTES can keep its data in
+// the INLINE_SLOTS entries right after its own(flagged ROOT_FLAG_INLINE), so
+// it needs no FAT entry or data block. Such an extended record must be
+// skipped as a whole when scanning a directory, see record_slots()
+
+// With FEATURE_CLONE, files made by fs_clone() share clusters. The reference
+// count table, a chain of its own starting at refIndex, holds a uint32_t per
+// cluster: # of references to the cluster beyond the first, from a directory
+// entry or the FAT entry of another cluster. A chain shared from some cluster
+// on is shared up to its end, so only the cluster where chains meet counts
+// them; a cluster is freed once it has no reference left
+
+// With FEATURE_RECLAIM, chains of deleted files are only unlinked from their
+// directory, & freed later a batch of clusters at a time. Each pending chain
+// starts at a reclaimIndex of the superblock, which moves along it as its
+// clusters get freed. The bit is cleared once no chain is left
+
+// With FEATURE_CBT, the changed block bitmap, a chain of its own starting at
+// cbtIndex, holds a bit per disk block(bit i % 8 of byte i / 8), set once the
+// block is written after the last checkpoint. Bitmap blocks are written
+// themselves, & so always set. A mount finding cbtOpen set wasn't unmounted
+// cleanly, & may have written blocks the bitmap misses: all count as changed
+
+// Struct representation of a delta header(4096 bytes)
+// Written by fs_delta_export(), followed by runs of changed blocks, each a
+// deltaRun then the content of its blocks, up to a run of 0 blocks
+struct __attribute__((__packed__)) deltaHeader {
+  // Signature "ECS150FD"(8 bytes)
+  uint8_t signature[SIGNATURE_BYTES];
+  // Total # of blocks of the image(4 bytes)
+  uint32_t numBlocks;
+  // cbtGen of the image the delta applies to, & of the image it makes(8 bytes)
+  uint32_t baseGen;
+  uint32_t gen;
+  // # of blocks in the delta(4 bytes)
+  uint32_t numChanged;
+  // Unused/Padding
+  uint8_t padding[BLOCK_SIZE - SIGNATURE_BYTES - 4 * sizeof(uint32_t)];
+};
+
+// Struct representation of a run of changed blocks in a delta(8 bytes)
+struct __attribute__((__packed__)) deltaRun {
+  // First block of the run(4 bytes)
+  uint32_t start;
+  // # of blocks of the run(4 bytes)
+  uint32_t count;
+};
+
+// Struct representation of a hole of a sparse file(8 bytes)
+// With FEATURE_SPARSE, files flagged ROOT_FLAG_SPARSE keep up to
+// SPARSE_MAX_HOLES holes in the INLINE_SLOTS entries right after their own,
+// sorted by first cluster, unused ones with a count of 0. Clusters of the file
+// in a hole read as zeros & aren't in the chain, which only holds the others
+struct __attribute__((__packed__)) hole {
+  // # of the first cluster of the hole within the file(4 bytes)
+  uint32_t start;
+  // # of clusters of the hole(4 bytes)
+  uint32_t count;
+};
+
+// Struct representation of the header of an extent list(8 bytes)
+// With FEATURE_EXTENTS, files flagged ROOT_FLAG_EXTENTS keep the runs of
+// contiguous clusters of their chain, in chain order, in the INLINE_SLOTS
+// entries right after their own: this header, then up to EXTENT_INLINE_RUNS
+// runs. Longer lists go to an overflow cluster of the file's own, holding as
+// many runs as fit. The FAT still links the chain; a list of 0 runs isn't up
+// to date, & gets rebuilt from the chain
+struct __attribute__((__packed__)) extentHeader {
+  // Overflow cluster holding the runs, 0 if they are inline(4 bytes)
+  uint32_t overflow;
+  // # of runs of the list(4 bytes)
+  uint32_t numRuns;
+};
+
+// Struct representation of a run of an extent list(8 bytes)
+struct __attribute__((__packed__)) extentRun {
+  // First cluster of the run(4 bytes)
+  uint32_t first;
+  // # of clusters of the run(4 bytes)
+  uint32_t count;
+};
+
+// Struct representation of a compressed frame header(8 bytes)
+// With FEATURE_COMPRESS, files flagged ROOT_FLAG_COMPRESSED hold a stream of
+// frames in their data blocks, each compressing COMP_FRAME_BYTES of the file
+// (less for the last one). Frames are packed back to back, regardless of
+// block boundaries
+struct __attribute__((__packed__)) frameHeader {
+  // # of bytes of the file held by the frame(4 bytes)
+  uint32_t rawLen;
+  // # of bytes of data following the header(4 bytes), with COMP_FRAME_RAW
+  // set if the data is stored uncompressed
+  uint32_t compLen;
+};
+
+#endif /* _LAYOUT_H */
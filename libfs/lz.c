@@ -0,0 +1,188 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "lz.h"
+
+// Compressed data is a sequence of sequences, each made of:
+//   token(1 byte): high nibble = # of literals, low nibble = match length - 4,
+//                  15 meaning the length goes on in the following bytes
+//   extra literal length bytes, added up until one is not 255
+//   literals
+//   match offset(2 bytes, little-endian, 1 to 65535 bytes back)
+//   extra match length bytes, added up until one is not 255
+// The last sequence only has literals, and ends the data
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+#define LZ_RUN_MASK 15
+// Search skips faster through data that keeps not matching
+#define LZ_SKIP_SHIFT 6
+
+// HELPER FUNCTION - reads 4 bytes at @p, whatever their alignment
+static uint32_t read32(const uint8_t *p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// HELPER FUNCTION - hashes 4 bytes into the match finder's table
+static uint32_t lz_hash(uint32_t v)
+{
+  return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// HELPER FUNCTION - writes the extra bytes of a length of at least 15
+static uint8_t *put_length(uint8_t *op, size_t len)
+{
+  for (len -= LZ_RUN_MASK; len >= 255; len -= 255) {
+    *op++ = 255;
+  }
+  *op++ = len;
+  return op;
+}
+
+// HELPER FUNCTION - reads the extra bytes of a length, -1 if input runs out
+static int get_length(const uint8_t **ip, const uint8_t *iend, size_t *len)
+{
+  uint8_t b;
+  do {
+    if (*ip >= iend) {
+      return -1;
+    }
+    b = *(*ip)++;
+    *len += b;
+  } while (b == 255);
+  return 0;
+}
+
+// HELPER FUNCTION - emits a sequence of @litLen literals at @lit, followed by
+// a match unless @matchLen is 0. Returns NULL if it doesn't fit before @oend
+static uint8_t *put_sequence(uint8_t *op, uint8_t *oend, const uint8_t *lit,
+                             size_t litLen, size_t offset, size_t matchLen)
+{
+  // Worst case size of the sequence
+  size_t need = 1 + litLen + litLen / 255 + 1 + 2 + matchLen / 255 + 1;
+  if (need > (size_t)(oend - op)) {
+    return NULL;
+  }
+
+  uint8_t *token = op++;
+  *token = (litLen >= LZ_RUN_MASK ? LZ_RUN_MASK : litLen) << 4;
+  if (litLen >= LZ_RUN_MASK) {
+    op = put_length(op, litLen);
+  }
+  memcpy(op, lit, litLen);
+  op += litLen;
+
+  if (matchLen) {
+    *op++ = offset & 0xFF;
+    *op++ = offset >> 8;
+    matchLen -= LZ_MIN_MATCH;
+    *token |= matchLen >= LZ_RUN_MASK ? LZ_RUN_MASK : matchLen;
+    if (matchLen >= LZ_RUN_MASK) {
+      op = put_length(op, matchLen);
+    }
+  }
+  return op;
+}
+
+size_t lz_compress(const void *src, size_t src_len, void *dst, size_t dst_cap)
+{
+  const uint8_t *base = src, *ip = src, *anchor = src;
+  const uint8_t *end = base + src_len;
+  uint8_t *op = dst, *oend = op + dst_cap;
+  // Last position of each hashed 4-byte sequence, relative to @base
+  uint32_t table[1 << LZ_HASH_BITS];
+  memset(table, 0, sizeof(table));
+
+  // A match needs 4 bytes to compare
+  const uint8_t *limit = src_len > LZ_MIN_MATCH ? end - LZ_MIN_MATCH : base;
+  while (ip < limit) {
+    uint32_t seq = read32(ip);
+    uint32_t h = lz_hash(seq);
+    const uint8_t *ref = base + table[h];
+    table[h] = ip - base;
+    if (ref >= ip || ip - ref > LZ_MAX_OFFSET || read32(ref) != seq) {
+      ip += 1 + ((ip - anchor) >> LZ_SKIP_SHIFT);
+      continue;
+    }
+
+    // Extend the match as far as it goes
+    const uint8_t *mp = ip + LZ_MIN_MATCH, *rp = ref + LZ_MIN_MATCH;
+    while (mp < end && *mp == *rp) {
+      mp++;
+      rp++;
+    }
+
+    op = put_sequence(op, oend, anchor, ip - anchor, ip - ref, mp - ip);
+    if (!op) {
+      return 0;
+    }
+    ip = anchor = mp;
+
+    // Remember a position inside the match, it helps on repetitive data
+    if (ip - 2 > base && ip + 2 <= end) {
+      table[lz_hash(read32(ip - 2))] = ip - 2 - base;
+    }
+  }
+
+  // Whatever is left is emitted as literals
+  op = put_sequence(op, oend, anchor, end - anchor, 0, 0);
+  if (!op) {
+    return 0;
+  }
+  return op - (uint8_t*)dst;
+}
+
+int lz_decompress(const void *src, size_t src_len, void *dst, size_t dst_len)
+{
+  const uint8_t *ip = src, *iend = ip + src_len;
+  uint8_t *op = dst, *oend = op + dst_len;
+
+  while (ip < iend) {
+    uint8_t token = *ip++;
+
+    // Literals
+    size_t len = token >> 4;
+    if (len == LZ_RUN_MASK && get_length(&ip, iend, &len)) {
+      return -1;
+    }
+    if (len > (size_t)(iend - ip) || len > (size_t)(oend - op)) {
+      return -1;
+    }
+    memcpy(op, ip, len);
+    op += len;
+    ip += len;
+    if (ip == iend) {
+      break;
+    }
+
+    // Match, which may overlap the bytes it produces
+    if (iend - ip < 2) {
+      return -1;
+    }
+    size_t offset = ip[0] | ip[1] << 8;
+    ip += 2;
+    len = token & LZ_RUN_MASK;
+    if (len == LZ_RUN_MASK && get_length(&ip, iend, &len)) {
+      return -1;
+    }
+    len += LZ_MIN_MATCH;
+    if (offset == 0 || offset > (size_t)(op - (uint8_t*)dst) ||
+        len > (size_t)(oend - op)) {
+      return -1;
+    }
+    const uint8_t *ref = op - offset;
+    if (offset >= len) {
+      memcpy(op, ref, len);
+      op += len;
+    } else {
+      while (len--) {
+        *op++ = *ref++;
+      }
+    }
+  }
+
+  return op == oend ? 0 : -1;
+}
@@ -0,0 +1,38 @@
+#ifndef _LZ_H
+#define _LZ_H
+
+#include <stddef.h> /* for size_t definition */
+
+/**
+ * lz_compress - Compress a buffer
+ * @src: Data to compress
+ * @src_len: Number of bytes of data to compress
+ * @dst: Buffer to be filled with compressed data
+ * @dst_cap: Size of buffer @dst
+ *
+ * Compress @src_len bytes of @src into @dst with a byte-oriented LZ77 codec
+ * (literal runs and back-references of at most 64 KB, in the spirit of LZ4).
+ * Compression stops as soon as the output would not fit in @dst_cap bytes, so
+ * passing a @dst_cap smaller than @src_len cheaply detects incompressible data.
+ *
+ * Return: 0 if the compressed data does not fit in @dst_cap bytes. Otherwise
+ * return the number of bytes written to @dst.
+ */
+size_t lz_compress(const void *src, size_t src_len, void *dst, size_t dst_cap);
+
+/**
+ * lz_decompress - Decompress a buffer
+ * @src: Data produced by lz_compress()
+ * @src_len: Number of bytes of compressed data
+ * @dst: Buffer to be filled with decompressed data
+ * @dst_len: Exact number of bytes the data decompresses to
+ *
+ * Decompress @src_len bytes of @src into @dst. Malformed input never makes the
+ * decoder read or write out of bounds.
+ *
+ * Return: -1 if @src is malformed or does not decompress to exactly @dst_len
+ * bytes. 0 otherwise.
+ */
+int lz_decompress(const void *src, size_t src_len, void *dst, size_t dst_len);
+
+#endif /* _LZ_H */